@@ -0,0 +1,270 @@
+// Checks every flocking kernel this CPU supports against the scalar
+// reference on candidates placed exactly on the boundary of a boid's vision:
+// on the sphere of the vision radius and on the surface of the view cone.
+// Rounding decides whether each is accepted, so a path that rounds
+// differently, for instance by fusing a multiply and an add, accepts
+// different neighbours. Exits non-zero on the first block of candidates
+// whose count differs, and times each path.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "boid_state.h"
+#include "flocking_kernel.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Candidates are compared in blocks of this many rows, a multiple of every
+// kernel's width, so no block is left to a kernel's scalar tail
+constexpr std::size_t kBlockSize = 8;
+
+struct Options {
+  std::size_t candidate_count = 100000;
+  double radius = 1;
+  double field_of_vision = 2;
+  int repeats = 5;
+  uint64_t seed = 1;
+};
+
+struct Result {
+  Flocking::InstructionSet instruction_set;
+  double ms = 0;
+  double accepted = 0;
+};
+
+Flocking::Parameters MakeParameters(const Options &options) {
+  return Flocking::Parameters{options.radius, options.field_of_vision, 1, 1,
+                              1, 1};
+}
+
+// A random unit vector
+void RandomDirection(std::mt19937_64 &random, double out[3]) {
+  std::normal_distribution<double> normal;
+  double length = 0;
+  while (!(length > 0)) {
+    for (int axis = 0; axis < 3; ++axis) {
+      out[axis] = normal(random);
+    }
+    length = std::sqrt(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+  }
+  for (int axis = 0; axis < 3; ++axis) {
+    out[axis] /= length;
+  }
+}
+
+// A random unit vector perpendicular to the unit vector `axis`
+void Perpendicular(std::mt19937_64 &random, const double axis[3],
+                   double out[3]) {
+  double along = 0;
+  do {
+    RandomDirection(random, out);
+    along = out[0] * axis[0] + out[1] * axis[1] + out[2] * axis[2];
+    for (int i = 0; i < 3; ++i) {
+      out[i] -= along * axis[i];
+    }
+    along = std::sqrt(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+  } while (!(along > 1e-3));
+  for (int i = 0; i < 3; ++i) {
+    out[i] /= along;
+  }
+}
+
+// Row 0 is the subject; the candidates follow it, alternately on the sphere
+// of the vision radius and on the view cone inside it
+Boids::BoidState MakeBoids(const Options &options) {
+  std::mt19937_64 random(options.seed);
+  std::uniform_real_distribution<double> coordinate(-1000, 1000);
+  std::uniform_real_distribution<double> fraction(0, 1);
+  Boids::BoidState boids;
+  const Position subject{{coordinate(random), coordinate(random),
+                          coordinate(random)}};
+  double heading[3];
+  RandomDirection(random, heading);
+  boids.PushBack(subject, Velocity{{heading[0], heading[1], heading[2]}},
+                 Acceleration{1}, 0);
+  const double cos_half_angle = std::cos(options.field_of_vision);
+  const double sin_half_angle = std::sin(options.field_of_vision);
+  for (std::size_t i = 0; i < options.candidate_count; ++i) {
+    double direction[3];
+    double length = options.radius;
+    if (i % 2 == 0) {
+      RandomDirection(random, direction);
+    } else {
+      double across[3];
+      Perpendicular(random, heading, across);
+      for (int axis = 0; axis < 3; ++axis) {
+        direction[axis] =
+            cos_half_angle * heading[axis] + sin_half_angle * across[axis];
+      }
+      length *= fraction(random);
+    }
+    const Position position{{subject.coords.x + length * direction[0],
+                             subject.coords.y + length * direction[1],
+                             subject.coords.z + length * direction[2]}};
+    boids.PushBack(position, Velocity{{0, 0, 0}}, Acceleration{1},
+                   static_cast<uint32_t>(i + 1));
+  }
+  return boids;
+}
+
+// Counts each block's accepted candidates, through both the range and the
+// list form, which lists the block's rows backwards
+void CountBlocks(const Flocking::Kernel &kernel,
+                 const Flocking::Subject &subject,
+                 const Boids::BoidState &boids, std::vector<double> &ranges,
+                 std::vector<double> &lists) {
+  ranges.clear();
+  lists.clear();
+  std::uint32_t rows[kBlockSize];
+  for (std::size_t begin = 1; begin + kBlockSize <= boids.size();
+       begin += kBlockSize) {
+    Flocking::SteeringSums sums;
+    kernel.Accumulate(subject, boids, begin, begin + kBlockSize, sums);
+    ranges.push_back(sums.count);
+    for (std::size_t k = 0; k < kBlockSize; ++k) {
+      rows[k] = static_cast<std::uint32_t>(begin + kBlockSize - 1 - k);
+    }
+    sums = Flocking::SteeringSums{};
+    kernel.Accumulate(subject, boids, rows, kBlockSize, sums);
+    lists.push_back(sums.count);
+  }
+}
+
+// Reports the first block whose count differs; returns whether all agree
+bool Compare(const char *path, const std::vector<double> &expected,
+             const std::vector<double> &actual) {
+  for (std::size_t block = 0; block < expected.size(); ++block) {
+    if (actual[block] != expected[block]) {
+      std::cerr << path << " differs on rows " << 1 + block * kBlockSize
+                << " to " << (block + 1) * kBlockSize << ": "
+                << expected[block] << " neighbours expected, "
+                << actual[block] << " accepted" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+void PrintUsage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--candidates=<count>] [--radius=<radius>]"
+               " [--field-of-vision=<radians>] [--repeats=<count>]"
+               " [--seed=<seed>]"
+            << std::endl;
+}
+
+bool ParseOptions(int argc, char **argv, Options *options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *argument = argv[i];
+    const char *value = std::strchr(argument, '=');
+    if (!value) {
+      return false;
+    }
+    const std::string name(argument, value++);
+    if (name == "--candidates") {
+      options->candidate_count =
+          static_cast<std::size_t>(std::max(1, std::atoi(value)));
+    } else if (name == "--radius") {
+      options->radius = std::strtod(value, nullptr);
+    } else if (name == "--field-of-vision") {
+      options->field_of_vision = std::strtod(value, nullptr);
+    } else if (name == "--repeats") {
+      options->repeats = std::max(1, std::atoi(value));
+    } else if (name == "--seed") {
+      options->seed = std::strtoull(value, nullptr, 0);
+    } else {
+      return false;
+    }
+  }
+  // Whole blocks only
+  options->candidate_count =
+      (options->candidate_count + kBlockSize - 1) / kBlockSize * kBlockSize;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  const auto boids = MakeBoids(options);
+  const auto parameters = MakeParameters(options);
+  const auto widest = Flocking::DetectInstructionSet();
+
+  std::vector<double> expected_ranges;
+  std::vector<double> expected_lists;
+  std::vector<double> ranges;
+  std::vector<double> lists;
+  std::vector<Result> results;
+  for (const auto instruction_set :
+       {Flocking::InstructionSet::kScalar, Flocking::InstructionSet::kAvx2,
+        Flocking::InstructionSet::kAvx512}) {
+    if (instruction_set > widest) {
+      break;
+    }
+    const Flocking::Kernel kernel(parameters, instruction_set);
+    if (kernel.instruction_set() != instruction_set) {
+      continue;
+    }
+    const auto subject = kernel.MakeSubject(boids, 0);
+    const char *path = Flocking::ToString(instruction_set);
+    if (results.empty()) {
+      CountBlocks(kernel, subject, boids, expected_ranges, expected_lists);
+      if (!Compare(path, expected_ranges, expected_lists)) {
+        return 1;
+      }
+    } else {
+      CountBlocks(kernel, subject, boids, ranges, lists);
+      if (!Compare(path, expected_ranges, ranges) ||
+          !Compare(path, expected_lists, lists)) {
+        return 1;
+      }
+    }
+
+    Result result{instruction_set};
+    for (int repeat = 0; repeat < options.repeats; ++repeat) {
+      Flocking::SteeringSums sums;
+      const auto start = Clock::now();
+      kernel.Accumulate(subject, boids, 1, boids.size(), sums);
+      result.ms +=
+          std::chrono::duration<double, std::milli>(Clock::now() - start)
+              .count();
+      result.accepted = sums.count;
+    }
+    if (!results.empty() && result.accepted != results.front().accepted) {
+      std::cerr << path << " accepted " << result.accepted
+                << " neighbours in all, " << results.front().accepted
+                << " expected" << std::endl;
+      return 1;
+    }
+    results.push_back(result);
+  }
+
+  std::printf("%zu candidates on the boundary, radius %g, field of vision %g\n",
+              options.candidate_count, options.radius,
+              options.field_of_vision);
+  std::printf("%-10s %12s %16s %12s\n", "path", "ms/pass", "ns/candidate",
+              "accepted");
+  for (const auto &result : results) {
+    const double ms = result.ms / options.repeats;
+    std::printf("%-10s %12.3f %16.2f %12.0f\n",
+                Flocking::ToString(result.instruction_set), ms,
+                ms * 1e6 / options.candidate_count, result.accepted);
+  }
+  std::printf("Results match\n");
+  return 0;
+}
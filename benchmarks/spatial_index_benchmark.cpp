@@ -0,0 +1,462 @@
+// Compares the movement system's spatial indexes with one absolute sphere
+// query per boid on the local runtime. Every path must find the same
+// neighbours for the sampled boids, and the tree's k nearest must match a
+// brute-force search; exits non-zero on the first boid that differs. Reports
+// the build and lookup cost of each index, the candidates each lookup tests
+// and the memory each index holds.
+
+#include <improbable/system/c_query.h>
+#include <improbable/system/c_system.h>
+#include <local_runtime/local_runtime.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "boid_state.h"
+#include "component_access.h"
+#include "scratch_arena.h"
+#include "spatial_grid.h"
+#include "spatial_tree.h"
+#include "spawn.h"
+#include "thread_pool.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  Spawn::Parameters spawn = {Spawn::Layout::kClustered, 20000, {}, /*seed=*/1};
+  double radius = 1;
+  // Boids whose neighbours are also fetched from the runtime, one query each
+  int samples = 1000;
+  std::size_t k = 8;
+  std::size_t leaf_size = Spatial::BoundingVolumeTree::kDefaultLeafSize;
+  int repeats = 5;
+  // Moves the first boids far away, one per coordinate, to (c, 0, c): the
+  // indexes must survive huge, infinite and NaN positions. Outliers are
+  // always sampled.
+  std::vector<double> outliers;
+};
+
+// A boid's neighbours, as positions in a canonical order
+using Neighbours = std::vector<std::tuple<double, double, double>>;
+
+struct Timing {
+  double build_ms = 0;
+  double lookup_ms = 0;
+  uint64_t candidates = 0;
+  uint64_t matches = 0;
+  std::size_t memory_bytes = 0;
+};
+
+struct Run {
+  const Options *options;
+  std::vector<std::size_t> samples;
+  std::vector<Neighbours> reference;
+  double reference_ms = 0;
+  Timing grid;
+  Timing tree;
+  Timing refit;
+  Timing nearest;
+  System_StatusCode rc = SYSTEM_STATUS_CODE_SUCCESS;
+};
+
+double Milliseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+bool Within(const Boids::BoidState &boids, std::size_t row, double x,
+            double y, double z, double radius) {
+  const double dx = boids.position_x[row] - x;
+  const double dy = boids.position_y[row] - y;
+  const double dz = boids.position_z[row] - z;
+  return dx * dx + dy * dy + dz * dz <= radius * radius;
+}
+
+void Add(const Boids::BoidState &boids, std::size_t row,
+         Neighbours &neighbours) {
+  neighbours.emplace_back(boids.position_x[row], boids.position_y[row],
+                          boids.position_z[row]);
+}
+
+// The current approach: a runtime query around each sampled boid
+System_StatusCode QueryEachBoid(Run &run, const Boids::BoidState &boids) {
+  run.reference.assign(run.samples.size(), {});
+  for (std::size_t i = 0; i < run.samples.size(); ++i) {
+    const auto row = run.samples[i];
+    auto constraint = System_Query_Constraint_CreateAbsoluteSphere(
+        System_Double3{boids.position_x[row], boids.position_y[row],
+                       boids.position_z[row]},
+        run.options->radius);
+    auto query = std::unique_ptr<System_Query_Handle_Data,
+                                 decltype(&System_Query_Destroy)>{
+        System_Query_Create(&constraint), System_Query_Destroy};
+    if (!query) {
+      return SYSTEM_STATUS_CODE_ERROR;
+    }
+    for (; !System_Query_IterationFinished(query.get());
+         System_Query_NextEntity(query.get())) {
+      Position position;
+      if (auto status = Components::Get(query.get(), position); !status.ok()) {
+        return status.code;
+      }
+      run.reference[i].emplace_back(position.coords.x, position.coords.y,
+                                    position.coords.z);
+    }
+    std::sort(run.reference[i].begin(), run.reference[i].end());
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+// Looks up every boid's neighbours through `ranges`, which calls its visitor
+// with candidate ranges of `sorted`, and checks the sampled boids' against
+// the runtime's. Returns false if any differ.
+template <typename Ranges>
+bool LookUpEveryBoid(Run &run, const Boids::BoidState &boids,
+                     const Boids::BoidState &sorted, const char *path,
+                     Ranges &&ranges, Timing &timing) {
+  const double radius = run.options->radius;
+  const auto start = Clock::now();
+  uint64_t candidates = 0;
+  uint64_t matches = 0;
+  for (std::size_t row = 0; row < boids.size(); ++row) {
+    const double x = boids.position_x[row];
+    const double y = boids.position_y[row];
+    const double z = boids.position_z[row];
+    ranges(x, y, z, [&](std::size_t begin, std::size_t end) {
+      candidates += end - begin;
+      for (auto slot = begin; slot < end; ++slot) {
+        matches += Within(sorted, slot, x, y, z, radius) ? 1 : 0;
+      }
+    });
+  }
+  timing.lookup_ms += Milliseconds(Clock::now() - start);
+  timing.candidates = candidates;
+  timing.matches = matches;
+
+  for (std::size_t i = 0; i < run.samples.size(); ++i) {
+    const auto row = run.samples[i];
+    const double x = boids.position_x[row];
+    const double y = boids.position_y[row];
+    const double z = boids.position_z[row];
+    Neighbours found;
+    ranges(x, y, z, [&](std::size_t begin, std::size_t end) {
+      for (auto slot = begin; slot < end; ++slot) {
+        if (Within(sorted, slot, x, y, z, radius)) {
+          Add(sorted, slot, found);
+        }
+      }
+    });
+    std::sort(found.begin(), found.end());
+    if (found != run.reference[i]) {
+      std::cerr << "Boid " << row << " differs on the " << path << ": "
+                << run.reference[i].size() << " neighbours expected, "
+                << found.size() << " found" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Checks the tree's k nearest of the sampled boids against a full scan
+bool CheckNearest(const Run &run, const Boids::BoidState &boids,
+                  const Boids::BoidState &sorted,
+                  const Spatial::BoundingVolumeTree &tree) {
+  const auto k = run.options->k;
+  std::vector<uint32_t> slots(k);
+  std::vector<double> distances_sq(k);
+  std::vector<double> expected;
+  for (const auto row : run.samples) {
+    const double x = boids.position_x[row];
+    const double y = boids.position_y[row];
+    const double z = boids.position_z[row];
+    expected.clear();
+    for (std::size_t other = 0; other < boids.size(); ++other) {
+      const double dx = boids.position_x[other] - x;
+      const double dy = boids.position_y[other] - y;
+      const double dz = boids.position_z[other] - z;
+      const double distance_sq = dx * dx + dy * dy + dz * dz;
+      // As Within, a NaN distance is no neighbour
+      if (!std::isnan(distance_sq)) {
+        expected.push_back(distance_sq);
+      }
+    }
+    const auto found_count = std::min(k, expected.size());
+    std::partial_sort(expected.begin(), expected.begin() + found_count,
+                      expected.end());
+    const auto found = tree.KNearest(
+        sorted.position_x.data(), sorted.position_y.data(),
+        sorted.position_z.data(), x, y, z, k, HUGE_VAL, slots.data(),
+        distances_sq.data());
+    if (found != found_count ||
+        !std::equal(distances_sq.begin(), distances_sq.begin() + found,
+                    expected.begin())) {
+      std::cerr << "Boid " << row << " has different " << k
+                << " nearest in the tree" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Runs every path in the only tick, where queries see the created entities
+bool CompareAll(Run &run, const Boids::BoidState &boids) {
+  const auto &options = *run.options;
+  const double radius = options.radius;
+  Boids::BoidState sorted;
+  Memory::ScratchArena arena;
+  Spatial::UniformGrid grid;
+  Spatial::BoundingVolumeTree tree;
+  std::vector<uint32_t> slots(options.k);
+  std::vector<double> distances_sq(options.k);
+
+  for (int repeat = 0; repeat < options.repeats; ++repeat) {
+    auto start = Clock::now();
+    if (auto rc = QueryEachBoid(run, boids); rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      std::cerr << "Sphere query failed (received status code: " << rc << ")"
+                << std::endl;
+      run.rc = rc;
+      return false;
+    }
+    run.reference_ms += Milliseconds(Clock::now() - start);
+
+    arena.Reset();
+    start = Clock::now();
+    grid.Build(boids.position_x.data(), boids.position_y.data(),
+               boids.position_z.data(), boids.size(), radius, arena);
+    run.grid.build_ms += Milliseconds(Clock::now() - start);
+    run.grid.memory_bytes = arena.high_water_mark();
+    sorted.Permute(boids, grid.order());
+    if (!LookUpEveryBoid(
+            run, boids, sorted, "grid",
+            [&](double x, double y, double z, auto &&visit) {
+              grid.ForEachCandidateRange(x, y, z, radius, visit);
+            },
+            run.grid)) {
+      return false;
+    }
+
+    start = Clock::now();
+    tree.Build(boids.position_x.data(), boids.position_y.data(),
+               boids.position_z.data(), boids.size(), options.leaf_size);
+    run.tree.build_ms += Milliseconds(Clock::now() - start);
+    run.tree.memory_bytes = tree.memory_bytes();
+    sorted.Permute(boids, tree.order());
+    const auto tree_ranges = [&](double x, double y, double z,
+                                 auto &&visit) {
+      tree.ForEachCandidateRange(x, y, z, radius, visit);
+    };
+    if (!LookUpEveryBoid(run, boids, sorted, "tree", tree_ranges, run.tree)) {
+      return false;
+    }
+
+    // The positions have not moved, so a refit tree looks up as fast as a
+    // built one; this times the refit itself
+    start = Clock::now();
+    tree.Refit(boids.position_x.data(), boids.position_y.data(),
+               boids.position_z.data());
+    run.refit.build_ms += Milliseconds(Clock::now() - start);
+    run.refit.memory_bytes = tree.memory_bytes();
+    if (!LookUpEveryBoid(run, boids, sorted, "refit tree", tree_ranges,
+                         run.refit)) {
+      return false;
+    }
+
+    start = Clock::now();
+    uint64_t nearest = 0;
+    for (std::size_t row = 0; row < boids.size(); ++row) {
+      nearest += tree.KNearest(
+          sorted.position_x.data(), sorted.position_y.data(),
+          sorted.position_z.data(), boids.position_x[row],
+          boids.position_y[row], boids.position_z[row], options.k, radius,
+          slots.data(), distances_sq.data());
+    }
+    run.nearest.lookup_ms += Milliseconds(Clock::now() - start);
+    run.nearest.matches = nearest;
+    run.nearest.memory_bytes = tree.memory_bytes();
+    if (!CheckNearest(run, boids, sorted, tree)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+System_StatusCode CompareTick(System_Handle, System_EntityIterator iterator,
+                              void *user_context, uint32_t) {
+  auto &run = *static_cast<Run *>(user_context);
+  Boids::BoidState boids;
+  for (; !System_IterationFinished(iterator); System_NextEntity(iterator)) {
+    Position position;
+    Velocity velocity;
+    Acceleration acceleration;
+    if (auto status =
+            Components::Get(iterator, position, velocity, acceleration);
+        !status.ok()) {
+      return run.rc = status.code;
+    }
+    boids.PushBack(position, velocity, acceleration,
+                   static_cast<uint32_t>(boids.size()));
+  }
+  if (boids.size() == 0) {
+    return SYSTEM_STATUS_CODE_SUCCESS;
+  }
+  std::mt19937_64 random(run.options->spawn.seed + 1);
+  std::uniform_int_distribution<std::size_t> pick(0, boids.size() - 1);
+  for (std::size_t row = 0;
+       row < std::min(run.options->outliers.size(), boids.size()); ++row) {
+    run.samples.push_back(row);
+  }
+  for (int i = 0; i < run.options->samples; ++i) {
+    run.samples.push_back(pick(random));
+  }
+  if (!CompareAll(run, boids) && run.rc == SYSTEM_STATUS_CODE_SUCCESS) {
+    run.rc = SYSTEM_STATUS_CODE_ERROR;
+  }
+  return run.rc;
+}
+
+void PrintUsage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--entities=<count>] [--layout=grid|uniform|clustered|poisson]"
+               " [--world-bounds=<x>,<z>]"
+               " [--clusters=<count>] [--cluster-radius=<distance>]"
+               " [--radius=<radius>] [--samples=<count>] [--k=<count>]"
+               " [--leaf-size=<count>] [--repeats=<count>] [--seed=<seed>]"
+               " [--outlier=<coordinate>]..."
+            << std::endl;
+}
+
+bool ParseOptions(int argc, char **argv, Options *options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *argument = argv[i];
+    const char *value = std::strchr(argument, '=');
+    if (!value) {
+      return false;
+    }
+    const std::string name(argument, value++);
+    if (name == "--entities") {
+      options->spawn.entity_count =
+          static_cast<std::size_t>(std::max(1, std::atoi(value)));
+    } else if (name == "--layout") {
+      if (!Spawn::ParseLayout(value, &options->spawn.layout)) {
+        return false;
+      }
+    } else if (name == "--world-bounds") {
+      char *end = nullptr;
+      options->spawn.world_bounds.x = std::strtod(value, &end);
+      options->spawn.world_bounds.z =
+          *end == ',' ? std::strtod(end + 1, nullptr)
+                      : options->spawn.world_bounds.x;
+    } else if (name == "--clusters") {
+      options->spawn.cluster_count =
+          static_cast<std::size_t>(std::max(1, std::atoi(value)));
+    } else if (name == "--cluster-radius") {
+      options->spawn.cluster_radius =
+          std::max(0.0, std::strtod(value, nullptr));
+    } else if (name == "--radius") {
+      options->radius = std::strtod(value, nullptr);
+    } else if (name == "--samples") {
+      options->samples = std::max(0, std::atoi(value));
+    } else if (name == "--k") {
+      options->k = static_cast<std::size_t>(std::max(1, std::atoi(value)));
+    } else if (name == "--leaf-size") {
+      options->leaf_size =
+          static_cast<std::size_t>(std::max(1, std::atoi(value)));
+    } else if (name == "--repeats") {
+      options->repeats = std::max(1, std::atoi(value));
+    } else if (name == "--seed") {
+      options->spawn.seed = std::strtoull(value, nullptr, 0);
+    } else if (name == "--outlier") {
+      options->outliers.push_back(std::strtod(value, nullptr));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+void PrintRow(const char *path, const Timing &timing, int repeats,
+              std::size_t lookups) {
+  const double lookup_ms = timing.lookup_ms / repeats;
+  std::printf("%-12s %10.3f %10.3f %12.1f %12.2f %12.2f %12zu\n", path,
+              timing.build_ms / repeats, lookup_ms,
+              lookups > 0 ? lookup_ms * 1e6 / lookups : 0,
+              lookups > 0 ? static_cast<double>(timing.candidates) / lookups
+                          : 0,
+              lookups > 0 ? static_cast<double>(timing.matches) / lookups : 0,
+              timing.memory_bytes);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  LocalRuntime_Reset();
+  LocalRuntime_Configuration configuration;
+  LocalRuntime_DefaultConfiguration(&configuration);
+  configuration.execution_mode =
+      LOCAL_RUNTIME_EXECUTION_MODE_AS_FAST_AS_POSSIBLE;
+  configuration.max_ticks = 1;
+  configuration.log_level = LOG_LEVEL_WARN;
+  LocalRuntime_Configure(&configuration);
+
+  const auto system_handle =
+      std::unique_ptr<System_Handle_Data, decltype(&System_Destroy)>{
+          System_Init(), System_Destroy};
+  Spawn::Buffers buffers;
+  {
+    Threading::ThreadPool pool(1);
+    Spawn::Generate(options.spawn, pool, buffers);
+  }
+  for (std::size_t i = 0;
+       i < std::min(options.outliers.size(), buffers.size()); ++i) {
+    const double c = options.outliers[i];
+    buffers.positions[i] = Position{{c, 0, c}};
+  }
+  if (Spawn::Submit(system_handle.get(), buffers, "boids") !=
+      SYSTEM_STATUS_CODE_SUCCESS) {
+    std::cerr << "Failed to create entities" << std::endl;
+    return 1;
+  }
+
+  Run run;
+  run.options = &options;
+  if (auto rc = SYSTEM_RUN(system_handle.get(), CompareTick, &run);
+      rc != SYSTEM_STATUS_CODE_SUCCESS || run.rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    return 1;
+  }
+
+  const auto boids = buffers.size();
+  const auto samples = run.samples.size();
+  const int repeats = options.repeats;
+  std::printf("%zu boids (%s), radius %g, %zu nearest, leaves of %zu\n", boids,
+              Spawn::ToString(options.spawn.layout), options.radius, options.k,
+              options.leaf_size);
+  std::printf("%-12s %10s %10s %12s %12s %12s %12s\n", "path", "build ms",
+              "lookup ms", "ns/lookup", "candidates", "matches", "bytes");
+  const double reference_ms = run.reference_ms / repeats;
+  std::printf("%-12s %10s %10.3f %12.1f %12s %12s %12s\n", "per-query", "-",
+              reference_ms, samples > 0 ? reference_ms * 1e6 / samples : 0,
+              "-", "-", "-");
+  PrintRow("grid", run.grid, repeats, boids);
+  PrintRow("tree", run.tree, repeats, boids);
+  PrintRow("tree refit", run.refit, repeats, boids);
+  PrintRow("tree k-nn", run.nearest, repeats, boids);
+  std::printf("Results match\n");
+  return 0;
+}
@@ -0,0 +1,297 @@
+// Checks System_Query_SphereBatch against one absolute sphere query per
+// sphere on the local runtime, and times both. Exits non-zero if any sphere's
+// matches differ.
+
+#include <improbable/system/c_query.h>
+#include <improbable/system/c_system.h>
+#include <local_runtime/local_runtime.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "component_access.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  int entity_count = 10000;
+  // Spheres are centred on randomly chosen entities
+  int sphere_count = 10000;
+  double radius = 1;
+  // Mean distance between entities, spread over a square world as the
+  // movement system spawns them
+  double spacing = 1;
+  int repeats = 5;
+  uint64_t seed = 1;
+  // Moves the first entities far away, one per coordinate, to (c, c, 0): the
+  // batch must survive huge, infinite and NaN positions. A sphere is always
+  // centred on each outlier.
+  std::vector<double> outliers;
+};
+
+// Every sphere's matches, in sphere order: the CSR form the batch call uses
+struct Matches {
+  std::vector<uint32_t> offsets;
+  // The Acceleration each entity was created with, which is its creation
+  // number and so tags it without an entity index
+  std::vector<double> tags;
+  std::vector<Position> positions;
+};
+
+struct Run {
+  const Options *options;
+  std::vector<System_Query_Constraint_AbsoluteSphere> spheres;
+  Matches reference;
+  Matches batched;
+  std::vector<System_EntityIndex> entity_indices;
+  double reference_ms = 0;
+  double batched_ms = 0;
+  System_StatusCode rc = SYSTEM_STATUS_CODE_SUCCESS;
+};
+
+System_StatusCode QueryEachSphere(Run &run, Matches &matches) {
+  matches.offsets.assign(1, 0);
+  matches.tags.clear();
+  matches.positions.clear();
+  for (const auto &sphere : run.spheres) {
+    auto constraint = System_Query_Constraint_CreateAbsoluteSphere(
+        sphere.center, sphere.radius);
+    auto query = std::unique_ptr<System_Query_Handle_Data,
+                                 decltype(&System_Query_Destroy)>{
+        System_Query_Create(&constraint), System_Query_Destroy};
+    if (!query) {
+      return SYSTEM_STATUS_CODE_ERROR;
+    }
+    for (; !System_Query_IterationFinished(query.get());
+         System_Query_NextEntity(query.get())) {
+      Position position;
+      Acceleration tag;
+      if (auto status = Components::Get(query.get(), position, tag);
+          !status.ok()) {
+        return status.code;
+      }
+      matches.tags.push_back(tag.value);
+      matches.positions.push_back(position);
+    }
+    matches.offsets.push_back(static_cast<uint32_t>(matches.tags.size()));
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode QueryBatch(Run &run, Matches &matches) {
+  const auto sphere_count = static_cast<uint32_t>(run.spheres.size());
+  matches.offsets.resize(sphere_count + 1);
+  for (;;) {
+    const System_ComponentColumnType columns[] = {
+        Components::FieldColumn<Acceleration, 0>(matches.tags.data()),
+        Components::FieldColumn<Position, 0>(matches.positions.data())};
+    System_Query_SphereBatchResult result{
+        matches.offsets.data(),
+        run.entity_indices.data(),
+        columns,
+        2,
+        static_cast<uint32_t>(matches.tags.size()),
+        0};
+    const auto rc =
+        System_Query_SphereBatch(run.spheres.data(), sphere_count, &result);
+    if (rc != SYSTEM_STATUS_CODE_OUT_OF_RANGE) {
+      matches.tags.resize(result.match_count);
+      matches.positions.resize(result.match_count);
+      return rc;
+    }
+    // Too small; grow every buffer to the reported total and retry
+    matches.tags.resize(result.match_count);
+    matches.positions.resize(result.match_count);
+    run.entity_indices.resize(result.match_count);
+  }
+}
+
+// Reports the first sphere whose matches differ; returns whether all agree
+bool Compare(const Run &run) {
+  const auto &expected = run.reference;
+  const auto &actual = run.batched;
+  for (std::size_t i = 0; i < run.spheres.size(); ++i) {
+    const auto begin = expected.offsets[i];
+    const auto end = expected.offsets[i + 1];
+    bool same = actual.offsets[i] == begin && actual.offsets[i + 1] == end;
+    for (auto k = begin; same && k < end; ++k) {
+      same = actual.tags[k] == expected.tags[k] &&
+             actual.positions[k] == expected.positions[k] &&
+             run.entity_indices[k] == static_cast<uint32_t>(expected.tags[k]);
+    }
+    if (!same) {
+      std::cerr << "Sphere " << i << " differs: " << end - begin
+                << " matches expected, "
+                << actual.offsets[i + 1] - actual.offsets[i] << " returned"
+                << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+double Milliseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Runs both paths in the only tick, where queries see the created entities
+System_StatusCode CompareTick(System_Handle, System_EntityIterator,
+                              void *user_context, uint32_t) {
+  auto &run = *static_cast<Run *>(user_context);
+  for (int repeat = 0; repeat < run.options->repeats; ++repeat) {
+    auto start = Clock::now();
+    if (auto rc = QueryEachSphere(run, run.reference);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      std::cerr << "Sphere query failed (received status code: " << rc << ")"
+                << std::endl;
+      return run.rc = rc;
+    }
+    run.reference_ms += Milliseconds(Clock::now() - start);
+
+    start = Clock::now();
+    if (auto rc = QueryBatch(run, run.batched);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      std::cerr << "Batched sphere query failed (received status code: " << rc
+                << ")" << std::endl;
+      return run.rc = rc;
+    }
+    run.batched_ms += Milliseconds(Clock::now() - start);
+
+    if (!Compare(run)) {
+      return run.rc = SYSTEM_STATUS_CODE_ERROR;
+    }
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+bool CreateEntities(System_Handle system_handle, const Options &options,
+                    std::vector<System_Double3> *centers) {
+  std::mt19937_64 random(options.seed);
+  const double extent =
+      std::sqrt(static_cast<double>(options.entity_count)) * options.spacing;
+  std::uniform_real_distribution<double> coordinate(0, extent);
+  for (int i = 0; i < options.entity_count; ++i) {
+    Position position{{coordinate(random), coordinate(random), 0}};
+    if (static_cast<std::size_t>(i) < options.outliers.size()) {
+      position.coords.x = position.coords.y = options.outliers[i];
+    }
+    Acceleration tag{static_cast<double>(i)};
+    auto instances = Components::Instances("boids", position, tag);
+    if (System_CreateEntity(system_handle, instances.data(),
+                            static_cast<uint32_t>(instances.size())) !=
+        SYSTEM_STATUS_CODE_SUCCESS) {
+      return false;
+    }
+    centers->push_back(System_Double3{position.coords.x, position.coords.y, position.coords.z});
+  }
+  return true;
+}
+
+void PrintUsage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--entities=<count>] [--spheres=<count>] [--radius=<radius>]"
+               " [--spacing=<distance>] [--repeats=<count>] [--seed=<seed>]"
+               " [--outlier=<coordinate>]..."
+            << std::endl;
+}
+
+bool ParseOptions(int argc, char **argv, Options *options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *argument = argv[i];
+    const char *value = std::strchr(argument, '=');
+    if (!value) {
+      return false;
+    }
+    const std::string name(argument, value++);
+    if (name == "--entities") {
+      options->entity_count = std::max(1, std::atoi(value));
+    } else if (name == "--spheres") {
+      options->sphere_count = std::max(0, std::atoi(value));
+    } else if (name == "--radius") {
+      options->radius = std::strtod(value, nullptr);
+    } else if (name == "--spacing") {
+      options->spacing = std::max(0.0, std::strtod(value, nullptr));
+    } else if (name == "--repeats") {
+      options->repeats = std::max(1, std::atoi(value));
+    } else if (name == "--seed") {
+      options->seed = std::strtoull(value, nullptr, 0);
+    } else if (name == "--outlier") {
+      options->outliers.push_back(std::strtod(value, nullptr));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  LocalRuntime_Reset();
+  LocalRuntime_Configuration configuration;
+  LocalRuntime_DefaultConfiguration(&configuration);
+  configuration.execution_mode =
+      LOCAL_RUNTIME_EXECUTION_MODE_AS_FAST_AS_POSSIBLE;
+  configuration.max_ticks = 1;
+  configuration.log_level = LOG_LEVEL_WARN;
+  LocalRuntime_Configure(&configuration);
+
+  const auto system_handle =
+      std::unique_ptr<System_Handle_Data, decltype(&System_Destroy)>{
+          System_Init(), System_Destroy};
+  std::vector<System_Double3> centers;
+  if (!CreateEntities(system_handle.get(), options, &centers)) {
+    std::cerr << "Failed to create entities" << std::endl;
+    return 1;
+  }
+
+  Run run;
+  run.options = &options;
+  std::mt19937_64 random(options.seed + 1);
+  std::uniform_int_distribution<std::size_t> pick(0, centers.size() - 1);
+  for (std::size_t i = 0; i < std::min(options.outliers.size(), centers.size());
+       ++i) {
+    run.spheres.push_back({centers[i], options.radius});
+  }
+  for (int i = 0; i < options.sphere_count; ++i) {
+    run.spheres.push_back({centers[pick(random)], options.radius});
+  }
+
+  if (auto rc = SYSTEM_RUN(system_handle.get(), CompareTick, &run);
+      rc != SYSTEM_STATUS_CODE_SUCCESS || run.rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    return 1;
+  }
+
+  const double sphere_queries =
+      static_cast<double>(run.spheres.size()) * options.repeats;
+  std::printf("%d entities, %zu spheres of radius %g, %zu matches\n",
+              options.entity_count, run.spheres.size(), options.radius,
+              run.batched.tags.size());
+  std::printf("%-10s %12s %16s\n", "path", "ms/batch", "ns/sphere");
+  std::printf("%-10s %12.3f %16.1f\n", "per-query",
+              run.reference_ms / options.repeats,
+              sphere_queries > 0 ? run.reference_ms * 1e6 / sphere_queries
+                                 : 0);
+  std::printf("%-10s %12.3f %16.1f\n", "batched",
+              run.batched_ms / options.repeats,
+              sphere_queries > 0 ? run.batched_ms * 1e6 / sphere_queries : 0);
+  std::printf("Results match\n");
+  return 0;
+}
@@ -0,0 +1,519 @@
+// Drives the movement system's TickCallback against the local runtime over a
+// sweep of entity counts and densities, and reports per-tick cost.
+
+#include <improbable/system/c_system.h>
+#include <local_runtime/local_runtime.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "movement_system.h"
+
+namespace {
+
+// Every heap allocation in the process, including those made by the runtime
+std::atomic<uint64_t> allocation_count{0};
+
+} // namespace
+
+void *operator new(std::size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (void *pointer = std::malloc(size > 0 ? size : 1)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  const auto align = static_cast<std::size_t>(alignment);
+  if (void *pointer =
+          std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align -
+                                     1) / align * align)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+void operator delete(void *pointer, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void *pointer) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void *pointer, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::vector<int> entity_counts = {1000, 10000, 100000};
+  // Distance between neighbouring boids at spawn; with a vision radius of 1,
+  // 0.5 is dense, 1 matches the movement system's default and 2 is sparse
+  std::vector<double> spacings = {0.5, 1, 2};
+  int warmup_ticks = 5;
+  int measured_ticks = 50;
+  // Passed to the tick callback as `ticks_fired` in place of the runtime's,
+  // to measure catch-up ticks; 0 passes the runtime's through
+  uint32_t ticks_fired = 0;
+  Movement::Configuration system = {
+      std::max(1u, std::thread::hardware_concurrency())};
+  // The layout and seed of every sweep point; the entity count and spacing
+  // come from the sweep
+  Spawn::Parameters spawn = {Spawn::Layout::kGrid, 0, {}, /*seed=*/1};
+  std::string output_path;
+  std::string label;
+  // Where to write the profiled ticks of the last sweep point as a Chrome
+  // trace; needs --profile-ticks
+  std::string trace_path;
+};
+
+// Measurements for one tick callback
+struct TickSample {
+  double nanoseconds;
+  uint64_t allocations;
+  std::size_t boids;
+  uint64_t neighbours;
+  bool neighbour_lists_rebuilt;
+  uint32_t substeps;
+  uint64_t component_updates;
+  uint64_t suppressed_component_updates;
+  std::size_t lod_reduced;
+};
+
+struct Run {
+  Movement::MovementSystem *system;
+  int warmup_ticks;
+  uint32_t ticks_fired;
+  int ticks = 0;
+  std::vector<TickSample> samples;
+};
+
+System_StatusCode TimedTick(System_Handle system_handle,
+                            System_EntityIterator entity_iterator,
+                            void *user_context, uint32_t ticks_fired) {
+  auto &run = *static_cast<Run *>(user_context);
+  const auto allocations_before =
+      allocation_count.load(std::memory_order_relaxed);
+  const auto &statistics = run.system->last_tick;
+  const auto updates_before = statistics.component_updates;
+  const auto suppressed_before = statistics.suppressed_component_updates;
+  const auto start = Clock::now();
+  const auto rc = Movement::TickCallback(
+      system_handle, entity_iterator, run.system,
+      run.ticks_fired > 0 ? run.ticks_fired : ticks_fired);
+  const auto end = Clock::now();
+  const auto allocations =
+      allocation_count.load(std::memory_order_relaxed) - allocations_before;
+
+  if (run.ticks++ >= run.warmup_ticks) {
+    run.samples.push_back(TickSample{
+        std::chrono::duration<double, std::nano>(end - start).count(),
+        allocations, run.system->last_tick.boid_count,
+        run.system->last_tick.neighbour_count,
+        run.system->last_tick.neighbour_lists_rebuilt,
+        run.system->last_tick.substeps,
+        statistics.component_updates - updates_before,
+        statistics.suppressed_component_updates - suppressed_before,
+        statistics.lod_reduced});
+  }
+  return rc;
+}
+
+struct Result {
+  int entity_count;
+  double spacing;
+  std::size_t boids;
+  double ns_per_entity_tick;
+  double p50_tick_ms;
+  double p99_tick_ms;
+  double allocations_per_tick;
+  double neighbours_per_boid;
+  // Fraction of measured ticks that rebuilt the Verlet neighbour lists; 0
+  // with the lists disabled
+  double neighbour_list_rebuild_rate;
+  double substeps_per_tick;
+  // Fraction of component updates the store held back as unchanged; 0
+  // without delta updates
+  double suppressed_update_fraction;
+  // Fraction of boid ticks the level of detail scheduler dead-reckoned
+  double dead_reckoned_fraction;
+  // Fingerprint of the boids after the last tick; with a fixed seed, equal
+  // hashes mean a change left the simulation's results untouched
+  uint64_t state_hash;
+};
+
+double Percentile(std::vector<double> values, double percentile) {
+  std::sort(values.begin(), values.end());
+  const auto rank = static_cast<std::size_t>(
+      percentile / 100 * static_cast<double>(values.size() - 1) + 0.5);
+  return values[std::min(rank, values.size() - 1)];
+}
+
+bool RunScenario(System_Handle system_handle, const Options &options,
+                 int entity_count, double spacing, Result *result) {
+  LocalRuntime_Reset();
+  LocalRuntime_Configuration configuration;
+  LocalRuntime_DefaultConfiguration(&configuration);
+  configuration.execution_mode =
+      LOCAL_RUNTIME_EXECUTION_MODE_AS_FAST_AS_POSSIBLE;
+  configuration.simulation_duration_seconds =
+      configuration.tick_rate_seconds *
+      (options.warmup_ticks + options.measured_ticks);
+  configuration.max_ticks =
+      static_cast<uint32_t>(options.warmup_ticks + options.measured_ticks);
+  configuration.log_level = LOG_LEVEL_WARN;
+  LocalRuntime_Configure(&configuration);
+
+  Movement::MovementSystem system{options.system};
+  auto spawn = options.spawn;
+  spawn.entity_count = static_cast<std::size_t>(entity_count);
+  spawn.spacing = spacing;
+  // Other layouts get a square world with the same mean density as the grid
+  const double extent = std::sqrt(static_cast<double>(entity_count)) * spacing;
+  spawn.world_bounds = Spawn::WorldBounds{extent, extent};
+  if (Movement::CreateEntities(system_handle, system.pool, spawn) !=
+      SYSTEM_STATUS_CODE_SUCCESS) {
+    return false;
+  }
+  Run run{&system, options.warmup_ticks, options.ticks_fired, 0, {}};
+  run.samples.reserve(static_cast<std::size_t>(options.measured_ticks));
+
+  if (auto rc = SYSTEM_RUN(system_handle, TimedTick, &run);
+      rc != SYSTEM_STATUS_CODE_SUCCESS || run.samples.empty()) {
+    std::cerr << "Benchmark run failed (received status code: " << rc << ")"
+              << std::endl;
+    return false;
+  }
+
+  std::vector<double> tick_ms;
+  double total_ns = 0;
+  double total_entity_ticks = 0;
+  double total_allocations = 0;
+  double total_neighbours = 0;
+  double total_rebuilds = 0;
+  double total_substeps = 0;
+  double total_updates = 0;
+  double total_suppressed = 0;
+  double total_reduced = 0;
+  for (const auto &sample : run.samples) {
+    tick_ms.push_back(sample.nanoseconds / 1e6);
+    total_ns += sample.nanoseconds;
+    total_entity_ticks += static_cast<double>(sample.boids);
+    total_allocations += static_cast<double>(sample.allocations);
+    total_neighbours += static_cast<double>(sample.neighbours);
+    total_rebuilds += sample.neighbour_lists_rebuilt ? 1 : 0;
+    total_substeps += sample.substeps;
+    total_updates += static_cast<double>(sample.component_updates);
+    total_suppressed +=
+        static_cast<double>(sample.suppressed_component_updates);
+    total_reduced += static_cast<double>(sample.lod_reduced);
+  }
+  const auto ticks = static_cast<double>(run.samples.size());
+  *result = Result{entity_count,
+                   spacing,
+                   run.samples.back().boids,
+                   total_entity_ticks > 0 ? total_ns / total_entity_ticks : 0,
+                   Percentile(tick_ms, 50),
+                   Percentile(tick_ms, 99),
+                   total_allocations / ticks,
+                   total_entity_ticks > 0
+                       ? total_neighbours / total_entity_ticks
+                       : 0,
+                   total_rebuilds / ticks,
+                   total_substeps / ticks,
+                   total_updates + total_suppressed > 0
+                       ? total_suppressed / (total_updates + total_suppressed)
+                       : 0,
+                   total_entity_ticks > 0 ? total_reduced / total_entity_ticks
+                                          : 0,
+                   Movement::HashBoidState(system.pool, system.boids)};
+
+  // Every sweep point overwrites the trace, leaving the last one's
+  if (!options.trace_path.empty() && system.profiler.enabled()) {
+    std::FILE *file = std::fopen(options.trace_path.c_str(), "w");
+    if (!file) {
+      std::cerr << "Failed to open " << options.trace_path << std::endl;
+      return false;
+    }
+    system.profiler.WriteChromeTrace(file);
+    std::fclose(file);
+  }
+  return true;
+}
+
+void WriteJson(const Options &options, const std::vector<Result> &results,
+               const char *instruction_set, std::FILE *file) {
+  std::fprintf(file, "{\n  \"label\": \"%s\",\n", options.label.c_str());
+  std::fprintf(file, "  \"threads\": %zu,\n", options.system.thread_count);
+  std::fprintf(file, "  \"kernel\": \"%s\",\n", instruction_set);
+  std::fprintf(file, "  \"verlet_skin\": %g,\n", options.system.verlet_skin);
+  std::fprintf(file, "  \"ticks_fired\": %u,\n", options.ticks_fired);
+  std::fprintf(file, "  \"bulk_access\": %s,\n",
+               options.system.bulk_component_access ? "true" : "false");
+  std::fprintf(file, "  \"owned_state\": %s,\n",
+               options.system.cache_owned_state ? "true" : "false");
+  std::fprintf(file, "  \"delta_updates\": %s,\n",
+               options.system.delta_updates ? "true" : "false");
+  std::fprintf(file, "  \"delta_epsilon\": %g,\n",
+               options.system.delta_filter.epsilon);
+  std::fprintf(file, "  \"delta_quantum\": %g,\n",
+               options.system.delta_filter.quantum);
+  std::fprintf(file, "  \"lod_interval\": %u,\n",
+               options.system.lod.interval);
+  std::fprintf(file, "  \"lod_isolated_neighbours\": %u,\n",
+               options.system.lod.isolated_neighbours);
+  std::fprintf(file, "  \"profile_ticks\": %u,\n",
+               options.system.profile_ticks);
+  std::fprintf(file, "  \"spatial_index\": \"%s\",\n",
+               Movement::ToString(options.system.spatial_index));
+  std::fprintf(file, "  \"tree_rebuild_interval\": %u,\n",
+               options.system.tree_rebuild_interval);
+  std::fprintf(file, "  \"view_culling\": %s,\n",
+               options.system.cull_view_cone ? "true" : "false");
+  std::fprintf(file, "  \"catch_up\": \"%s\",\n",
+               Movement::ToString(options.system.catch_up_mode));
+  std::fprintf(file, "  \"layout\": \"%s\",\n",
+               Spawn::ToString(options.spawn.layout));
+  std::fprintf(file, "  \"warmup_ticks\": %d,\n", options.warmup_ticks);
+  std::fprintf(file, "  \"measured_ticks\": %d,\n", options.measured_ticks);
+  std::fprintf(file, "  \"results\": [\n");
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto &result = results[i];
+    std::fprintf(file,
+                 "    {\"entities\": %d, \"spacing\": %g, \"boids\": %zu, "
+                 "\"ns_per_entity_tick\": %.3f, \"p50_tick_ms\": %.6f, "
+                 "\"p99_tick_ms\": %.6f, \"allocations_per_tick\": %.2f, "
+                 "\"neighbours_per_boid\": %.3f, "
+                 "\"neighbour_list_rebuild_rate\": %.3f, "
+                 "\"substeps_per_tick\": %.2f, "
+                 "\"suppressed_update_fraction\": %.4f, "
+                 "\"dead_reckoned_fraction\": %.4f, "
+                 "\"state_hash\": \"%016llx\"}%s\n",
+                 result.entity_count, result.spacing, result.boids,
+                 result.ns_per_entity_tick, result.p50_tick_ms,
+                 result.p99_tick_ms, result.allocations_per_tick,
+                 result.neighbours_per_boid, result.neighbour_list_rebuild_rate,
+                 result.substeps_per_tick, result.suppressed_update_fraction,
+                 result.dead_reckoned_fraction,
+                 static_cast<unsigned long long>(result.state_hash),
+                 i + 1 < results.size() ? "," : "");
+  }
+  std::fprintf(file, "  ]\n}\n");
+}
+
+template <typename T>
+bool ParseList(const char *text, T (*parse)(const char *, char **),
+               std::vector<T> *values) {
+  values->clear();
+  for (const char *cursor = text; *cursor;) {
+    char *end = nullptr;
+    const T value = parse(cursor, &end);
+    if (end == cursor || value <= 0) {
+      return false;
+    }
+    values->push_back(value);
+    cursor = *end == ',' ? end + 1 : end;
+  }
+  return !values->empty();
+}
+
+int ParseInt(const char *text, char **end) {
+  return static_cast<int>(std::strtol(text, end, 10));
+}
+
+double ParseDouble(const char *text, char **end) {
+  return std::strtod(text, end);
+}
+
+void PrintUsage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--entities=1000,10000,...] [--spacings=0.5,1,...]"
+               " [--layout=grid|uniform|clustered|poisson] [--seed=<seed>]"
+               " [--deterministic=0|1] [--verlet-skin=<distance>]"
+               " [--spatial-index=grid|tree] [--tree-rebuild=<ticks>]"
+               " [--ticks-fired=<ticks>] [--max-substeps=<count>]"
+               " [--catch-up=fixed|adaptive] [--catch-up-budget-ms=<ms>]"
+               " [--bulk-access=0|1] [--view-culling=0|1]"
+               " [--owned-state=0|1] [--delta-updates=0|1]"
+               " [--delta-epsilon=<distance>] [--delta-quantum=<step>]"
+               " [--lod-interval=<ticks>] [--lod-isolated=<neighbours>]"
+               " [--profile-ticks=<count>] [--trace-output=<trace.json>]"
+               " [--warmup=<ticks>] [--ticks=<ticks>] [--threads=<count>]"
+               " [--output=<results.json>] [--label=<text>]"
+            << std::endl;
+}
+
+bool ParseOptions(int argc, char **argv, Options *options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *argument = argv[i];
+    const char *value = std::strchr(argument, '=');
+    if (!value) {
+      return false;
+    }
+    const std::string name(argument, value++);
+    if (name == "--entities") {
+      if (!ParseList(value, ParseInt, &options->entity_counts)) {
+        return false;
+      }
+    } else if (name == "--spacings") {
+      if (!ParseList(value, ParseDouble, &options->spacings)) {
+        return false;
+      }
+    } else if (name == "--warmup") {
+      options->warmup_ticks = std::max(0, std::atoi(value));
+    } else if (name == "--ticks") {
+      options->measured_ticks = std::max(1, std::atoi(value));
+    } else if (name == "--threads") {
+      options->system.thread_count =
+          static_cast<std::size_t>(std::max(1, std::atoi(value)));
+    } else if (name == "--seed") {
+      options->spawn.seed = std::strtoull(value, nullptr, 0);
+    } else if (name == "--deterministic") {
+      options->system.deterministic = std::atoi(value) != 0;
+    } else if (name == "--verlet-skin") {
+      options->system.verlet_skin = std::max(0.0, std::strtod(value, nullptr));
+    } else if (name == "--spatial-index") {
+      if (!Movement::ParseSpatialIndex(value, &options->system.spatial_index)) {
+        return false;
+      }
+    } else if (name == "--tree-rebuild") {
+      options->system.tree_rebuild_interval =
+          static_cast<uint32_t>(std::max(0, std::atoi(value)));
+    } else if (name == "--bulk-access") {
+      options->system.bulk_component_access = std::atoi(value) != 0;
+    } else if (name == "--owned-state") {
+      options->system.cache_owned_state = std::atoi(value) != 0;
+    } else if (name == "--lod-interval") {
+      options->system.lod.interval =
+          static_cast<uint32_t>(std::max(0, std::atoi(value)));
+    } else if (name == "--lod-isolated") {
+      options->system.lod.isolated_neighbours =
+          static_cast<uint32_t>(std::max(0, std::atoi(value)));
+    } else if (name == "--delta-updates") {
+      options->system.delta_updates = std::atoi(value) != 0;
+    } else if (name == "--delta-epsilon") {
+      options->system.delta_filter.epsilon =
+          std::max(0.0, std::strtod(value, nullptr));
+    } else if (name == "--delta-quantum") {
+      options->system.delta_filter.quantum =
+          std::max(0.0, std::strtod(value, nullptr));
+    } else if (name == "--profile-ticks") {
+      options->system.profile_ticks =
+          static_cast<uint32_t>(std::max(0, std::atoi(value)));
+    } else if (name == "--trace-output") {
+      options->trace_path = value;
+    } else if (name == "--view-culling") {
+      options->system.cull_view_cone = std::atoi(value) != 0;
+    } else if (name == "--ticks-fired") {
+      options->ticks_fired =
+          static_cast<uint32_t>(std::max(0, std::atoi(value)));
+    } else if (name == "--max-substeps") {
+      options->system.max_substeps =
+          static_cast<uint32_t>(std::max(1, std::atoi(value)));
+    } else if (name == "--catch-up") {
+      if (!Movement::ParseCatchUpMode(value, &options->system.catch_up_mode)) {
+        return false;
+      }
+    } else if (name == "--catch-up-budget-ms") {
+      options->system.catch_up_budget_ms = std::strtod(value, nullptr);
+    } else if (name == "--layout") {
+      if (!Spawn::ParseLayout(value, &options->spawn.layout)) {
+        return false;
+      }
+    } else if (name == "--output") {
+      options->output_path = value;
+    } else if (name == "--label") {
+      options->label = value;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  const auto system_handle =
+      std::unique_ptr<System_Handle_Data, decltype(&System_Destroy)>{
+          System_Init(), System_Destroy};
+  const char *instruction_set =
+      Flocking::ToString(options.system.deterministic
+                             ? Flocking::InstructionSet::kScalar
+                             : Flocking::DetectInstructionSet());
+
+  std::printf("%zu threads, %s kernel, %d measured ticks after %d warmup\n",
+              options.system.thread_count, instruction_set,
+              options.measured_ticks, options.warmup_ticks);
+  std::printf("%10s %8s %14s %12s %12s %12s %15s %12s %9s %16s\n",
+              "entities", "spacing", "ns/entity/tick", "p50 ms", "p99 ms",
+              "allocs/tick", "neighbours/boid", "rebuild rate", "substeps",
+              "state hash");
+
+  std::vector<Result> results;
+  for (const int entity_count : options.entity_counts) {
+    for (const double spacing : options.spacings) {
+      Result result;
+      if (!RunScenario(system_handle.get(), options, entity_count, spacing,
+                       &result)) {
+        return 1;
+      }
+      std::printf(
+          "%10d %8g %14.1f %12.3f %12.3f %12.1f %15.2f %12.3f %9.2f %016llx\n",
+          result.entity_count, result.spacing, result.ns_per_entity_tick,
+          result.p50_tick_ms, result.p99_tick_ms, result.allocations_per_tick,
+          result.neighbours_per_boid, result.neighbour_list_rebuild_rate,
+          result.substeps_per_tick,
+          static_cast<unsigned long long>(result.state_hash));
+      std::fflush(stdout);
+      results.push_back(result);
+    }
+  }
+
+  if (!options.output_path.empty()) {
+    std::FILE *file = std::fopen(options.output_path.c_str(), "w");
+    if (!file) {
+      std::cerr << "Failed to open " << options.output_path << std::endl;
+      return 1;
+    }
+    WriteJson(options, results, instruction_set, file);
+    std::fclose(file);
+  }
+  return 0;
+}
@@ -9,25 +9,27 @@
 
 // ---------------------- Types ---------------------- 
 
-struct Direction {
-  static constexpr std::uint32_t kComponentId = 1002;
+struct Vector3D {
+  static constexpr std::uint32_t kComponentId = 1000;
 
-  double value;
+  double x;
+  double y;
+  double z;
 
-  inline bool operator==(const Direction& other) const {
-    return value == other.value;
+  inline bool operator==(const Vector3D& other) const {
+    return x == other.x && y == other.y && z == other.z;
   }
 
-  inline bool operator!=(const Direction& other) const {
+  inline bool operator!=(const Vector3D& other) const {
     return !operator==(other);
   }
 };
-static_assert(sizeof(Direction) == 8);
+static_assert(sizeof(Vector3D) == 24);
 
 struct Velocity {
   static constexpr std::uint32_t kComponentId = 1001;
 
-  double value;
+  Vector3D value;
 
   inline bool operator==(const Velocity& other) const {
     return value == other.value;
@@ -37,6 +39,21 @@ struct Velocity {
     return !operator==(other);
   }
 };
-static_assert(sizeof(Velocity) == 8);
+static_assert(sizeof(Velocity) == 24);
+
+struct Acceleration {
+  static constexpr std::uint32_t kComponentId = 1003;
+
+  double value;
+
+  inline bool operator==(const Acceleration& other) const {
+    return value == other.value;
+  }
+
+  inline bool operator!=(const Acceleration& other) const {
+    return !operator==(other);
+  }
+};
+static_assert(sizeof(Acceleration) == 8);
 
 #endif  // IMPROBABLE_SCHEMA_myschema_schema_4676459199623344917_INCLUDED
\ No newline at end of file
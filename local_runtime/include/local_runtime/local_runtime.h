@@ -0,0 +1,76 @@
+// Configuration entry points of the local stand-in runtime. These are not part
+// of the System API; they let harnesses set up a simulation that would
+// otherwise come from simulation_configuration.json.
+
+#ifndef LOCAL_RUNTIME_H
+#define LOCAL_RUNTIME_H
+
+#include <improbable/system/c_system.h>
+#include <cstdint>
+
+#ifdef __cplusplus
+extern "C" {
+#endif  //__cplusplus
+
+typedef enum LocalRuntime_ExecutionMode {
+  // Ticks back to back, each advancing simulated time by one tick period.
+  // `ticks_fired` is always 1.
+  LOCAL_RUNTIME_EXECUTION_MODE_AS_FAST_AS_POSSIBLE,
+  // Ticks on the wall clock at the tick rate. A callback that overruns makes
+  // the next one see the number of tick periods that have elapsed.
+  LOCAL_RUNTIME_EXECUTION_MODE_REAL_TIME,
+} LocalRuntime_ExecutionMode;
+
+typedef struct LocalRuntime_Configuration {
+  LocalRuntime_ExecutionMode execution_mode;
+  double tick_rate_seconds;
+  double simulation_duration_seconds;
+  // Stops after this many tick callbacks even if simulated time remains; 0
+  // means no limit
+  uint32_t max_ticks;
+  // Components the system may write, and whose entities its iterator visits.
+  // An empty list grants write access to every component and visits every
+  // entity.
+  const System_ComponentId* write_components;
+  uint32_t write_component_count;
+  // Messages below this level are dropped
+  System_LogLevel log_level;
+} LocalRuntime_Configuration;
+
+/*
+ * Fills `configuration` with the defaults, overridden by any of these
+ * environment variables:
+ *   LOCAL_RUNTIME_EXECUTION_MODE       EXECUTION_MODE_AS_FAST_AS_POSSIBLE or
+ *                                      EXECUTION_MODE_REAL_TIME
+ *   LOCAL_RUNTIME_TICK_RATE            e.g. "0.1s" or "100ms"
+ *   LOCAL_RUNTIME_SIMULATION_DURATION  e.g. "10s"
+ *   LOCAL_RUNTIME_MAX_TICKS            e.g. "500"
+ *   LOCAL_RUNTIME_WRITE_COMPONENTS     e.g. "54,1001"
+ *   LOCAL_RUNTIME_LOG_LEVEL            e.g. "LOG_LEVEL_WARN"
+ * The defaults match simulation_configuration.json: as fast as possible, a
+ * 0.1s tick rate, a 10s duration and LOG_LEVEL_INFO.
+ */
+DLL_PUBLIC void LocalRuntime_DefaultConfiguration(LocalRuntime_Configuration* configuration);
+
+/*
+ * Replaces the runtime configuration. The component list is copied. Takes
+ * effect from the next System_Run.
+ */
+DLL_PUBLIC void LocalRuntime_Configure(const LocalRuntime_Configuration* configuration);
+
+/*
+ * Deletes every entity and pending change, so a harness can run several
+ * simulations in one process.
+ */
+DLL_PUBLIC void LocalRuntime_Reset();
+
+/*
+ * The number of live entities, not counting creations still pending.
+ */
+DLL_PUBLIC uint32_t LocalRuntime_EntityCount();
+
+#ifdef __cplusplus
+}
+#endif  //__cplusplus
+
+#endif  // LOCAL_RUNTIME_H
@@ -0,0 +1,131 @@
+#include "runtime.h"
+
+#include <algorithm>
+
+using LocalRuntime::Runtime;
+
+System_Query_Constraint
+System_Query_Constraint_CreateAbsoluteSphere(System_Double3 center,
+                                             double radius) {
+  System_Query_Constraint constraint{};
+  constraint.constraint_type = SYSTEM_QUERY_CONSTRAINT_TYPE_ABSOLUTE_SPHERE;
+  constraint.absolute_sphere_constraint = {center, radius};
+  return constraint;
+}
+
+System_Query_Constraint
+System_Query_Constraint_CreateEntityIndex(System_EntityIndex entity_index) {
+  System_Query_Constraint constraint{};
+  constraint.constraint_type = SYSTEM_QUERY_CONSTRAINT_TYPE_ENTITY_INDEX;
+  constraint.entity_index_constraint = {entity_index};
+  return constraint;
+}
+
+System_Query_Constraint
+System_Query_Constraint_CreateComponent(System_ComponentId component_id) {
+  System_Query_Constraint constraint{};
+  constraint.constraint_type = SYSTEM_QUERY_CONSTRAINT_TYPE_COMPONENT;
+  constraint.component_constraint = {component_id};
+  return constraint;
+}
+
+System_Query_Handle System_Query_Create(System_Query_Constraint *constraint) {
+  if (!constraint) {
+    return nullptr;
+  }
+  return Runtime::Instance().CreateQuery(
+      System_Query_CompoundConstraint_CreateSimple(*constraint));
+}
+
+System_Query_Handle
+System_Query_CreateCompound(const System_Query_CompoundConstraint *constraint) {
+  if (!constraint) {
+    return nullptr;
+  }
+  return Runtime::Instance().CreateQuery(*constraint);
+}
+
+System_StatusCode System_Query_Destroy(System_Query_Handle query_handle) {
+  if (!query_handle) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  Runtime::Instance().DestroyQuery(query_handle);
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode System_Query_NextEntity(System_Query_Handle query_handle) {
+  if (System_Query_IterationFinished(query_handle)) {
+    return SYSTEM_STATUS_CODE_ITERATION_ALREADY_COMPLETED;
+  }
+  ++query_handle->position;
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+bool System_Query_IterationFinished(System_Query_Handle query_handle) {
+  return !query_handle ||
+         query_handle->position >= query_handle->matches.size();
+}
+
+System_StatusCode System_Query_GetComponent(System_Query_Handle query_handle,
+                                            System_ComponentId component_id,
+                                            uint8_t *component_data_out,
+                                            uint32_t component_data_size) {
+  if (System_Query_IterationFinished(query_handle)) {
+    return SYSTEM_STATUS_CODE_ITERATION_ALREADY_COMPLETED;
+  }
+  return Runtime::Instance().GetComponent(
+      query_handle->matches[query_handle->position], component_id,
+      component_data_out, component_data_size);
+}
+
+System_StatusCode
+System_Query_GetComponentsBulk(System_Query_Handle query_handle,
+                               const System_ComponentColumnType *columns,
+                               uint32_t column_count,
+                               uint32_t max_entity_count,
+                               uint32_t *entity_count_out) {
+  if (!query_handle || !entity_count_out) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  const auto &matches = query_handle->matches;
+  const std::size_t position = std::min(query_handle->position, matches.size());
+  const std::size_t count =
+      std::min<std::size_t>(max_entity_count, matches.size() - position);
+  if (auto rc = Runtime::Instance().GetColumns(matches.data() + position, count,
+                                               columns, column_count);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    return rc;
+  }
+  query_handle->position = position + count;
+  *entity_count_out = static_cast<uint32_t>(count);
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode
+System_Query_GetEntityIndices(System_Query_Handle query_handle,
+                              System_EntityIndex *entity_indices_out,
+                              uint32_t max_entity_count,
+                              uint32_t *entity_count_out) {
+  if (!query_handle || !entity_count_out ||
+      (max_entity_count > 0 && !entity_indices_out)) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  const auto &matches = query_handle->matches;
+  const std::size_t position = std::min(query_handle->position, matches.size());
+  const std::size_t count =
+      std::min<std::size_t>(max_entity_count, matches.size() - position);
+  std::copy_n(matches.data() + position, count, entity_indices_out);
+  query_handle->position = position + count;
+  *entity_count_out = static_cast<uint32_t>(count);
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode
+System_Query_SphereBatch(const System_Query_Constraint_AbsoluteSphere *spheres,
+                         uint32_t sphere_count,
+                         System_Query_SphereBatchResult *result) {
+  if (!result) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  return Runtime::Instance().SphereBatch(spheres, sphere_count, *result);
+}
@@ -0,0 +1,204 @@
+#include "runtime.h"
+
+#include <algorithm>
+
+using LocalRuntime::Runtime;
+
+namespace {
+
+bool Current(const System_EntityIterator iterator, System_EntityIndex *entity) {
+  if (!iterator || iterator->position >= iterator->entities->size()) {
+    return false;
+  }
+  *entity = (*iterator->entities)[iterator->position];
+  return true;
+}
+
+} // namespace
+
+System_Handle System_Init() { return new System_Handle_Data; }
+
+void System_Destroy(System_Handle handle) { delete handle; }
+
+bool System_IterationFinished(const System_EntityIterator entity_iterator) {
+  return !entity_iterator ||
+         entity_iterator->position >= entity_iterator->entities->size();
+}
+
+System_StatusCode System_NextEntity(System_EntityIterator entity_iterator) {
+  if (System_IterationFinished(entity_iterator)) {
+    return SYSTEM_STATUS_CODE_ITERATION_ALREADY_COMPLETED;
+  }
+  ++entity_iterator->position;
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode
+System_CopyEntityIterator(const System_EntityIterator entity_iterator,
+                          System_EntityIterator *entity_iterator_copy) {
+  if (!entity_iterator || !entity_iterator_copy) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  return Runtime::Instance().CopyIterator(*entity_iterator,
+                                          entity_iterator_copy);
+}
+
+System_StatusCode System_GetComponent(const System_EntityIterator entity_iterator,
+                                      System_ComponentId component_id,
+                                      uint8_t *component_data_out,
+                                      uint32_t component_data_size) {
+  System_EntityIndex entity;
+  if (!Current(entity_iterator, &entity)) {
+    return SYSTEM_STATUS_CODE_ITERATION_ALREADY_COMPLETED;
+  }
+  return Runtime::Instance().GetComponent(entity, component_id,
+                                          component_data_out,
+                                          component_data_size);
+}
+
+System_StatusCode System_UpdateComponent(System_EntityIterator entity_iterator,
+                                         System_ComponentId component_id,
+                                         uint8_t *component_data_in,
+                                         uint32_t component_data_size) {
+  System_EntityIndex entity;
+  if (!Current(entity_iterator, &entity)) {
+    return SYSTEM_STATUS_CODE_ITERATION_ALREADY_COMPLETED;
+  }
+  return Runtime::Instance().UpdateComponent(
+      entity, component_id, component_data_in, component_data_size);
+}
+
+System_StatusCode
+System_GetComponentsBulk(System_EntityIterator entity_iterator,
+                         const System_ComponentColumnType *columns,
+                         uint32_t column_count, uint32_t max_entity_count,
+                         uint32_t *entity_count_out) {
+  if (!entity_iterator || !entity_count_out) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  const auto &entities = *entity_iterator->entities;
+  const std::size_t position =
+      std::min(entity_iterator->position, entities.size());
+  const std::size_t count =
+      std::min<std::size_t>(max_entity_count, entities.size() - position);
+  if (auto rc = Runtime::Instance().GetColumns(
+          entities.data() + position, count, columns, column_count);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    return rc;
+  }
+  entity_iterator->position = position + count;
+  *entity_count_out = static_cast<uint32_t>(count);
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode
+System_UpdateComponentsBulk(System_EntityIterator entity_iterator,
+                            const System_ComponentColumnType *columns,
+                            uint32_t column_count, uint32_t entity_count) {
+  if (!entity_iterator) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  const auto &entities = *entity_iterator->entities;
+  const std::size_t position = entity_iterator->position;
+  if (position > entities.size() || entity_count > entities.size() - position) {
+    return SYSTEM_STATUS_CODE_OUT_OF_RANGE;
+  }
+  if (auto rc = Runtime::Instance().UpdateColumns(
+          entities.data() + position, entity_count, columns, column_count);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    return rc;
+  }
+  entity_iterator->position = position + entity_count;
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode System_GetEntityIndices(System_EntityIterator entity_iterator,
+                                          System_EntityIndex *entity_indices_out,
+                                          uint32_t max_entity_count,
+                                          uint32_t *entity_count_out) {
+  if (!entity_iterator || !entity_count_out ||
+      (max_entity_count > 0 && !entity_indices_out)) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  const auto &entities = *entity_iterator->entities;
+  const std::size_t position =
+      std::min(entity_iterator->position, entities.size());
+  const std::size_t count =
+      std::min<std::size_t>(max_entity_count, entities.size() - position);
+  std::copy_n(entities.data() + position, count, entity_indices_out);
+  entity_iterator->position = position + count;
+  *entity_count_out = static_cast<uint32_t>(count);
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode System_RemoveComponent(System_EntityIterator entity_iterator,
+                                         System_ComponentId component_id) {
+  System_EntityIndex entity;
+  if (!Current(entity_iterator, &entity)) {
+    return SYSTEM_STATUS_CODE_ITERATION_ALREADY_COMPLETED;
+  }
+  return Runtime::Instance().RemoveComponent(entity, component_id);
+}
+
+System_StatusCode
+System_AddComponent(System_EntityIterator entity_iterator,
+                    System_ComponentInstanceType *component_instance) {
+  System_EntityIndex entity;
+  if (!Current(entity_iterator, &entity)) {
+    return SYSTEM_STATUS_CODE_ITERATION_ALREADY_COMPLETED;
+  }
+  if (!component_instance) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  return Runtime::Instance().AddComponent(entity, *component_instance);
+}
+
+System_StatusCode System_DeleteEntity(System_EntityIterator entity_iterator) {
+  System_EntityIndex entity;
+  if (!Current(entity_iterator, &entity)) {
+    return SYSTEM_STATUS_CODE_ITERATION_ALREADY_COMPLETED;
+  }
+  return Runtime::Instance().DeleteEntity(entity);
+}
+
+System_StatusCode
+System_CreateEntity(System_Handle system_handle,
+                    System_ComponentInstanceType *initial_components,
+                    uint32_t initial_component_count) {
+  if (!system_handle) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  return Runtime::Instance().CreateEntity(initial_components,
+                                          initial_component_count);
+}
+
+System_StatusCode System_SetWriter(System_EntityIterator entity_iterator,
+                                   System_ComponentId component_id,
+                                   const char *system_layer) {
+  System_EntityIndex entity;
+  if (!Current(entity_iterator, &entity)) {
+    return SYSTEM_STATUS_CODE_ITERATION_ALREADY_COMPLETED;
+  }
+  return Runtime::Instance().SetWriter(entity, component_id, system_layer);
+}
+
+System_StatusCode System_SendLogMessage(System_Handle system_handle,
+                                        System_LogMessageInfoType *msg_info) {
+  if (!system_handle || !msg_info) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  return Runtime::Instance().SendLogMessage(*msg_info);
+}
+
+System_StatusCode System_Run(int major_version, int minor_version,
+                             int patch_version, System_Handle handle,
+                             System_TickCallbackType system_tick_cb,
+                             void *user_context) {
+  // Only the major version breaks compatibility
+  static_cast<void>(minor_version);
+  static_cast<void>(patch_version);
+  if (major_version != SYSTEM_API_VERSION_MAJOR) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  return Runtime::Instance().Run(handle, system_tick_cb, user_context);
+}
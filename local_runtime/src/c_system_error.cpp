@@ -0,0 +1,35 @@
+#include <improbable/system/c_system_error.h>
+
+const char *System_StatusCodeToString(System_StatusCode status_code) {
+  switch (status_code) {
+  case SYSTEM_STATUS_CODE_SUCCESS:
+    return "SUCCESS";
+  case SYSTEM_STATUS_CODE_NO_WRITE_ACCESS:
+    return "NO_WRITE_ACCESS";
+  case SYSTEM_STATUS_CODE_INVALID_DATA_SIZE:
+    return "INVALID_DATA_SIZE";
+  case SYSTEM_STATUS_CODE_ITERATION_ALREADY_COMPLETED:
+    return "ITERATION_ALREADY_COMPLETED";
+  case SYSTEM_STATUS_CODE_INVALID_COMPONENT:
+    return "INVALID_COMPONENT";
+  case SYSTEM_STATUS_CODE_ALREADY_EXISTS:
+    return "ALREADY_EXISTS";
+  case SYSTEM_STATUS_CODE_OUT_OF_MEMORY:
+    return "OUT_OF_MEMORY";
+  case SYSTEM_STATUS_CODE_MISSING_COMPONENT:
+    return "MISSING_COMPONENT";
+  case SYSTEM_STATUS_CODE_NO_TICK_RATE_CONFIG:
+    return "NO_TICK_RATE_CONFIG";
+  case SYSTEM_STATUS_CODE_INVALID_ARGUMENT:
+    return "INVALID_ARGUMENT";
+  case SYSTEM_STATUS_CODE_OUT_OF_RANGE:
+    return "OUT_OF_RANGE";
+  case SYSTEM_STATUS_CODE_NOT_IMPLEMENTED:
+    return "NOT_IMPLEMENTED";
+  case SYSTEM_STATUS_CODE_ERROR:
+    return "ERROR";
+  case SYSTEM_STATUS_CODE_ABORT:
+    return "ABORT";
+  }
+  return "UNKNOWN";
+}
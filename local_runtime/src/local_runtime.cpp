@@ -0,0 +1,135 @@
+#include "runtime.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace LocalRuntime {
+
+namespace {
+
+const char *Environment(const char *name) {
+  const char *value = std::getenv(name);
+  return value && *value ? value : nullptr;
+}
+
+bool ParseLogLevel(const std::string &text, System_LogLevel *level) {
+  static const struct {
+    const char *name;
+    System_LogLevel level;
+  } kLevels[] = {{"LOG_LEVEL_TRACE", LOG_LEVEL_TRACE},
+                 {"LOG_LEVEL_DEBUG", LOG_LEVEL_DEBUG},
+                 {"LOG_LEVEL_INFO", LOG_LEVEL_INFO},
+                 {"LOG_LEVEL_WARN", LOG_LEVEL_WARN},
+                 {"LOG_LEVEL_ERROR", LOG_LEVEL_ERROR},
+                 {"LOG_LEVEL_ALWAYS", LOG_LEVEL_ALWAYS}};
+  for (const auto &entry : kLevels) {
+    if (text == entry.name) {
+      *level = entry.level;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Warn(const char *variable, const char *value) {
+  std::cerr << "Local runtime ignoring " << variable << "=\"" << value
+            << "\"" << std::endl;
+}
+
+} // namespace
+
+Configuration ConfigurationFromEnvironment() {
+  Configuration configuration;
+
+  if (const char *value = Environment("LOCAL_RUNTIME_EXECUTION_MODE")) {
+    if (std::strcmp(value, "EXECUTION_MODE_AS_FAST_AS_POSSIBLE") == 0) {
+      configuration.execution_mode =
+          LOCAL_RUNTIME_EXECUTION_MODE_AS_FAST_AS_POSSIBLE;
+    } else if (std::strcmp(value, "EXECUTION_MODE_REAL_TIME") == 0) {
+      configuration.execution_mode = LOCAL_RUNTIME_EXECUTION_MODE_REAL_TIME;
+    } else {
+      Warn("LOCAL_RUNTIME_EXECUTION_MODE", value);
+    }
+  }
+  if (const char *value = Environment("LOCAL_RUNTIME_TICK_RATE")) {
+    double seconds = 0;
+    if (ParseDuration(value, &seconds) && seconds > 0) {
+      configuration.tick_rate_seconds = seconds;
+    } else {
+      Warn("LOCAL_RUNTIME_TICK_RATE", value);
+    }
+  }
+  if (const char *value = Environment("LOCAL_RUNTIME_SIMULATION_DURATION")) {
+    double seconds = 0;
+    if (ParseDuration(value, &seconds)) {
+      configuration.simulation_duration_seconds = seconds;
+    } else {
+      Warn("LOCAL_RUNTIME_SIMULATION_DURATION", value);
+    }
+  }
+  if (const char *value = Environment("LOCAL_RUNTIME_MAX_TICKS")) {
+    configuration.max_ticks =
+        static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+  }
+  if (const char *value = Environment("LOCAL_RUNTIME_WRITE_COMPONENTS")) {
+    for (const char *cursor = value; *cursor;) {
+      char *end = nullptr;
+      const auto component_id = std::strtoul(cursor, &end, 10);
+      if (end == cursor) {
+        Warn("LOCAL_RUNTIME_WRITE_COMPONENTS", value);
+        configuration.write_components.clear();
+        break;
+      }
+      configuration.write_components.push_back(
+          static_cast<System_ComponentId>(component_id));
+      cursor = *end == ',' ? end + 1 : end;
+    }
+  }
+  if (const char *value = Environment("LOCAL_RUNTIME_LOG_LEVEL")) {
+    if (!ParseLogLevel(value, &configuration.log_level)) {
+      Warn("LOCAL_RUNTIME_LOG_LEVEL", value);
+    }
+  }
+  return configuration;
+}
+
+} // namespace LocalRuntime
+
+using LocalRuntime::Runtime;
+
+void LocalRuntime_DefaultConfiguration(
+    LocalRuntime_Configuration *configuration) {
+  // The returned component list must outlive the call, so it points at a
+  // copy that lives as long as the process
+  static const auto defaults = LocalRuntime::ConfigurationFromEnvironment();
+  configuration->execution_mode = defaults.execution_mode;
+  configuration->tick_rate_seconds = defaults.tick_rate_seconds;
+  configuration->simulation_duration_seconds =
+      defaults.simulation_duration_seconds;
+  configuration->max_ticks = defaults.max_ticks;
+  configuration->write_components = defaults.write_components.data();
+  configuration->write_component_count =
+      static_cast<uint32_t>(defaults.write_components.size());
+  configuration->log_level = defaults.log_level;
+}
+
+void LocalRuntime_Configure(const LocalRuntime_Configuration *configuration) {
+  LocalRuntime::Configuration copy;
+  copy.execution_mode = configuration->execution_mode;
+  copy.tick_rate_seconds = configuration->tick_rate_seconds;
+  copy.simulation_duration_seconds =
+      configuration->simulation_duration_seconds;
+  copy.max_ticks = configuration->max_ticks;
+  copy.write_components.assign(configuration->write_components,
+                               configuration->write_components +
+                                   configuration->write_component_count);
+  copy.log_level = configuration->log_level;
+  Runtime::Instance().Configure(copy);
+}
+
+void LocalRuntime_Reset() { Runtime::Instance().Reset(); }
+
+uint32_t LocalRuntime_EntityCount() {
+  return Runtime::Instance().EntityCount();
+}
@@ -0,0 +1,864 @@
+#include "runtime.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace LocalRuntime {
+
+namespace {
+
+const char *LevelName(System_LogLevel level) {
+  switch (level) {
+  case LOG_LEVEL_TRACE:
+    return "TRACE";
+  case LOG_LEVEL_DEBUG:
+    return "DEBUG";
+  case LOG_LEVEL_INFO:
+    return "INFO";
+  case LOG_LEVEL_WARN:
+    return "WARN";
+  case LOG_LEVEL_ERROR:
+    return "ERROR";
+  case LOG_LEVEL_ALWAYS:
+    return "ALWAYS";
+  }
+  return "UNKNOWN";
+}
+
+// Where the k-th entity of a bulk transfer goes in a column's buffer
+uint8_t *ColumnEntry(const System_ComponentColumnType &column, std::size_t k) {
+  const std::size_t stride = column.stride ? column.stride : column.field_size;
+  return column.data + k * stride;
+}
+
+// Whether the constraint is of a known type
+bool Valid(const System_Query_Constraint &constraint) {
+  switch (constraint.constraint_type) {
+  case SYSTEM_QUERY_CONSTRAINT_TYPE_ABSOLUTE_SPHERE:
+  case SYSTEM_QUERY_CONSTRAINT_TYPE_ENTITY_INDEX:
+  case SYSTEM_QUERY_CONSTRAINT_TYPE_COMPONENT:
+    return true;
+  }
+  return false;
+}
+
+// Deeper compound constraints are rejected, which also catches operands that
+// refer back to the constraint holding them
+constexpr int kMaxConstraintDepth = 32;
+
+// Whether every constraint in the tree is of a known type with its operands
+// present
+bool Valid(const System_Query_CompoundConstraint &constraint, int depth) {
+  if (depth > kMaxConstraintDepth) {
+    return false;
+  }
+  switch (constraint.constraint_type) {
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_SIMPLE:
+    return Valid(constraint.simple_constraint);
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_ABSOLUTE_BOX:
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_ABSOLUTE_CYLINDER:
+    return true;
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_AND:
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_OR:
+    if (constraint.operand_count > 0 && !constraint.operands) {
+      return false;
+    }
+    for (uint32_t i = 0; i < constraint.operand_count; ++i) {
+      if (!Valid(constraint.operands[i], depth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+} // namespace
+
+void ComponentTable::Put(System_EntityIndex entity,
+                         const uint8_t *component_data) {
+  if (entity >= present.size()) {
+    const std::size_t capacity =
+        std::max<std::size_t>(entity + 1, present.size() * 2);
+    present.resize(capacity, 0);
+    data.resize(capacity * size);
+  }
+  std::memcpy(At(entity), component_data, size);
+  present[entity] = 1;
+}
+
+void PositionGrid::Build(const System_EntityIndex *entities,
+                         const double *coords, std::size_t count,
+                         double cell_size) {
+  entities_.resize(count);
+  coords_.resize(3 * count);
+  if (count == 0) {
+    return;
+  }
+
+  double lower[3] = {coords[0], coords[1], coords[2]};
+  double upper[3] = {coords[0], coords[1], coords[2]};
+  for (std::size_t i = 1; i < count; ++i) {
+    for (int axis = 0; axis < 3; ++axis) {
+      lower[axis] = std::min(lower[axis], coords[3 * i + axis]);
+      upper[axis] = std::max(upper[axis], coords[3 * i + axis]);
+    }
+  }
+
+  // Coarsen the cells until there are at most a few per entity, so sparse
+  // worlds do not get a huge, mostly empty table
+  if (!(cell_size > 0)) {
+    cell_size = 1;
+  }
+  const std::size_t max_cells = 4 * count + 64;
+  for (;;) {
+    std::size_t cell_count = 1;
+    for (int axis = 0; axis < 3; ++axis) {
+      const double cells = std::floor((upper[axis] - lower[axis]) / cell_size);
+      // An entity at an infinite or NaN coordinate leaves the extent without
+      // a finite size; the axis gets a single cell
+      dims_[axis] =
+          std::isfinite(cells) ? static_cast<int>(std::min(cells, 1e6)) + 1 : 1;
+      cell_count *= static_cast<std::size_t>(dims_[axis]);
+    }
+    if (cell_count <= max_cells) {
+      break;
+    }
+    cell_size *= 2;
+  }
+  for (int axis = 0; axis < 3; ++axis) {
+    origin_[axis] = lower[axis];
+  }
+  inverse_cell_size_ = 1.0 / cell_size;
+
+  // Counting sort by cell; stable, so each cell keeps the entities' order
+  const std::size_t cell_count =
+      static_cast<std::size_t>(dims_[0]) * dims_[1] * dims_[2];
+  cells_.resize(count);
+  cell_starts_.assign(cell_count + 1, 0);
+  for (std::size_t i = 0; i < count; ++i) {
+    const std::size_t cell =
+        (static_cast<std::size_t>(Cell(coords[3 * i + 2], 2)) * dims_[1] +
+         Cell(coords[3 * i + 1], 1)) *
+            dims_[0] +
+        Cell(coords[3 * i], 0);
+    cells_[i] = static_cast<uint32_t>(cell);
+    ++cell_starts_[cell + 1];
+  }
+  for (std::size_t c = 0; c < cell_count; ++c) {
+    cell_starts_[c + 1] += cell_starts_[c];
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    const std::size_t k = cell_starts_[cells_[i]]++;
+    entities_[k] = entities[i];
+    std::memcpy(&coords_[3 * k], &coords[3 * i], 3 * sizeof(double));
+  }
+  // The fill advanced each start to the next cell's; shift them back
+  for (std::size_t c = cell_count; c > 0; --c) {
+    cell_starts_[c] = cell_starts_[c - 1];
+  }
+  cell_starts_[0] = 0;
+}
+
+int PositionGrid::Cell(double value, int axis) const {
+  const double cell = std::floor((value - origin_[axis]) * inverse_cell_size_);
+  if (!(cell >= 0)) {
+    return 0;
+  }
+  return static_cast<int>(std::min(cell, static_cast<double>(dims_[axis] - 1)));
+}
+
+Runtime::Runtime() : configuration_(ConfigurationFromEnvironment()) {}
+
+Runtime &Runtime::Instance() {
+  static Runtime runtime;
+  return runtime;
+}
+
+void Runtime::Reset() {
+  alive_.clear();
+  next_entity_ = 0;
+  tables_.clear();
+  pending_changes_.clear();
+  pending_data_.clear();
+  iterated_entities_.clear();
+}
+
+uint32_t Runtime::EntityCount() const {
+  return static_cast<uint32_t>(std::count(alive_.begin(), alive_.end(), 1));
+}
+
+const ComponentTable *
+Runtime::FindTable(System_ComponentId component_id) const {
+  for (const auto &table : tables_) {
+    if (table.id == component_id) {
+      return &table;
+    }
+  }
+  return nullptr;
+}
+
+ComponentTable *Runtime::FindTable(System_ComponentId component_id) {
+  for (auto &table : tables_) {
+    if (table.id == component_id) {
+      return &table;
+    }
+  }
+  return nullptr;
+}
+
+System_StatusCode Runtime::TableFor(System_ComponentId component_id,
+                                    uint32_t size, ComponentTable **table) {
+  if (auto *existing = FindTable(component_id)) {
+    if (existing->size != size) {
+      return SYSTEM_STATUS_CODE_INVALID_DATA_SIZE;
+    }
+    *table = existing;
+    return SYSTEM_STATUS_CODE_SUCCESS;
+  }
+  if (size == 0) {
+    return SYSTEM_STATUS_CODE_INVALID_DATA_SIZE;
+  }
+  tables_.push_back(ComponentTable{component_id, size, {}, {}});
+  *table = &tables_.back();
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+bool Runtime::CanWrite(System_ComponentId component_id) const {
+  const auto &writable = configuration_.write_components;
+  return writable.empty() ||
+         std::find(writable.begin(), writable.end(), component_id) !=
+             writable.end();
+}
+
+System_StatusCode Runtime::Enqueue(PendingChange::Type type,
+                                   System_EntityIndex entity,
+                                   System_ComponentId component_id,
+                                   const uint8_t *data, uint32_t size) {
+  const std::size_t offset = pending_data_.size();
+  if (size > 0) {
+    pending_data_.insert(pending_data_.end(), data, data + size);
+  }
+  pending_changes_.push_back(
+      PendingChange{type, entity, component_id, offset, size});
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+void Runtime::CommitPendingChanges() {
+  for (const auto &change : pending_changes_) {
+    const uint8_t *data = pending_data_.data() + change.data_offset;
+    switch (change.type) {
+    case PendingChange::Type::kCreate:
+      if (change.entity >= alive_.size()) {
+        alive_.resize(change.entity + 1, 0);
+      }
+      alive_[change.entity] = 1;
+      break;
+    case PendingChange::Type::kAdd:
+      if (Alive(change.entity)) {
+        FindTable(change.component_id)->Put(change.entity, data);
+      }
+      break;
+    case PendingChange::Type::kUpdate:
+      if (auto *table = FindTable(change.component_id);
+          table && table->Has(change.entity)) {
+        std::memcpy(table->At(change.entity), data, table->size);
+      }
+      break;
+    case PendingChange::Type::kRemove:
+      if (auto *table = FindTable(change.component_id);
+          table && table->Has(change.entity)) {
+        table->present[change.entity] = 0;
+      }
+      break;
+    case PendingChange::Type::kDelete:
+      if (Alive(change.entity)) {
+        alive_[change.entity] = 0;
+        for (auto &table : tables_) {
+          if (table.Has(change.entity)) {
+            table.present[change.entity] = 0;
+          }
+        }
+      }
+      break;
+    }
+  }
+  pending_changes_.clear();
+  pending_data_.clear();
+}
+
+void Runtime::CollectIteratedEntities() {
+  iterated_entities_.clear();
+  const auto &writable = configuration_.write_components;
+  for (System_EntityIndex entity = 0; entity < alive_.size(); ++entity) {
+    if (!alive_[entity]) {
+      continue;
+    }
+    bool writes_any = writable.empty();
+    for (auto component_id : writable) {
+      const auto *table = FindTable(component_id);
+      if (table && table->Has(entity)) {
+        writes_any = true;
+        break;
+      }
+    }
+    if (writes_any) {
+      iterated_entities_.push_back(entity);
+    }
+  }
+}
+
+System_StatusCode Runtime::Run(System_Handle handle,
+                               System_TickCallbackType callback,
+                               void *user_context) {
+  using Clock = std::chrono::steady_clock;
+  if (!handle || !callback || configuration_.tick_rate_seconds <= 0) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+
+  const auto tick_period =
+      std::chrono::duration<double>(configuration_.tick_rate_seconds);
+  const auto total_ticks = static_cast<uint64_t>(std::llround(
+      configuration_.simulation_duration_seconds /
+      configuration_.tick_rate_seconds));
+  const bool real_time = configuration_.execution_mode ==
+                         LOCAL_RUNTIME_EXECUTION_MODE_REAL_TIME;
+  const auto start = Clock::now();
+
+  uint64_t elapsed_ticks = 0;
+  uint32_t callbacks = 0;
+  while (elapsed_ticks < total_ticks &&
+         (configuration_.max_ticks == 0 ||
+          callbacks < configuration_.max_ticks)) {
+    uint32_t ticks_fired = 1;
+    if (real_time) {
+      // Wait for the next tick boundary, then report every boundary that has
+      // passed since the previous callback
+      const auto next_tick = start + tick_period * (elapsed_ticks + 1);
+      std::this_thread::sleep_until(
+          std::chrono::time_point_cast<Clock::duration>(next_tick));
+      const auto now_ticks = static_cast<uint64_t>(
+          std::chrono::duration<double>(Clock::now() - start) / tick_period);
+      const auto fired =
+          std::min(now_ticks, total_ticks) - std::min(elapsed_ticks, now_ticks);
+      ticks_fired = static_cast<uint32_t>(std::max<uint64_t>(fired, 1));
+    }
+    elapsed_ticks += ticks_fired;
+
+    CommitPendingChanges();
+    CollectIteratedEntities();
+
+    iterators_in_use_ = 0;
+    System_EntityIterator iterator = nullptr;
+    CopyIterator(System_EntityIterator_Data{&iterated_entities_, 0},
+                 &iterator);
+    ++callbacks;
+    if (auto rc = callback(handle, iterator, user_context, ticks_fired);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      return rc;
+    }
+  }
+  CommitPendingChanges();
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode Runtime::CopyIterator(const System_EntityIterator_Data &source,
+                                        System_EntityIterator *copy) {
+  if (iterators_in_use_ == iterators_.size()) {
+    iterators_.push_back(std::make_unique<System_EntityIterator_Data>());
+  }
+  auto *iterator = iterators_[iterators_in_use_++].get();
+  *iterator = source;
+  *copy = iterator;
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode Runtime::GetComponent(System_EntityIndex entity,
+                                        System_ComponentId component_id,
+                                        uint8_t *data_out,
+                                        uint32_t size) const {
+  const auto *table = FindTable(component_id);
+  if (!table) {
+    return SYSTEM_STATUS_CODE_INVALID_COMPONENT;
+  }
+  if (!table->Has(entity)) {
+    return SYSTEM_STATUS_CODE_MISSING_COMPONENT;
+  }
+  if (size != table->size || !data_out) {
+    return SYSTEM_STATUS_CODE_INVALID_DATA_SIZE;
+  }
+  std::memcpy(data_out, table->At(entity), size);
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode Runtime::UpdateComponent(System_EntityIndex entity,
+                                           System_ComponentId component_id,
+                                           const uint8_t *data_in,
+                                           uint32_t size) {
+  if (!CanWrite(component_id)) {
+    return SYSTEM_STATUS_CODE_NO_WRITE_ACCESS;
+  }
+  const auto *table = FindTable(component_id);
+  if (!table) {
+    return SYSTEM_STATUS_CODE_INVALID_COMPONENT;
+  }
+  if (!table->Has(entity)) {
+    return SYSTEM_STATUS_CODE_MISSING_COMPONENT;
+  }
+  if (size != table->size || !data_in) {
+    return SYSTEM_STATUS_CODE_INVALID_DATA_SIZE;
+  }
+  return Enqueue(PendingChange::Type::kUpdate, entity, component_id, data_in,
+                 size);
+}
+
+System_StatusCode
+Runtime::AddComponent(System_EntityIndex entity,
+                      const System_ComponentInstanceType &instance) {
+  if (!CanWrite(instance.component_id)) {
+    return SYSTEM_STATUS_CODE_NO_WRITE_ACCESS;
+  }
+  ComponentTable *table = nullptr;
+  if (auto rc = TableFor(instance.component_id, instance.component_data_size,
+                         &table);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    return rc;
+  }
+  if (table->Has(entity)) {
+    return SYSTEM_STATUS_CODE_ALREADY_EXISTS;
+  }
+  if (!instance.component_data) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  return Enqueue(PendingChange::Type::kAdd, entity, instance.component_id,
+                 instance.component_data, instance.component_data_size);
+}
+
+System_StatusCode Runtime::RemoveComponent(System_EntityIndex entity,
+                                           System_ComponentId component_id) {
+  if (!CanWrite(component_id)) {
+    return SYSTEM_STATUS_CODE_NO_WRITE_ACCESS;
+  }
+  const auto *table = FindTable(component_id);
+  if (!table) {
+    return SYSTEM_STATUS_CODE_INVALID_COMPONENT;
+  }
+  if (!table->Has(entity)) {
+    return SYSTEM_STATUS_CODE_MISSING_COMPONENT;
+  }
+  return Enqueue(PendingChange::Type::kRemove, entity, component_id, nullptr,
+                 0);
+}
+
+System_StatusCode Runtime::DeleteEntity(System_EntityIndex entity) {
+  return Enqueue(PendingChange::Type::kDelete, entity, 0, nullptr, 0);
+}
+
+System_StatusCode
+Runtime::CreateEntity(const System_ComponentInstanceType *components,
+                      uint32_t component_count) {
+  if (component_count > 0 && !components) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  // Validate everything before queueing anything, so a rejected entity
+  // leaves no partial state behind
+  for (uint32_t i = 0; i < component_count; ++i) {
+    ComponentTable *table = nullptr;
+    if (auto rc = TableFor(components[i].component_id,
+                           components[i].component_data_size, &table);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      return rc;
+    }
+    if (!components[i].component_data) {
+      return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+    }
+    for (uint32_t j = 0; j < i; ++j) {
+      if (components[j].component_id == components[i].component_id) {
+        return SYSTEM_STATUS_CODE_ALREADY_EXISTS;
+      }
+    }
+  }
+
+  const auto entity = next_entity_++;
+  Enqueue(PendingChange::Type::kCreate, entity, 0, nullptr, 0);
+  for (uint32_t i = 0; i < component_count; ++i) {
+    Enqueue(PendingChange::Type::kAdd, entity, components[i].component_id,
+            components[i].component_data, components[i].component_data_size);
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode Runtime::SetWriter(System_EntityIndex entity,
+                                     System_ComponentId component_id,
+                                     const char *layer) const {
+  // There is only ever one system, so every writer change is a no-op
+  if (!layer) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  const auto *table = FindTable(component_id);
+  if (!table || !table->Has(entity)) {
+    return SYSTEM_STATUS_CODE_MISSING_COMPONENT;
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode
+Runtime::SendLogMessage(const System_LogMessageInfoType &message) const {
+  if (!message.message) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  if (message.level >= configuration_.log_level) {
+    std::printf("[%s] %s\n", LevelName(message.level), message.message);
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode
+Runtime::CheckColumns(const System_EntityIndex *entities,
+                      std::size_t entity_count,
+                      const System_ComponentColumnType *columns,
+                      uint32_t column_count) const {
+  if (column_count > 0 && !columns) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+  for (uint32_t i = 0; i < column_count; ++i) {
+    const auto &column = columns[i];
+    const auto *table = FindTable(column.component_id);
+    if (!table) {
+      return SYSTEM_STATUS_CODE_INVALID_COMPONENT;
+    }
+    if (column.component_data_size != table->size || column.field_size == 0 ||
+        column.field_offset > table->size ||
+        column.field_size > table->size - column.field_offset) {
+      return SYSTEM_STATUS_CODE_INVALID_DATA_SIZE;
+    }
+    if (!column.data) {
+      return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+    }
+    for (std::size_t k = 0; k < entity_count; ++k) {
+      if (!table->Has(entities[k])) {
+        return SYSTEM_STATUS_CODE_MISSING_COMPONENT;
+      }
+    }
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode Runtime::GetColumns(const System_EntityIndex *entities,
+                                      std::size_t entity_count,
+                                      const System_ComponentColumnType *columns,
+                                      uint32_t column_count) const {
+  if (auto rc = CheckColumns(entities, entity_count, columns, column_count);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    return rc;
+  }
+  // Column by column, so each pass reads one table and writes one buffer
+  for (uint32_t i = 0; i < column_count; ++i) {
+    const auto &column = columns[i];
+    const auto *table = FindTable(column.component_id);
+    if (column.field_size == sizeof(double)) {
+      for (std::size_t k = 0; k < entity_count; ++k) {
+        std::memcpy(ColumnEntry(column, k),
+                    table->At(entities[k]) + column.field_offset,
+                    sizeof(double));
+      }
+      continue;
+    }
+    for (std::size_t k = 0; k < entity_count; ++k) {
+      std::memcpy(ColumnEntry(column, k),
+                  table->At(entities[k]) + column.field_offset,
+                  column.field_size);
+    }
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+System_StatusCode
+Runtime::UpdateColumns(const System_EntityIndex *entities,
+                       std::size_t entity_count,
+                       const System_ComponentColumnType *columns,
+                       uint32_t column_count) {
+  if (auto rc = CheckColumns(entities, entity_count, columns, column_count);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    return rc;
+  }
+  for (uint32_t i = 0; i < column_count; ++i) {
+    if (!CanWrite(columns[i].component_id)) {
+      return SYSTEM_STATUS_CODE_NO_WRITE_ACCESS;
+    }
+  }
+
+  // One update per entity and component, as the per-entity calls would
+  // queue: the component's current value with every column for it laid over
+  for (std::size_t k = 0; k < entity_count; ++k) {
+    for (uint32_t i = 0; i < column_count; ++i) {
+      const auto component_id = columns[i].component_id;
+      bool seen = false;
+      for (uint32_t j = 0; j < i && !seen; ++j) {
+        seen = columns[j].component_id == component_id;
+      }
+      if (seen) {
+        continue;
+      }
+      const auto *table = FindTable(component_id);
+      const std::size_t offset = pending_data_.size();
+      pending_data_.insert(pending_data_.end(), table->At(entities[k]),
+                           table->At(entities[k]) + table->size);
+      for (uint32_t j = i; j < column_count; ++j) {
+        const auto &column = columns[j];
+        if (column.component_id == component_id) {
+          std::memcpy(pending_data_.data() + offset + column.field_offset,
+                      ColumnEntry(column, k), column.field_size);
+        }
+      }
+      pending_changes_.push_back(PendingChange{PendingChange::Type::kUpdate,
+                                               entities[k], component_id,
+                                               offset, table->size});
+    }
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+bool Runtime::PositionOf(System_EntityIndex entity, double coords[3]) const {
+  const auto *positions = FindTable(kPositionComponentId);
+  if (!positions || !positions->Has(entity)) {
+    return false;
+  }
+  std::memcpy(coords, positions->At(entity), 3 * sizeof(double));
+  return true;
+}
+
+bool Runtime::Matches(const System_Query_Constraint &constraint,
+                      System_EntityIndex entity) const {
+  if (!Alive(entity)) {
+    return false;
+  }
+  switch (constraint.constraint_type) {
+  case SYSTEM_QUERY_CONSTRAINT_TYPE_ABSOLUTE_SPHERE: {
+    double coords[3];
+    if (!PositionOf(entity, coords)) {
+      return false;
+    }
+    const auto &sphere = constraint.absolute_sphere_constraint;
+    const double dx = coords[0] - sphere.center.x;
+    const double dy = coords[1] - sphere.center.y;
+    const double dz = coords[2] - sphere.center.z;
+    return dx * dx + dy * dy + dz * dz <= sphere.radius * sphere.radius;
+  }
+  case SYSTEM_QUERY_CONSTRAINT_TYPE_ENTITY_INDEX:
+    return entity == constraint.entity_index_constraint.entity_index;
+  case SYSTEM_QUERY_CONSTRAINT_TYPE_COMPONENT: {
+    const auto *table =
+        FindTable(constraint.component_constraint.component_id);
+    return table && table->Has(entity);
+  }
+  }
+  return false;
+}
+
+bool Runtime::Matches(const System_Query_CompoundConstraint &constraint,
+                      System_EntityIndex entity) const {
+  if (!Alive(entity)) {
+    return false;
+  }
+  double coords[3];
+  switch (constraint.constraint_type) {
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_SIMPLE:
+    return Matches(constraint.simple_constraint, entity);
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_ABSOLUTE_BOX: {
+    if (!PositionOf(entity, coords)) {
+      return false;
+    }
+    const auto &box = constraint.absolute_box_constraint;
+    return std::abs(coords[0] - box.center.x) <= 0.5 * box.edge_length.x &&
+           std::abs(coords[1] - box.center.y) <= 0.5 * box.edge_length.y &&
+           std::abs(coords[2] - box.center.z) <= 0.5 * box.edge_length.z;
+  }
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_ABSOLUTE_CYLINDER: {
+    if (!PositionOf(entity, coords)) {
+      return false;
+    }
+    const auto &cylinder = constraint.absolute_cylinder_constraint;
+    const double dx = coords[0] - cylinder.center.x;
+    const double dz = coords[2] - cylinder.center.z;
+    return dx * dx + dz * dz <= cylinder.radius * cylinder.radius;
+  }
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_AND:
+    for (uint32_t i = 0; i < constraint.operand_count; ++i) {
+      if (!Matches(constraint.operands[i], entity)) {
+        return false;
+      }
+    }
+    return true;
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_OR:
+    for (uint32_t i = 0; i < constraint.operand_count; ++i) {
+      if (Matches(constraint.operands[i], entity)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  return false;
+}
+
+bool Runtime::IndexedCandidates(
+    const System_Query_CompoundConstraint &constraint,
+    std::vector<System_EntityIndex> &candidates) const {
+  switch (constraint.constraint_type) {
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_SIMPLE: {
+    const auto &simple = constraint.simple_constraint;
+    if (simple.constraint_type != SYSTEM_QUERY_CONSTRAINT_TYPE_ENTITY_INDEX) {
+      return false;
+    }
+    candidates.push_back(simple.entity_index_constraint.entity_index);
+    return true;
+  }
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_AND:
+    // Any operand that names its entities bounds the whole and
+    for (uint32_t i = 0; i < constraint.operand_count; ++i) {
+      const auto size = candidates.size();
+      if (IndexedCandidates(constraint.operands[i], candidates)) {
+        return true;
+      }
+      candidates.resize(size);
+    }
+    return false;
+  case SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_OR: {
+    // Only if every operand names its entities
+    const auto size = candidates.size();
+    for (uint32_t i = 0; i < constraint.operand_count; ++i) {
+      if (!IndexedCandidates(constraint.operands[i], candidates)) {
+        candidates.resize(size);
+        return false;
+      }
+    }
+    std::sort(candidates.begin() + size, candidates.end());
+    candidates.erase(std::unique(candidates.begin() + size, candidates.end()),
+                     candidates.end());
+    return true;
+  }
+  }
+  return false;
+}
+
+System_Query_Handle
+Runtime::CreateQuery(const System_Query_CompoundConstraint &constraint) {
+  if (!Valid(constraint, 0)) {
+    return nullptr;
+  }
+
+  System_Query_Handle query = nullptr;
+  if (free_queries_.empty()) {
+    query = new System_Query_Handle_Data;
+  } else {
+    query = free_queries_.back();
+    free_queries_.pop_back();
+  }
+  query->matches.clear();
+  query->position = 0;
+
+  query_candidates_.clear();
+  if (IndexedCandidates(constraint, query_candidates_)) {
+    // Only the named entities can match, so skip the scan
+    for (const auto entity : query_candidates_) {
+      if (Matches(constraint, entity)) {
+        query->matches.push_back(entity);
+      }
+    }
+    return query;
+  }
+  for (System_EntityIndex entity = 0; entity < alive_.size(); ++entity) {
+    if (Matches(constraint, entity)) {
+      query->matches.push_back(entity);
+    }
+  }
+  return query;
+}
+
+void Runtime::DestroyQuery(System_Query_Handle query) {
+  free_queries_.push_back(query);
+}
+
+System_StatusCode
+Runtime::SphereBatch(const System_Query_Constraint_AbsoluteSphere *spheres,
+                     uint32_t sphere_count,
+                     System_Query_SphereBatchResult &result) {
+  if ((sphere_count > 0 && !spheres) || !result.offsets) {
+    return SYSTEM_STATUS_CODE_INVALID_ARGUMENT;
+  }
+
+  // Index every entity a sphere constraint could match
+  batch_entities_.clear();
+  batch_coords_.clear();
+  if (const auto *positions = FindTable(kPositionComponentId)) {
+    for (System_EntityIndex entity = 0; entity < alive_.size(); ++entity) {
+      if (Alive(entity) && positions->Has(entity)) {
+        double coords[3];
+        std::memcpy(coords, positions->At(entity), sizeof(coords));
+        batch_entities_.push_back(entity);
+        batch_coords_.insert(batch_coords_.end(), coords, coords + 3);
+      }
+    }
+  }
+  double max_radius = 0;
+  for (uint32_t i = 0; i < sphere_count; ++i) {
+    max_radius = std::max(max_radius, std::abs(spheres[i].radius));
+  }
+  batch_grid_.Build(batch_entities_.data(), batch_coords_.data(),
+                    batch_entities_.size(), max_radius);
+
+  // Gather each sphere's matches in entity index order
+  batch_matches_.clear();
+  result.offsets[0] = 0;
+  for (uint32_t i = 0; i < sphere_count; ++i) {
+    const std::size_t begin = batch_matches_.size();
+    batch_grid_.ForEachWithin(
+        spheres[i].center, spheres[i].radius,
+        [&](System_EntityIndex entity) { batch_matches_.push_back(entity); });
+    std::sort(batch_matches_.begin() + begin, batch_matches_.end());
+    if (batch_matches_.size() > UINT32_MAX) {
+      return SYSTEM_STATUS_CODE_OUT_OF_MEMORY;
+    }
+    result.offsets[i + 1] = static_cast<uint32_t>(batch_matches_.size());
+  }
+  result.match_count = static_cast<uint32_t>(batch_matches_.size());
+  if (result.match_count > result.match_capacity) {
+    return SYSTEM_STATUS_CODE_OUT_OF_RANGE;
+  }
+
+  if (batch_matches_.empty()) {
+    return SYSTEM_STATUS_CODE_SUCCESS;
+  }
+  if (result.entity_indices) {
+    std::copy(batch_matches_.begin(), batch_matches_.end(),
+              result.entity_indices);
+  }
+  return GetColumns(batch_matches_.data(), batch_matches_.size(),
+                    result.columns, result.column_count);
+}
+
+bool ParseDuration(const std::string &text, double *seconds) {
+  char *end = nullptr;
+  const double value = std::strtod(text.c_str(), &end);
+  if (end == text.c_str() || value < 0) {
+    return false;
+  }
+  const std::string unit = end;
+  if (unit == "s" || unit.empty()) {
+    *seconds = value;
+  } else if (unit == "ms") {
+    *seconds = value / 1000;
+  } else if (unit == "m") {
+    *seconds = value * 60;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+} // namespace LocalRuntime
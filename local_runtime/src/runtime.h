@@ -0,0 +1,268 @@
+#ifndef LOCAL_RUNTIME_RUNTIME_H
+#define LOCAL_RUNTIME_RUNTIME_H
+
+#include <improbable/system/c_query.h>
+#include <improbable/system/c_system.h>
+#include <improbable/system/c_system_error.h>
+#include <local_runtime/local_runtime.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct System_Handle_Data {};
+
+// Visits a fixed list of entity indices. Iterators and their copies are owned
+// by the runtime and recycled once the tick they were handed out in ends.
+struct System_EntityIterator_Data {
+  const std::vector<System_EntityIndex> *entities = nullptr;
+  std::size_t position = 0;
+};
+
+// The matches of a query, evaluated against the committed world when the
+// query was created
+struct System_Query_Handle_Data {
+  std::vector<System_EntityIndex> matches;
+  std::size_t position = 0;
+};
+
+namespace LocalRuntime {
+
+// The standard library Position component, which spatial constraints read
+constexpr System_ComponentId kPositionComponentId = 54;
+
+// Every instance of one component type, stored densely by entity index
+struct ComponentTable {
+  System_ComponentId id = 0;
+  uint32_t size = 0;
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> present;
+
+  bool Has(System_EntityIndex entity) const {
+    return entity < present.size() && present[entity];
+  }
+  uint8_t *At(System_EntityIndex entity) {
+    return data.data() + static_cast<std::size_t>(entity) * size;
+  }
+  const uint8_t *At(System_EntityIndex entity) const {
+    return data.data() + static_cast<std::size_t>(entity) * size;
+  }
+  void Put(System_EntityIndex entity, const uint8_t *component_data);
+};
+
+// A uniform grid over the positions of every live entity, rebuilt for each
+// batch of sphere queries so that each sphere only tests the entities in the
+// cells it overlaps. Entities within a cell are in ascending index order.
+class PositionGrid {
+public:
+  // Buckets `count` entities with the given coordinates (x, y, z triples)
+  // into cells of at least `cell_size`
+  void Build(const System_EntityIndex *entities, const double *coords,
+             std::size_t count, double cell_size);
+
+  // Calls `visit(entity)` for every entity within `radius` of `center`,
+  // using the same test as an absolute sphere constraint
+  template <typename Visitor>
+  void ForEachWithin(const System_Double3 &center, double radius,
+                     Visitor &&visit) const {
+    if (entities_.empty()) {
+      return;
+    }
+    int low[3];
+    int high[3];
+    const double point[3] = {center.x, center.y, center.z};
+    const double reach = std::abs(radius);
+    for (int axis = 0; axis < 3; ++axis) {
+      low[axis] = Cell(point[axis] - reach, axis);
+      high[axis] = Cell(point[axis] + reach, axis);
+    }
+    const double radius_sq = radius * radius;
+    for (int z = low[2]; z <= high[2]; ++z) {
+      for (int y = low[1]; y <= high[1]; ++y) {
+        const std::size_t row = (static_cast<std::size_t>(z) * dims_[1] + y) *
+                                dims_[0];
+        for (std::size_t k = cell_starts_[row + low[0]];
+             k < cell_starts_[row + high[0] + 1]; ++k) {
+          const double *p = &coords_[3 * k];
+          const double dx = p[0] - center.x;
+          const double dy = p[1] - center.y;
+          const double dz = p[2] - center.z;
+          if (dx * dx + dy * dy + dz * dz <= radius_sq) {
+            visit(entities_[k]);
+          }
+        }
+      }
+    }
+  }
+
+private:
+  // The cell along `axis` holding `value`, clamped to the grid
+  int Cell(double value, int axis) const;
+
+  double origin_[3] = {0, 0, 0};
+  double inverse_cell_size_ = 1;
+  int dims_[3] = {1, 1, 1};
+  // Entities and their coordinates in cell order; cell c holds entries
+  // [cell_starts_[c], cell_starts_[c + 1])
+  std::vector<System_EntityIndex> entities_;
+  std::vector<double> coords_;
+  std::vector<uint32_t> cell_starts_;
+  std::vector<uint32_t> cells_;
+};
+
+// A change requested during a tick (or before the first one), applied when
+// the tick ends so that no system observes it until its next tick
+struct PendingChange {
+  enum class Type { kCreate, kUpdate, kAdd, kRemove, kDelete };
+  Type type;
+  System_EntityIndex entity;
+  System_ComponentId component_id;
+  // Component bytes live in Runtime::pending_data_
+  std::size_t data_offset;
+  uint32_t data_size;
+};
+
+struct Configuration {
+  LocalRuntime_ExecutionMode execution_mode =
+      LOCAL_RUNTIME_EXECUTION_MODE_AS_FAST_AS_POSSIBLE;
+  double tick_rate_seconds = 0.1;
+  double simulation_duration_seconds = 10;
+  uint32_t max_ticks = 0;
+  std::vector<System_ComponentId> write_components;
+  System_LogLevel log_level = LOG_LEVEL_INFO;
+};
+
+// The whole simulated world. There is one per process, shared by every
+// system handle; it is not thread safe, so all API calls must come from the
+// thread running the tick.
+class Runtime {
+public:
+  static Runtime &Instance();
+
+  void Configure(const Configuration &configuration) {
+    configuration_ = configuration;
+  }
+  const Configuration &configuration() const { return configuration_; }
+  void Reset();
+  uint32_t EntityCount() const;
+
+  System_StatusCode Run(System_Handle handle, System_TickCallbackType callback,
+                        void *user_context);
+
+  // Entity iterator access
+  System_StatusCode CopyIterator(const System_EntityIterator_Data &source,
+                                 System_EntityIterator *copy);
+  System_StatusCode GetComponent(System_EntityIndex entity,
+                                 System_ComponentId component_id,
+                                 uint8_t *data_out, uint32_t size) const;
+  System_StatusCode UpdateComponent(System_EntityIndex entity,
+                                    System_ComponentId component_id,
+                                    const uint8_t *data_in, uint32_t size);
+  System_StatusCode AddComponent(System_EntityIndex entity,
+                                 const System_ComponentInstanceType &instance);
+  System_StatusCode RemoveComponent(System_EntityIndex entity,
+                                    System_ComponentId component_id);
+  System_StatusCode DeleteEntity(System_EntityIndex entity);
+  System_StatusCode CreateEntity(const System_ComponentInstanceType *components,
+                                 uint32_t component_count);
+  System_StatusCode SetWriter(System_EntityIndex entity,
+                              System_ComponentId component_id,
+                              const char *layer) const;
+  System_StatusCode SendLogMessage(const System_LogMessageInfoType &message) const;
+
+  // Bulk access to the components of a run of entities, for the iterator and
+  // query extensions
+  System_StatusCode GetColumns(const System_EntityIndex *entities,
+                               std::size_t entity_count,
+                               const System_ComponentColumnType *columns,
+                               uint32_t column_count) const;
+  System_StatusCode UpdateColumns(const System_EntityIndex *entities,
+                                  std::size_t entity_count,
+                                  const System_ComponentColumnType *columns,
+                                  uint32_t column_count);
+
+  // Queries
+  bool Matches(const System_Query_Constraint &constraint,
+               System_EntityIndex entity) const;
+  bool Matches(const System_Query_CompoundConstraint &constraint,
+               System_EntityIndex entity) const;
+  // Simple constraints are created as compound ones holding them
+  System_Query_Handle
+  CreateQuery(const System_Query_CompoundConstraint &constraint);
+  void DestroyQuery(System_Query_Handle query);
+  System_StatusCode
+  SphereBatch(const System_Query_Constraint_AbsoluteSphere *spheres,
+              uint32_t sphere_count, System_Query_SphereBatchResult &result);
+
+private:
+  Runtime();
+
+  bool Alive(System_EntityIndex entity) const {
+    return entity < alive_.size() && alive_[entity];
+  }
+  bool CanWrite(System_ComponentId component_id) const;
+  const ComponentTable *FindTable(System_ComponentId component_id) const;
+  ComponentTable *FindTable(System_ComponentId component_id);
+  // Finds or registers the table for a component, checking that its size
+  // agrees with every earlier instance
+  System_StatusCode TableFor(System_ComponentId component_id, uint32_t size,
+                             ComponentTable **table);
+  // Copies the entity's position into `coords`; false if it has none
+  bool PositionOf(System_EntityIndex entity, double coords[3]) const;
+  // Appends the only entities `constraint` can match, in ascending order, if
+  // it names them by index, as an entity index constraint or an and with
+  // one does; returns false if it could match any entity
+  bool IndexedCandidates(const System_Query_CompoundConstraint &constraint,
+                         std::vector<System_EntityIndex> &candidates) const;
+  // Checks that every column names a known component with its size and a
+  // field inside it, and that every entity has the component
+  System_StatusCode CheckColumns(const System_EntityIndex *entities,
+                                 std::size_t entity_count,
+                                 const System_ComponentColumnType *columns,
+                                 uint32_t column_count) const;
+  System_StatusCode Enqueue(PendingChange::Type type, System_EntityIndex entity,
+                            System_ComponentId component_id,
+                            const uint8_t *data, uint32_t size);
+  void CommitPendingChanges();
+  void CollectIteratedEntities();
+
+  Configuration configuration_;
+
+  std::vector<uint8_t> alive_;
+  // Entities that exist, or will once pending creations commit
+  System_EntityIndex next_entity_ = 0;
+  std::vector<ComponentTable> tables_;
+
+  std::vector<PendingChange> pending_changes_;
+  std::vector<uint8_t> pending_data_;
+
+  // Entities the system's iterator visits this tick, and the iterators handed
+  // out for it
+  std::vector<System_EntityIndex> iterated_entities_;
+  std::vector<std::unique_ptr<System_EntityIterator_Data>> iterators_;
+  std::size_t iterators_in_use_ = 0;
+
+  // Destroyed queries, kept to be reused without reallocating their storage
+  std::vector<System_Query_Handle> free_queries_;
+  std::vector<System_EntityIndex> query_candidates_;
+
+  // Working storage for batched sphere queries, kept between calls
+  PositionGrid batch_grid_;
+  std::vector<System_EntityIndex> batch_entities_;
+  std::vector<double> batch_coords_;
+  std::vector<System_EntityIndex> batch_matches_;
+};
+
+// The defaults, overridden by the LOCAL_RUNTIME_* environment variables
+Configuration ConfigurationFromEnvironment();
+
+// Parses a duration such as "0.1s", "100ms" or "2m" into seconds. Returns
+// false if the string is not a duration.
+bool ParseDuration(const std::string &text, double *seconds);
+
+} // namespace LocalRuntime
+
+#endif // LOCAL_RUNTIME_RUNTIME_H
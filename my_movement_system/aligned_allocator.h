@@ -0,0 +1,47 @@
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+
+namespace Memory {
+
+// Standard allocator that over-aligns every allocation, so containers using it
+// start on a cache line boundary and vector loads never split a line
+template <typename T, std::size_t Alignment> struct AlignedAllocator {
+  static_assert(Alignment >= alignof(T) && (Alignment & (Alignment - 1)) == 0,
+                "Alignment must be a power of two no smaller than alignof(T)");
+
+  using value_type = T;
+
+  template <typename U> struct rebind {
+    using other = AlignedAllocator<U, Alignment>;
+  };
+
+  AlignedAllocator() noexcept = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment> &) noexcept {}
+
+  T *allocate(std::size_t count) {
+    return static_cast<T *>(
+        ::operator new(count * sizeof(T), std::align_val_t{Alignment}));
+  }
+
+  void deallocate(T *pointer, std::size_t) noexcept {
+    ::operator delete(pointer, std::align_val_t{Alignment});
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Alignment> &) const noexcept {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, Alignment> &) const noexcept {
+    return false;
+  }
+};
+
+} // namespace Memory
+
+#endif // ALIGNED_ALLOCATOR_H
@@ -0,0 +1,132 @@
+#ifndef BOID_STATE_H
+#define BOID_STATE_H
+
+#include <improbable/standard_library.h>
+#include <myschema.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "aligned_allocator.h"
+
+namespace Boids {
+
+// Columns start on a cache line so SIMD loads from the start of a column are
+// aligned and each column streams through L1 independently
+static constexpr std::size_t kColumnAlignment = 64;
+
+template <typename T>
+using Column = std::vector<T, Memory::AlignedAllocator<T, kColumnAlignment>>;
+
+// Structure-of-arrays store for boid state gathered each tick. Row i of every
+// column belongs to the same boid. Storage is kept across `clear()` so steady
+// state ticks do not reallocate.
+struct BoidState {
+  Column<double> position_x;
+  Column<double> position_y;
+  Column<double> position_z;
+  Column<double> velocity_x;
+  Column<double> velocity_y;
+  Column<double> velocity_z;
+  Column<double> acceleration;
+  // The entity's position in the order it was gathered (the runtime's
+  // iteration or query order), so rows can be reordered and still be written
+  // back to the right entity
+  Column<std::uint32_t> entity_index;
+
+  std::size_t size() const { return position_x.size(); }
+  bool empty() const { return position_x.empty(); }
+
+  void clear() { resize(0); }
+
+  void resize(std::size_t count) {
+    position_x.resize(count);
+    position_y.resize(count);
+    position_z.resize(count);
+    velocity_x.resize(count);
+    velocity_y.resize(count);
+    velocity_z.resize(count);
+    acceleration.resize(count);
+    entity_index.resize(count);
+  }
+
+  void reserve(std::size_t count) {
+    position_x.reserve(count);
+    position_y.reserve(count);
+    position_z.reserve(count);
+    velocity_x.reserve(count);
+    velocity_y.reserve(count);
+    velocity_z.reserve(count);
+    acceleration.reserve(count);
+    entity_index.reserve(count);
+  }
+
+  // Appends a boid from its compiled-schema components
+  void PushBack(const Position &position, const Velocity &velocity,
+                const Acceleration &acceleration_component,
+                std::uint32_t index) {
+    position_x.push_back(position.coords.x);
+    position_y.push_back(position.coords.y);
+    position_z.push_back(position.coords.z);
+    velocity_x.push_back(velocity.value.x);
+    velocity_y.push_back(velocity.value.y);
+    velocity_z.push_back(velocity.value.z);
+    acceleration.push_back(acceleration_component.value);
+    entity_index.push_back(index);
+  }
+
+  Position GetPosition(std::size_t row) const {
+    return Position{Coordinates{position_x[row], position_y[row],
+                                position_z[row]}};
+  }
+
+  Velocity GetVelocity(std::size_t row) const {
+    return Velocity{
+        Vector3D{velocity_x[row], velocity_y[row], velocity_z[row]}};
+  }
+
+  Acceleration GetAcceleration(std::size_t row) const {
+    return Acceleration{acceleration[row]};
+  }
+
+  void SetPosition(std::size_t row, const Position &position) {
+    position_x[row] = position.coords.x;
+    position_y[row] = position.coords.y;
+    position_z[row] = position.coords.z;
+  }
+
+  void SetVelocity(std::size_t row, const Velocity &velocity) {
+    velocity_x[row] = velocity.value.x;
+    velocity_y[row] = velocity.value.y;
+    velocity_z[row] = velocity.value.z;
+  }
+
+  // Replaces this state with the rows of `source` in the order given by
+  // `order`, where `order[i]` is the source row that becomes row i
+  void Permute(const BoidState &source, const std::uint32_t *order) {
+    Select(source, order, source.size());
+  }
+
+  // Replaces this state with `count` rows of `source`, where `order[i]` is
+  // the source row that becomes row i; rows may repeat or be left out
+  void Select(const BoidState &source, const std::uint32_t *order,
+              std::size_t count) {
+    resize(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto row = order[i];
+      position_x[i] = source.position_x[row];
+      position_y[i] = source.position_y[row];
+      position_z[i] = source.position_z[row];
+      velocity_x[i] = source.velocity_x[row];
+      velocity_y[i] = source.velocity_y[row];
+      velocity_z[i] = source.velocity_z[row];
+      acceleration[i] = source.acceleration[row];
+      entity_index[i] = source.entity_index[row];
+    }
+  }
+};
+
+} // namespace Boids
+
+#endif // BOID_STATE_H
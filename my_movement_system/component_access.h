@@ -0,0 +1,196 @@
+#ifndef COMPONENT_ACCESS_H
+#define COMPONENT_ACCESS_H
+
+#include <improbable/standard_library.h>
+#include <improbable/system/c_query.h>
+#include <improbable/system/c_system.h>
+#include <myschema.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Typed access to the components of compiled_schema. Each call names its
+// components by type; the ids and sizes handed to the C API come from the
+// types, and fetching several components unrolls at compile time into the
+// same sequence of C calls a hand-written version would make, stopping at the
+// first failure.
+//
+// Every component used through this layer must be declared in `Schema`
+// below, mirroring its schema file. The declaration is checked against the
+// compiled struct, so a compiled_schema header that has drifted from the
+// schema fails to build instead of handing the runtime buffers of the wrong
+// size.
+namespace Components {
+
+// The fields a schema declaration gives a component, in order. Fields are
+// stored packed, so the component's size is the sum of theirs.
+template <typename... Fields> struct Layout {
+  static constexpr std::size_t kSize = (std::size_t{0} + ... + sizeof(Fields));
+};
+
+// A component's schema declaration: its id, a name for messages and its
+// layout. Left undefined for types that are not declared components.
+template <typename T> struct Schema;
+
+// improbable/standard_library.schema
+template <> struct Schema<Position> {
+  static constexpr std::uint32_t kId = 54;
+  static constexpr char kName[] = "position";
+  using Fields = Layout<double, double, double>;
+};
+
+// schema/myschema.schema
+template <> struct Schema<Velocity> {
+  static constexpr std::uint32_t kId = 1001;
+  static constexpr char kName[] = "velocity";
+  using Fields = Layout<double, double, double>;
+};
+
+template <> struct Schema<Acceleration> {
+  static constexpr std::uint32_t kId = 1003;
+  static constexpr char kName[] = "acceleration";
+  using Fields = Layout<double>;
+};
+
+// Instantiated for every component type the layer touches; fails the build if
+// the compiled struct disagrees with its schema declaration
+template <typename T> constexpr bool CheckComponent() {
+  static_assert(std::is_trivially_copyable_v<T> &&
+                    std::is_standard_layout_v<T>,
+                "Components are copied to and from the runtime as bytes");
+  static_assert(T::kComponentId == Schema<T>::kId,
+                "Compiled component id disagrees with the schema");
+  static_assert(sizeof(T) == Schema<T>::Fields::kSize,
+                "Compiled component size disagrees with the schema");
+  return true;
+}
+
+template <typename... Ts> constexpr bool Distinct() {
+  constexpr std::uint32_t ids[] = {Schema<Ts>::kId..., 0};
+  for (std::size_t i = 0; i < sizeof...(Ts); ++i) {
+    for (std::size_t j = i + 1; j < sizeof...(Ts); ++j) {
+      if (ids[i] == ids[j]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename... Ts> constexpr bool CheckComponents() {
+  static_assert((CheckComponent<Ts>() && ...));
+  static_assert(Distinct<Ts...>(), "A component is named more than once");
+  return true;
+}
+
+// The outcome of accessing several components: success, or the status code
+// of the first call that failed and the component it was for
+struct Status {
+  System_StatusCode code = SYSTEM_STATUS_CODE_SUCCESS;
+  const char *component = nullptr;
+
+  bool ok() const { return code == SYSTEM_STATUS_CODE_SUCCESS; }
+};
+
+namespace Detail {
+
+template <typename T>
+inline uint8_t *Bytes(T &component) {
+  return reinterpret_cast<uint8_t *>(&component);
+}
+
+// Records a failed call in `status`; returns whether the call succeeded, so
+// a fold over `&&` stops at the first failure
+template <typename T>
+inline bool Succeeded(System_StatusCode rc, Status &status) {
+  if (rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    status = Status{rc, Schema<T>::kName};
+    return false;
+  }
+  return true;
+}
+
+} // namespace Detail
+
+// Reads the components of the iterator's current entity
+template <typename... Ts>
+inline Status Get(System_EntityIterator iterator, Ts &...components) {
+  static_assert(CheckComponents<Ts...>());
+  Status status;
+  (void)(Detail::Succeeded<Ts>(
+             System_GetComponent(iterator, Ts::kComponentId,
+                                 Detail::Bytes(components), sizeof(Ts)),
+             status) &&
+         ...);
+  return status;
+}
+
+// Reads the components of the query's current entity
+template <typename... Ts>
+inline Status Get(System_Query_Handle query, Ts &...components) {
+  static_assert(CheckComponents<Ts...>());
+  Status status;
+  (void)(Detail::Succeeded<Ts>(
+             System_Query_GetComponent(query, Ts::kComponentId,
+                                       Detail::Bytes(components), sizeof(Ts)),
+             status) &&
+         ...);
+  return status;
+}
+
+// Sends updates of the components of the iterator's current entity. The
+// runtime copies them, and they become visible on the next tick.
+template <typename... Ts>
+inline Status Store(System_EntityIterator iterator, const Ts &...components) {
+  static_assert(CheckComponents<Ts...>());
+  Status status;
+  (void)(Detail::Succeeded<Ts>(
+             System_UpdateComponent(
+                 iterator, Ts::kComponentId,
+                 Detail::Bytes(const_cast<Ts &>(components)), sizeof(Ts)),
+             status) &&
+         ...);
+  return status;
+}
+
+// Describes the components for System_CreateEntity, writable by `layer`. The
+// descriptions point into `components`, which must outlive them.
+template <typename... Ts>
+inline std::array<System_ComponentInstanceType, sizeof...(Ts)>
+Instances(const char *layer, Ts &...components) {
+  static_assert(CheckComponents<Ts...>());
+  return {System_ComponentInstanceType{Ts::kComponentId,
+                                       Detail::Bytes(components), sizeof(Ts),
+                                       layer}...};
+}
+
+// Component constraints for each of the components, to combine with
+// System_Query_CompoundConstraint_CreateAnd into a query for entities with
+// all of them
+template <typename... Ts>
+inline std::array<System_Query_CompoundConstraint, sizeof...(Ts)>
+Constraints() {
+  static_assert(CheckComponents<Ts...>());
+  return {System_Query_CompoundConstraint_CreateSimple(
+      System_Query_Constraint_CreateComponent(Ts::kComponentId))...};
+}
+
+// A column for the bulk calls holding the field of T at byte `kOffset`, of
+// type Field, for consecutive entities at `data`
+template <typename T, std::size_t kOffset, typename Field>
+inline System_ComponentColumnType FieldColumn(Field *data) {
+  static_assert(CheckComponents<T>());
+  static_assert(std::is_trivially_copyable_v<Field>);
+  static_assert(kOffset + sizeof(Field) <= sizeof(T),
+                "Field lies outside the component");
+  auto *bytes = reinterpret_cast<uint8_t *>(
+      const_cast<std::remove_const_t<Field> *>(data));
+  return System_ComponentColumnType{T::kComponentId, sizeof(T),     kOffset,
+                                    sizeof(Field),   bytes, sizeof(Field)};
+}
+
+} // namespace Components
+
+#endif // COMPONENT_ACCESS_H
@@ -0,0 +1,586 @@
+#ifndef FLOCKING_KERNEL_H
+#define FLOCKING_KERNEL_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "boid_state.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define FLOCKING_HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define FLOCKING_HAVE_X86_KERNELS 0
+#endif
+
+namespace Flocking {
+
+struct Parameters {
+  // Neighbours further away than this are ignored
+  double vision_radius;
+  // Half-angle of the view cone around the boid's heading, in radians.
+  // Neighbours outside the cone are ignored.
+  double field_of_vision;
+  double separation_weight;
+  double alignment_weight;
+  double cohesion_weight;
+  double max_speed;
+};
+
+// The boid being steered
+struct Subject {
+  double x, y, z;
+  double vx, vy, vz;
+  // cos(field_of_vision) * |v|, so the view test needs no division
+  double view_threshold;
+};
+
+// A broadphase for the view test: whether a ball of candidates might hold
+// one the subject can see. It tests the ball's centre against the view cone
+// with its apex pushed back along the heading by radius / sin(half-angle),
+// which contains every point within the radius of the original cone, so it
+// never rejects a ball holding an accepted candidate. Only narrow cones, up
+// to a half-angle of 90 degrees, of moving subjects are culled; otherwise
+// every ball may hold one.
+class ViewCone {
+public:
+  ViewCone() = default;
+  ViewCone(const Subject &subject, double ball_radius, double cos_half_angle,
+           double sin_half_angle) {
+    const double speed = std::sqrt(subject.vx * subject.vx +
+                                   subject.vy * subject.vy +
+                                   subject.vz * subject.vz);
+    if (!(speed > 0 && cos_half_angle > 0 && sin_half_angle > 0)) {
+      return;
+    }
+    axis_[0] = subject.vx / speed;
+    axis_[1] = subject.vy / speed;
+    axis_[2] = subject.vz / speed;
+    // Slightly larger than the ball, so rounding in the centre and in the
+    // candidates' own view test cannot reject a candidate on the boundary
+    const double shift = ball_radius * (1 + 1e-6) / sin_half_angle;
+    apex_[0] = subject.x - shift * axis_[0];
+    apex_[1] = subject.y - shift * axis_[1];
+    apex_[2] = subject.z - shift * axis_[2];
+    cos_sq_ = cos_half_angle * cos_half_angle;
+    enabled_ = true;
+  }
+
+  bool enabled() const { return enabled_; }
+
+  // False only if no candidate within the ball radius of (x, y, z) is visible
+  bool MayHold(double x, double y, double z) const {
+    const double dx = x - apex_[0];
+    const double dy = y - apex_[1];
+    const double dz = z - apex_[2];
+    const double along = axis_[0] * dx + axis_[1] * dy + axis_[2] * dz;
+    return along >= 0 && along * along >= cos_sq_ * (dx * dx + dy * dy + dz * dz);
+  }
+
+private:
+  bool enabled_ = false;
+  double apex_[3] = {0, 0, 0};
+  double axis_[3] = {0, 0, 0};
+  double cos_sq_ = 0;
+};
+
+// Running sums over the neighbours a subject accepts
+struct SteeringSums {
+  // Sum of -d / |d|^2 over neighbour offsets d; pushes away from close boids
+  double separation[3] = {0, 0, 0};
+  double velocity[3] = {0, 0, 0};
+  double position[3] = {0, 0, 0};
+  double count = 0;
+};
+
+enum class InstructionSet { kScalar, kAvx2, kAvx512 };
+
+inline const char *ToString(InstructionSet instruction_set) {
+  switch (instruction_set) {
+  case InstructionSet::kAvx512:
+    return "AVX-512";
+  case InstructionSet::kAvx2:
+    return "AVX2";
+  case InstructionSet::kScalar:
+    break;
+  }
+  return "scalar";
+}
+
+// The widest instruction set both compiled in and supported by this CPU
+inline InstructionSet DetectInstructionSet() {
+#if FLOCKING_HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return InstructionSet::kAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return InstructionSet::kAvx2;
+  }
+#endif
+  return InstructionSet::kScalar;
+}
+
+// Candidates are either a contiguous range of rows or an explicit list of
+// them. The accumulate functions are written once against these two, which
+// tell them how to find and load the k-th candidate.
+
+// Candidate rows [begin, end)
+struct RowRange {
+  std::size_t begin;
+  std::size_t end;
+
+  std::size_t size() const { return end - begin; }
+  std::size_t row(std::size_t k) const { return begin + k; }
+};
+
+// Candidate rows rows[0], ..., rows[count - 1]
+struct RowList {
+  const std::uint32_t *rows;
+  std::size_t count;
+
+  std::size_t size() const { return count; }
+  std::size_t row(std::size_t k) const { return rows[k]; }
+};
+
+// Each accumulate function tests the candidate rows against the subject and
+// adds the accepted ones into `sums`. A candidate is accepted when it is
+// within the vision radius, is not at the subject's own position, and lies
+// inside the view cone.
+//
+// The SIMD variants evaluate the same expressions in the same precision as
+// the scalar reference, so they accept exactly the same neighbours; only the
+// order of the summation differs, which bounds the difference in the sums to
+// a few ULPs per accepted neighbour.
+//
+// That holds only while every product is rounded before it is added. GCC
+// fuses a multiply and an add into one FMA wherever the target has it, by
+// default even for intrinsics, and Clang does within an expression; a fused
+// distance rounds differently and moves neighbours across the vision radius
+// in one path and not another. Contraction is off for all of them.
+#if defined(__clang__)
+#pragma float_control(push)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+template <typename Rows>
+void AccumulateScalar(const Subject &subject,
+                      const Boids::BoidState &candidates, const Rows &rows,
+                      std::size_t first, double radius_sq,
+                      SteeringSums &sums) {
+  for (std::size_t k = first; k < rows.size(); ++k) {
+    const std::size_t j = rows.row(k);
+    const double dx = candidates.position_x[j] - subject.x;
+    const double dy = candidates.position_y[j] - subject.y;
+    const double dz = candidates.position_z[j] - subject.z;
+    const double distance_sq = (dx * dx + dy * dy) + dz * dz;
+    if (!(distance_sq <= radius_sq && distance_sq > 0)) {
+      continue;
+    }
+    const double dot = (subject.vx * dx + subject.vy * dy) + subject.vz * dz;
+    if (!(dot >= subject.view_threshold * std::sqrt(distance_sq))) {
+      continue;
+    }
+    const double inverse_distance_sq = 1.0 / distance_sq;
+    sums.separation[0] -= dx * inverse_distance_sq;
+    sums.separation[1] -= dy * inverse_distance_sq;
+    sums.separation[2] -= dz * inverse_distance_sq;
+    sums.velocity[0] += candidates.velocity_x[j];
+    sums.velocity[1] += candidates.velocity_y[j];
+    sums.velocity[2] += candidates.velocity_z[j];
+    sums.position[0] += candidates.position_x[j];
+    sums.position[1] += candidates.position_y[j];
+    sums.position[2] += candidates.position_z[j];
+    sums.count += 1;
+  }
+}
+
+template <typename Rows>
+void AccumulateScalar(const Subject &subject,
+                      const Boids::BoidState &candidates, const Rows &rows,
+                      double radius_sq, SteeringSums &sums) {
+  AccumulateScalar(subject, candidates, rows, 0, radius_sq, sums);
+}
+
+#if FLOCKING_HAVE_X86_KERNELS
+
+__attribute__((target("avx2"))) inline double
+HorizontalSum(__m256d value) {
+  const __m128d low = _mm256_castpd256_pd128(value);
+  const __m128d high = _mm256_extractf128_pd(value, 1);
+  const __m128d pair = _mm_add_pd(low, high);
+  return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+
+// Candidates k, ..., k + 3 of one column
+__attribute__((target("avx2"))) inline __m256d
+Load4(const double *column, const RowRange &rows, std::size_t k) {
+  return _mm256_loadu_pd(column + rows.begin + k);
+}
+
+__attribute__((target("avx2"))) inline __m256d
+Load4(const double *column, const RowList &rows, std::size_t k) {
+  const __m128i indices =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows.rows + k));
+  const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+  return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), column, indices, all,
+                                  8);
+}
+
+// Four candidates per iteration; the remainder goes through the scalar path
+template <typename Rows>
+__attribute__((target("avx2"))) void
+AccumulateAvx2(const Subject &subject, const Boids::BoidState &candidates,
+               const Rows &rows, double radius_sq, SteeringSums &sums) {
+  const __m256d x = _mm256_set1_pd(subject.x);
+  const __m256d y = _mm256_set1_pd(subject.y);
+  const __m256d z = _mm256_set1_pd(subject.z);
+  const __m256d vx = _mm256_set1_pd(subject.vx);
+  const __m256d vy = _mm256_set1_pd(subject.vy);
+  const __m256d vz = _mm256_set1_pd(subject.vz);
+  const __m256d view_threshold = _mm256_set1_pd(subject.view_threshold);
+  const __m256d radius_sq_v = _mm256_set1_pd(radius_sq);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+
+  __m256d separation_x = zero, separation_y = zero, separation_z = zero;
+  __m256d velocity_x = zero, velocity_y = zero, velocity_z = zero;
+  __m256d position_x = zero, position_y = zero, position_z = zero;
+  __m256d count = zero;
+
+  const std::size_t size = rows.size();
+  std::size_t k = 0;
+  for (; k + 4 <= size; k += 4) {
+    const __m256d px = Load4(candidates.position_x.data(), rows, k);
+    const __m256d py = Load4(candidates.position_y.data(), rows, k);
+    const __m256d pz = Load4(candidates.position_z.data(), rows, k);
+    const __m256d dx = _mm256_sub_pd(px, x);
+    const __m256d dy = _mm256_sub_pd(py, y);
+    const __m256d dz = _mm256_sub_pd(pz, z);
+    const __m256d distance_sq = _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+        _mm256_mul_pd(dz, dz));
+    const __m256d dot = _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(vx, dx), _mm256_mul_pd(vy, dy)),
+        _mm256_mul_pd(vz, dz));
+
+    __m256d mask = _mm256_and_pd(
+        _mm256_cmp_pd(distance_sq, radius_sq_v, _CMP_LE_OQ),
+        _mm256_cmp_pd(distance_sq, zero, _CMP_GT_OQ));
+    mask = _mm256_and_pd(
+        mask, _mm256_cmp_pd(dot,
+                            _mm256_mul_pd(view_threshold,
+                                          _mm256_sqrt_pd(distance_sq)),
+                            _CMP_GE_OQ));
+    if (_mm256_movemask_pd(mask) == 0) {
+      continue;
+    }
+
+    // Rejected lanes may hold inf or NaN here; the mask zeroes them
+    const __m256d inverse_distance_sq = _mm256_div_pd(one, distance_sq);
+    separation_x = _mm256_sub_pd(
+        separation_x,
+        _mm256_and_pd(mask, _mm256_mul_pd(dx, inverse_distance_sq)));
+    separation_y = _mm256_sub_pd(
+        separation_y,
+        _mm256_and_pd(mask, _mm256_mul_pd(dy, inverse_distance_sq)));
+    separation_z = _mm256_sub_pd(
+        separation_z,
+        _mm256_and_pd(mask, _mm256_mul_pd(dz, inverse_distance_sq)));
+    velocity_x = _mm256_add_pd(
+        velocity_x,
+        _mm256_and_pd(mask, Load4(candidates.velocity_x.data(), rows, k)));
+    velocity_y = _mm256_add_pd(
+        velocity_y,
+        _mm256_and_pd(mask, Load4(candidates.velocity_y.data(), rows, k)));
+    velocity_z = _mm256_add_pd(
+        velocity_z,
+        _mm256_and_pd(mask, Load4(candidates.velocity_z.data(), rows, k)));
+    position_x = _mm256_add_pd(position_x, _mm256_and_pd(mask, px));
+    position_y = _mm256_add_pd(position_y, _mm256_and_pd(mask, py));
+    position_z = _mm256_add_pd(position_z, _mm256_and_pd(mask, pz));
+    count = _mm256_add_pd(count, _mm256_and_pd(mask, one));
+  }
+
+  sums.separation[0] += HorizontalSum(separation_x);
+  sums.separation[1] += HorizontalSum(separation_y);
+  sums.separation[2] += HorizontalSum(separation_z);
+  sums.velocity[0] += HorizontalSum(velocity_x);
+  sums.velocity[1] += HorizontalSum(velocity_y);
+  sums.velocity[2] += HorizontalSum(velocity_z);
+  sums.position[0] += HorizontalSum(position_x);
+  sums.position[1] += HorizontalSum(position_y);
+  sums.position[2] += HorizontalSum(position_z);
+  sums.count += HorizontalSum(count);
+
+  AccumulateScalar(subject, candidates, rows, k, radius_sq, sums);
+}
+
+__attribute__((target("avx512f"))) inline double
+HorizontalSum(__m512d value) {
+  alignas(64) double lanes[8];
+  _mm512_store_pd(lanes, value);
+  return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+         ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+// The candidates k, ..., k + 7 of one column selected by `lanes`; the other
+// lanes are zero
+__attribute__((target("avx512f"))) inline __m512d
+Load8(const double *column, const RowRange &rows, std::size_t k,
+      __mmask8 lanes) {
+  return _mm512_maskz_loadu_pd(lanes, column + rows.begin + k);
+}
+
+__attribute__((target("avx512f"))) inline __m512d
+Load8(const double *column, const RowList &rows, std::size_t k,
+      __mmask8 lanes) {
+  // Load only the indices that exist; `lanes` never selects one past them
+  const int remaining =
+      static_cast<int>(std::min<std::size_t>(rows.count - k, 8));
+  const __m256i in_list = _mm256_cmpgt_epi32(
+      _mm256_set1_epi32(remaining), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  const __m256i indices = _mm256_maskload_epi32(
+      reinterpret_cast<const int *>(rows.rows + k), in_list);
+  return _mm512_mask_i32gather_pd(_mm512_setzero_pd(), lanes, indices, column,
+                                  8);
+}
+
+// Eight candidates per iteration; the remainder uses masked loads
+template <typename Rows>
+__attribute__((target("avx512f"))) void
+AccumulateAvx512(const Subject &subject, const Boids::BoidState &candidates,
+                 const Rows &rows, double radius_sq, SteeringSums &sums) {
+  const __m512d x = _mm512_set1_pd(subject.x);
+  const __m512d y = _mm512_set1_pd(subject.y);
+  const __m512d z = _mm512_set1_pd(subject.z);
+  const __m512d vx = _mm512_set1_pd(subject.vx);
+  const __m512d vy = _mm512_set1_pd(subject.vy);
+  const __m512d vz = _mm512_set1_pd(subject.vz);
+  const __m512d view_threshold = _mm512_set1_pd(subject.view_threshold);
+  const __m512d radius_sq_v = _mm512_set1_pd(radius_sq);
+  const __m512d zero = _mm512_setzero_pd();
+  const __m512d one = _mm512_set1_pd(1.0);
+
+  __m512d separation_x = zero, separation_y = zero, separation_z = zero;
+  __m512d velocity_x = zero, velocity_y = zero, velocity_z = zero;
+  __m512d position_x = zero, position_y = zero, position_z = zero;
+  __m512d count = zero;
+
+  const std::size_t size = rows.size();
+  for (std::size_t k = 0; k < size; k += 8) {
+    const std::size_t remaining = size - k;
+    const __mmask8 lanes =
+        remaining >= 8 ? __mmask8(0xFF)
+                       : static_cast<__mmask8>((1u << remaining) - 1);
+    const __m512d px = Load8(candidates.position_x.data(), rows, k, lanes);
+    const __m512d py = Load8(candidates.position_y.data(), rows, k, lanes);
+    const __m512d pz = Load8(candidates.position_z.data(), rows, k, lanes);
+    const __m512d dx = _mm512_sub_pd(px, x);
+    const __m512d dy = _mm512_sub_pd(py, y);
+    const __m512d dz = _mm512_sub_pd(pz, z);
+    const __m512d distance_sq = _mm512_add_pd(
+        _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)),
+        _mm512_mul_pd(dz, dz));
+    const __m512d dot = _mm512_add_pd(
+        _mm512_add_pd(_mm512_mul_pd(vx, dx), _mm512_mul_pd(vy, dy)),
+        _mm512_mul_pd(vz, dz));
+
+    __mmask8 mask =
+        _mm512_mask_cmp_pd_mask(lanes, distance_sq, radius_sq_v, _CMP_LE_OQ);
+    mask = _mm512_mask_cmp_pd_mask(mask, distance_sq, zero, _CMP_GT_OQ);
+    mask = _mm512_mask_cmp_pd_mask(
+        mask, dot,
+        _mm512_mul_pd(view_threshold, _mm512_maskz_sqrt_pd(mask, distance_sq)),
+        _CMP_GE_OQ);
+    if (mask == 0) {
+      continue;
+    }
+
+    const __m512d inverse_distance_sq = _mm512_div_pd(one, distance_sq);
+    separation_x = _mm512_mask_sub_pd(separation_x, mask, separation_x,
+                                      _mm512_mul_pd(dx, inverse_distance_sq));
+    separation_y = _mm512_mask_sub_pd(separation_y, mask, separation_y,
+                                      _mm512_mul_pd(dy, inverse_distance_sq));
+    separation_z = _mm512_mask_sub_pd(separation_z, mask, separation_z,
+                                      _mm512_mul_pd(dz, inverse_distance_sq));
+    velocity_x = _mm512_mask_add_pd(
+        velocity_x, mask, velocity_x,
+        Load8(candidates.velocity_x.data(), rows, k, mask));
+    velocity_y = _mm512_mask_add_pd(
+        velocity_y, mask, velocity_y,
+        Load8(candidates.velocity_y.data(), rows, k, mask));
+    velocity_z = _mm512_mask_add_pd(
+        velocity_z, mask, velocity_z,
+        Load8(candidates.velocity_z.data(), rows, k, mask));
+    position_x = _mm512_mask_add_pd(position_x, mask, position_x, px);
+    position_y = _mm512_mask_add_pd(position_y, mask, position_y, py);
+    position_z = _mm512_mask_add_pd(position_z, mask, position_z, pz);
+    count = _mm512_mask_add_pd(count, mask, count, one);
+  }
+
+  sums.separation[0] += HorizontalSum(separation_x);
+  sums.separation[1] += HorizontalSum(separation_y);
+  sums.separation[2] += HorizontalSum(separation_z);
+  sums.velocity[0] += HorizontalSum(velocity_x);
+  sums.velocity[1] += HorizontalSum(velocity_y);
+  sums.velocity[2] += HorizontalSum(velocity_z);
+  sums.position[0] += HorizontalSum(position_x);
+  sums.position[1] += HorizontalSum(position_y);
+  sums.position[2] += HorizontalSum(position_z);
+  sums.count += HorizontalSum(count);
+}
+
+#endif // FLOCKING_HAVE_X86_KERNELS
+
+#if defined(__clang__)
+#pragma float_control(pop)
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+// Separation, alignment and cohesion for one boid at a time, vectorised over
+// its candidate neighbours with the instruction set chosen at construction
+class Kernel {
+public:
+  Kernel(const Parameters &parameters, InstructionSet instruction_set)
+      : parameters_(parameters),
+        radius_sq_(parameters.vision_radius * parameters.vision_radius),
+        cos_field_of_vision_(std::cos(parameters.field_of_vision)),
+        sin_field_of_vision_(std::sin(parameters.field_of_vision)),
+        max_gain_(parameters.alignment_weight > 0
+                      ? 1.0 / parameters.alignment_weight
+                      : HUGE_VAL),
+        instruction_set_(instruction_set) {
+#if FLOCKING_HAVE_X86_KERNELS
+    if (instruction_set == InstructionSet::kAvx512) {
+      accumulate_range_ = AccumulateAvx512<RowRange>;
+      accumulate_list_ = AccumulateAvx512<RowList>;
+      return;
+    }
+    if (instruction_set == InstructionSet::kAvx2) {
+      accumulate_range_ = AccumulateAvx2<RowRange>;
+      accumulate_list_ = AccumulateAvx2<RowList>;
+      return;
+    }
+#endif
+    instruction_set_ = InstructionSet::kScalar;
+  }
+
+  const Parameters &parameters() const { return parameters_; }
+  InstructionSet instruction_set() const { return instruction_set_; }
+
+  Subject MakeSubject(const Boids::BoidState &boids, std::size_t row) const {
+    const double vx = boids.velocity_x[row];
+    const double vy = boids.velocity_y[row];
+    const double vz = boids.velocity_z[row];
+    return Subject{boids.position_x[row],
+                   boids.position_y[row],
+                   boids.position_z[row],
+                   vx,
+                   vy,
+                   vz,
+                   cos_field_of_vision_ * std::sqrt(vx * vx + vy * vy + vz * vz)};
+  }
+
+  // The subject's view cone, for skipping balls of `ball_radius` around
+  // candidates it cannot see
+  ViewCone MakeViewCone(const Subject &subject, double ball_radius) const {
+    return ViewCone(subject, ball_radius, cos_field_of_vision_,
+                    sin_field_of_vision_);
+  }
+
+  // Adds the accepted candidates among rows [begin, end) into `sums`
+  void Accumulate(const Subject &subject, const Boids::BoidState &candidates,
+                  std::size_t begin, std::size_t end,
+                  SteeringSums &sums) const {
+    accumulate_range_(subject, candidates, RowRange{begin, end}, radius_sq_,
+                      sums);
+  }
+
+  // Adds the accepted candidates among the `count` rows listed in `rows`
+  // into `sums`. Accepts exactly the neighbours Accumulate would.
+  void Accumulate(const Subject &subject, const Boids::BoidState &candidates,
+                  const std::uint32_t *rows, std::size_t count,
+                  SteeringSums &sums) const {
+    accumulate_list_(subject, candidates, RowList{rows, count}, radius_sq_,
+                     sums);
+  }
+
+  // Applies the combined steering to the boid in `row` and advances it by
+  // `dt` ticks. The boid's acceleration scales how hard it can steer and the
+  // resulting speed is capped at `max_speed`. Over a long step the steering
+  // gain is capped so that alignment moves the boid's velocity at most all
+  // the way to its neighbours' mean, rather than overshooting and
+  // oscillating about it; ordinary one-tick steps never reach the cap.
+  void Integrate(const SteeringSums &sums, Boids::BoidState &boids,
+                 std::size_t row, double dt) const {
+    double vx = boids.velocity_x[row];
+    double vy = boids.velocity_y[row];
+    double vz = boids.velocity_z[row];
+
+    if (sums.count > 0) {
+      const double inverse_count = 1.0 / sums.count;
+      const double gain = std::min(boids.acceleration[row] * dt, max_gain_);
+      const double steer_x =
+          parameters_.separation_weight * sums.separation[0] +
+          parameters_.alignment_weight * (sums.velocity[0] * inverse_count - vx) +
+          parameters_.cohesion_weight *
+              (sums.position[0] * inverse_count - boids.position_x[row]);
+      const double steer_y =
+          parameters_.separation_weight * sums.separation[1] +
+          parameters_.alignment_weight * (sums.velocity[1] * inverse_count - vy) +
+          parameters_.cohesion_weight *
+              (sums.position[1] * inverse_count - boids.position_y[row]);
+      const double steer_z =
+          parameters_.separation_weight * sums.separation[2] +
+          parameters_.alignment_weight * (sums.velocity[2] * inverse_count - vz) +
+          parameters_.cohesion_weight *
+              (sums.position[2] * inverse_count - boids.position_z[row]);
+      vx += gain * steer_x;
+      vy += gain * steer_y;
+      vz += gain * steer_z;
+    }
+
+    const double speed_sq = vx * vx + vy * vy + vz * vz;
+    const double max_speed_sq = parameters_.max_speed * parameters_.max_speed;
+    if (speed_sq > max_speed_sq) {
+      const double scale = parameters_.max_speed / std::sqrt(speed_sq);
+      vx *= scale;
+      vy *= scale;
+      vz *= scale;
+    }
+
+    boids.velocity_x[row] = vx;
+    boids.velocity_y[row] = vy;
+    boids.velocity_z[row] = vz;
+    boids.position_x[row] += vx * dt;
+    boids.position_y[row] += vy * dt;
+    boids.position_z[row] += vz * dt;
+  }
+
+private:
+  template <typename Rows>
+  using AccumulateFunction = void (*)(const Subject &,
+                                      const Boids::BoidState &, const Rows &,
+                                      double, SteeringSums &);
+
+  Parameters parameters_;
+  double radius_sq_;
+  double cos_field_of_vision_;
+  double sin_field_of_vision_;
+  // Largest steering gain one Integrate step applies
+  double max_gain_;
+  InstructionSet instruction_set_;
+  AccumulateFunction<RowRange> accumulate_range_ = AccumulateScalar<RowRange>;
+  AccumulateFunction<RowList> accumulate_list_ = AccumulateScalar<RowList>;
+};
+
+} // namespace Flocking
+
+#endif // FLOCKING_KERNEL_H
@@ -0,0 +1,123 @@
+#ifndef LOD_SCHEDULER_H
+#define LOD_SCHEDULER_H
+
+#include <improbable/standard_library.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "boid_state.h"
+#include "random.h"
+#include "thread_pool.h"
+
+// Level of detail for the flocking compute. Boids that matter little, being
+// isolated or far from every point of interest, only search for neighbours
+// and steer every few ticks; in between they are dead-reckoned, carrying on
+// at their current velocity. Their full ticks are staggered, so each tick
+// steers a similar share of them.
+namespace Lod {
+
+// Boids within `radius` of `centre` in the x-z plane, at any height, always
+// tick in full
+struct PointOfInterest {
+  Coordinates centre{};
+  double radius = 0;
+};
+
+struct Parameters {
+  // Low-importance boids tick in full once in this many ticks; 0 or 1 ticks
+  // every boid in full
+  std::uint32_t interval = 0;
+  // Boids that saw at most this many neighbours on their last full tick are
+  // low importance. An isolated boid does not steer, so dead reckoning it is
+  // exact until another boid comes into view.
+  std::uint32_t isolated_neighbours = 0;
+  // With any points, boids inside one are important and boids outside all
+  // of them are not, whatever their neighbours
+  std::vector<PointOfInterest> points_of_interest;
+};
+
+// Decides, tick by tick, which rows of the batch tick in full. Rows are
+// matched to the previous tick's by position, so whenever the rows may hold
+// other boids than before the counts are forgotten, and every boid ticks in
+// full once while they are relearnt. That happens on any change in the
+// number of rows, and on every Forget().
+class Scheduler {
+public:
+  explicit Scheduler(const Parameters &parameters) : parameters_(parameters) {}
+
+  bool enabled() const { return parameters_.interval > 1; }
+
+  // Forgets every row's neighbour count, for a batch whose rows were
+  // reassigned
+  void Forget() { neighbours_.clear(); }
+
+  // Plans tick number `tick` for `boids`; returns how many are dead-reckoned
+  std::size_t Plan(Threading::ThreadPool &pool, const Boids::BoidState &boids,
+                   std::uint64_t tick, std::size_t grain) {
+    const auto count = boids.size();
+    if (neighbours_.size() != count) {
+      neighbours_.assign(count, kUnknown);
+    }
+    full_.resize(count);
+    const auto interval = parameters_.interval;
+    const auto &points = parameters_.points_of_interest;
+    std::atomic<std::size_t> reduced{0};
+    pool.ParallelFor(count, grain, [&](std::size_t begin, std::size_t end) {
+      std::size_t chunk_reduced = 0;
+      for (std::size_t i = begin; i < end; ++i) {
+        const bool known = neighbours_[i] != kUnknown;
+        bool important =
+            !known || neighbours_[i] > parameters_.isolated_neighbours;
+        // Inside a point of interest even an isolated boid ticks in full;
+        // outside all of them even a crowded one does not
+        if (!points.empty()) {
+          important = !known || Inside(points, boids.position_x[i],
+                                       boids.position_z[i]);
+        }
+        // Each row's full ticks fall on its own phase of the interval
+        const bool full =
+            important || (tick + Random::Mix(i)) % interval == 0;
+        full_[i] = full;
+        chunk_reduced += full ? 0 : 1;
+      }
+      reduced.fetch_add(chunk_reduced, std::memory_order_relaxed);
+    });
+    return reduced.load(std::memory_order_relaxed);
+  }
+
+  // Whether `row` ticks in full under the last plan
+  bool Full(std::size_t row) const { return full_[row] != 0; }
+
+  // Records the neighbours `row` saw on a full tick
+  void RecordNeighbours(std::size_t row, std::uint32_t neighbours) {
+    neighbours_[row] = neighbours;
+  }
+
+private:
+  static constexpr std::uint32_t kUnknown = UINT32_MAX;
+
+  static bool Inside(const std::vector<PointOfInterest> &points, double x,
+                     double z) {
+    for (const auto &point : points) {
+      const double dx = x - point.centre.x;
+      const double dz = z - point.centre.z;
+      if (dx * dx + dz * dz <= point.radius * point.radius) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  Parameters parameters_;
+  // Per row: whether it ticks in full, and its neighbours at its last full
+  // tick
+  std::vector<std::uint8_t> full_;
+  std::vector<std::uint32_t> neighbours_;
+};
+
+} // namespace Lod
+
+#endif // LOD_SCHEDULER_H
@@ -0,0 +1,251 @@
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <improbable/system/c_system.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// Messages below this level are compiled out of MOVEMENT_LOG and
+// MOVEMENT_LOG_EVERY entirely, arguments included. Build with, for example,
+// -DMOVEMENT_LOG_MIN_LEVEL=LOG_LEVEL_INFO to strip trace and debug logging.
+#ifndef MOVEMENT_LOG_MIN_LEVEL
+#define MOVEMENT_LOG_MIN_LEVEL LOG_LEVEL_TRACE
+#endif
+
+namespace Logging {
+
+// Buffers log messages so that logging never calls into the runtime from the
+// code that produces them. Any thread may log: messages are formatted into
+// fixed-size slots of a lock-free ring buffer, and the tick thread sends them
+// all to the runtime in one batch with `Flush()`.
+//
+// Nothing allocates. A message longer than a slot is truncated, and a message
+// logged while the ring is full is dropped; both are counted and reported by
+// the next flush.
+class Logger {
+public:
+  static constexpr std::size_t kSlotCount = 1024;
+  static constexpr std::size_t kMaxMessageLength = 240;
+
+  explicit Logger(System_LogLevel level = LOG_LEVEL_INFO) : level_(level) {
+    for (std::size_t i = 0; i < kSlotCount; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  Logger(const Logger &) = delete;
+  Logger &operator=(const Logger &) = delete;
+
+  // The run-time filter: messages below `level` are discarded before they are
+  // formatted
+  void set_level(System_LogLevel level) {
+    level_.store(level, std::memory_order_relaxed);
+  }
+  System_LogLevel level() const {
+    return level_.load(std::memory_order_relaxed);
+  }
+  bool Enabled(System_LogLevel level) const { return level >= this->level(); }
+
+  // Formats a message and queues it. Returns false if it was dropped because
+  // the ring was full.
+  __attribute__((format(printf, 4, 5))) bool
+  Log(System_LogLevel level, std::uint64_t suppressed, const char *format,
+      ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    const bool queued = Push(level, suppressed, format, arguments);
+    va_end(arguments);
+    return queued;
+  }
+
+  // Sends every queued message to the runtime, oldest first. Must be called
+  // from the thread that runs the tick, as the System API requires. Returns
+  // the number of messages sent.
+  std::size_t Flush(System_Handle system_handle) {
+    std::size_t sent = 0;
+    for (;;) {
+      std::size_t position = read_position_.load(std::memory_order_relaxed);
+      Slot &slot = slots_[position % kSlotCount];
+      if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+        break;
+      }
+      read_position_.store(position + 1, std::memory_order_relaxed);
+      Send(system_handle, slot.level, slot.text);
+      slot.sequence.store(position + kSlotCount, std::memory_order_release);
+      ++sent;
+    }
+
+    if (const auto dropped = dropped_.exchange(0, std::memory_order_relaxed)) {
+      char text[kMaxMessageLength];
+      std::snprintf(text, sizeof(text),
+                    "Dropped %llu log messages: the log buffer was full",
+                    static_cast<unsigned long long>(dropped));
+      Send(system_handle, LOG_LEVEL_WARN, text);
+      ++sent;
+    }
+    return sent;
+  }
+
+  // Messages the runtime rejected, which were written to stderr instead
+  std::uint64_t failed_count() const {
+    return failed_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct alignas(64) Slot {
+    // Equal to the slot's write position when it is free, and one past it
+    // once the message is ready to read
+    std::atomic<std::size_t> sequence;
+    System_LogLevel level;
+    char text[kMaxMessageLength];
+  };
+
+  bool Push(System_LogLevel level, std::uint64_t suppressed,
+            const char *format, va_list arguments) {
+    // Claim a slot (a bounded multi-producer queue; see Vyukov)
+    Slot *slot = nullptr;
+    std::size_t position = write_position_.load(std::memory_order_relaxed);
+    for (;;) {
+      slot = &slots_[position % kSlotCount];
+      const auto sequence = slot->sequence.load(std::memory_order_acquire);
+      const auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+      if (difference == 0) {
+        if (write_position_.compare_exchange_weak(position, position + 1,
+                                                  std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      } else {
+        position = write_position_.load(std::memory_order_relaxed);
+      }
+    }
+
+    slot->level = level;
+    int length = std::vsnprintf(slot->text, kMaxMessageLength, format,
+                                arguments);
+    if (length >= 0 && suppressed > 0 &&
+        static_cast<std::size_t>(length) < kMaxMessageLength) {
+      std::snprintf(slot->text + length, kMaxMessageLength - length,
+                    " (%llu similar messages suppressed)",
+                    static_cast<unsigned long long>(suppressed));
+    }
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  void Send(System_Handle system_handle, System_LogLevel level,
+            const char *text) {
+    auto message = System_LogMessageInfo{level, text};
+    if (auto rc = System_SendLogMessage(system_handle, &message);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      // A lost log line is not worth stopping the simulation for
+      failed_.fetch_add(1, std::memory_order_relaxed);
+      std::cerr << "System failed to send log message \"" << text
+                << "\" (received status code: " << rc << ")" << std::endl;
+    }
+  }
+
+  std::atomic<System_LogLevel> level_;
+  alignas(64) std::atomic<std::size_t> write_position_{0};
+  alignas(64) std::atomic<std::size_t> read_position_{0};
+  std::atomic<std::uint64_t> dropped_{0};
+  std::atomic<std::uint64_t> failed_{0};
+  Slot slots_[kSlotCount];
+};
+
+// Lets through at most one message per `interval` and counts the rest, so a
+// message logged every tick or every boid cannot flood the console
+class RateLimiter {
+public:
+  explicit RateLimiter(std::chrono::steady_clock::duration interval)
+      : interval_(interval.count()) {}
+
+  // Returns true if a message may be logged now, and sets `suppressed` to the
+  // number of messages held back since the last one that was
+  bool Allow(std::uint64_t *suppressed) {
+    const auto now =
+        std::chrono::steady_clock::now().time_since_epoch().count();
+    auto next = next_allowed_.load(std::memory_order_relaxed);
+    if (now < next || !next_allowed_.compare_exchange_strong(
+                          next, now + interval_, std::memory_order_relaxed)) {
+      suppressed_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    *suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+
+private:
+  const std::chrono::steady_clock::rep interval_;
+  std::atomic<std::chrono::steady_clock::rep> next_allowed_{0};
+  std::atomic<std::uint64_t> suppressed_{0};
+};
+
+// Parses a level name such as "LOG_LEVEL_DEBUG", as used in the simulation
+// configuration. Returns false if the name is not a level.
+inline bool ParseLogLevel(const char *name, System_LogLevel *level) {
+  static const struct {
+    const char *name;
+    System_LogLevel level;
+  } kLevels[] = {{"LOG_LEVEL_TRACE", LOG_LEVEL_TRACE},
+                 {"LOG_LEVEL_DEBUG", LOG_LEVEL_DEBUG},
+                 {"LOG_LEVEL_INFO", LOG_LEVEL_INFO},
+                 {"LOG_LEVEL_WARN", LOG_LEVEL_WARN},
+                 {"LOG_LEVEL_ERROR", LOG_LEVEL_ERROR},
+                 {"LOG_LEVEL_ALWAYS", LOG_LEVEL_ALWAYS}};
+  for (const auto &entry : kLevels) {
+    if (std::strcmp(name, entry.name) == 0) {
+      *level = entry.level;
+      return true;
+    }
+  }
+  return false;
+}
+
+// The logger the movement system and its harnesses share
+inline Logger &DefaultLogger() {
+  static Logger logger;
+  return logger;
+}
+
+} // namespace Logging
+
+// Queues a printf-style message on the default logger if `level` passes both
+// the compile-time and the run-time filter
+#define MOVEMENT_LOG(level, ...)                                               \
+  do {                                                                         \
+    if constexpr ((level) >= (MOVEMENT_LOG_MIN_LEVEL)) {                       \
+      auto &movement_log_logger_ = ::Logging::DefaultLogger();                 \
+      if (movement_log_logger_.Enabled(level)) {                               \
+        movement_log_logger_.Log(level, 0, __VA_ARGS__);                       \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+// As MOVEMENT_LOG, but this call site logs at most once per `interval` (a
+// std::chrono duration); the next message that gets through reports how many
+// were suppressed
+#define MOVEMENT_LOG_EVERY(level, interval, ...)                               \
+  do {                                                                         \
+    if constexpr ((level) >= (MOVEMENT_LOG_MIN_LEVEL)) {                       \
+      auto &movement_log_logger_ = ::Logging::DefaultLogger();                 \
+      static ::Logging::RateLimiter movement_log_limiter_{interval};           \
+      std::uint64_t movement_log_suppressed_ = 0;                              \
+      if (movement_log_logger_.Enabled(level) &&                               \
+          movement_log_limiter_.Allow(&movement_log_suppressed_)) {            \
+        movement_log_logger_.Log(level, movement_log_suppressed_,              \
+                                 __VA_ARGS__);                                 \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+#endif // LOGGING_H
@@ -4,248 +4,326 @@
 #include <improbable/system/c_system_error.h>
 #include <myschema.h>
 
-#include <array>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
-
 #include <random>
+#include <string>
+#include <thread>
 
-static constexpr double random_lower_bound = 0.1;
-static constexpr double random_upper_bound = 0.2;
-static constexpr double vision_radius = 1;
-static constexpr double field_of_vision = 1;
+#include "movement_system.h"
 
 namespace {
 
 constexpr auto kEntityCount = 10;
-const auto sideLength = static_cast<int>(sqrt(kEntityCount));
 
 using RAIISystemHandle =
     std::unique_ptr<System_Handle_Data, decltype(&System_Destroy)>;
 
-// A simple error-handling wrapper around the C API for sending log messages
-void SendLogMessage(System_Handle system_handle, System_LogLevel level,
-                    const std::string &log_message) {
-  auto message = System_LogMessageInfo{level, log_message.c_str()};
-  if (auto rc = System_SendLogMessage(system_handle, &message);
-      rc != SYSTEM_STATUS_CODE_SUCCESS) {
-    std::cerr << "System failed to send log message \"" << log_message.c_str()
-              << "\" (received status code: " << rc << ")" << std::endl;
-    exit(1);
-  }
-}
+using Movement::MovementSystem;
 
-// A simple function that populates the simulation with entities
-void CreateEntities(System_Handle system_handle) {
-  std::random_device rd;
-  std::mt19937 rng(rd());
-  std::uniform_int_distribution<> dist(random_lower_bound, random_upper_bound);
-  double random_velocity_val = static_cast<double>(dist(rng));
-
-  for (int i = 0; i < kEntityCount; ++i) {
-    int row = i / sideLength;
-    int col = i % sideLength;
-
-    auto position = Position{
-        Coordinates{static_cast<double>(row), 0, static_cast<double>(col)}};
-    auto velocity = Velocity{random_velocity_val, 0, random_velocity_val};
-    auto acceleration = Acceleration{0.1};
-
-    auto position_component_instance = System_ComponentInstanceType{
-        Position::kComponentId, reinterpret_cast<uint8_t *>(&position),
-        sizeof(position), "movement_layer"};
-
-    auto velocity_component_instance = System_ComponentInstanceType{
-        Velocity::kComponentId, reinterpret_cast<uint8_t *>(&velocity),
-        sizeof(velocity), "movement_layer"};
-
-    auto acceleration_component_instance = System_ComponentInstanceType{
-        Acceleration::kComponentId, reinterpret_cast<uint8_t *>(&acceleration),
-        sizeof(acceleration), "movement_layer"};
-
-    std::array<System_ComponentInstanceType, 3> components = {
-        position_component_instance, velocity_component_instance,
-        acceleration_component_instance};
-    if (auto rc = System_CreateEntity(system_handle, components.data(),
-                                      components.size());
-        rc != SYSTEM_STATUS_CODE_SUCCESS) {
-      std::cerr << "System failed to create entity (received status code: "
-                << rc << ")" << std::endl;
-      exit(1);
-    }
-  }
+Movement::Configuration DefaultConfiguration() {
+  Movement::Configuration configuration;
+  configuration.thread_count =
+      std::max(1u, std::thread::hardware_concurrency());
+  return configuration;
 }
 
-// The callback that fires every system tick
-System_StatusCode TickCallback(System_Handle system_handle,
-                               System_EntityIterator entity_iterator,
-                               void *user_context, uint32_t ticks_fired) {
-
-  SendLogMessage(system_handle, LOG_LEVEL_INFO, "My movement system ticking");
-  // Create objects to store corresponding components of the current entity
-  auto position = std::make_unique<Position>();
-  auto velocity = std::make_unique<Velocity>();
-  auto acceleration = std::make_unique<Acceleration>();
-
-  // Iterate over the entity iterator
-  while (!System_IterationFinished(entity_iterator)) {
-    // Get the current entity's position component
-    if (auto rc = System_GetComponent(
-            entity_iterator, Position::kComponentId,
-            reinterpret_cast<uint8_t *>(position.get()), sizeof(*position));
-        rc != SYSTEM_STATUS_CODE_SUCCESS) {
-      SendLogMessage(system_handle, LOG_LEVEL_ERROR,
-                     "Failed to get current entity position");
-      return SYSTEM_STATUS_CODE_ABORT;
-    }
-
-    // Get the current entity's velocity component
-    if (auto rc = System_GetComponent(
-            entity_iterator, Velocity::kComponentId,
-            reinterpret_cast<uint8_t *>(velocity.get()), sizeof(*velocity));
-        rc != SYSTEM_STATUS_CODE_SUCCESS) {
-      SendLogMessage(system_handle, LOG_LEVEL_ERROR,
-                     "Failed to get current entity velocity");
-      return SYSTEM_STATUS_CODE_ABORT;
-    }
-
-    // Get the current entity's acceleration component
-    if (auto rc = System_GetComponent(
-            entity_iterator, Acceleration::kComponentId,
-            reinterpret_cast<uint8_t *>(acceleration.get()), sizeof(*acceleration));
-        rc != SYSTEM_STATUS_CODE_SUCCESS) {
-      SendLogMessage(system_handle, LOG_LEVEL_ERROR,
-                     "Failed to get current entity acceleration");
-      return SYSTEM_STATUS_CODE_ABORT;
-    }
+Spawn::Parameters DefaultSpawnParameters() {
+  Spawn::Parameters parameters;
+  parameters.entity_count = kEntityCount;
+  parameters.seed = std::random_device{}();
+  return parameters;
+}
 
-    // Update the position component with a fixed velocity. While we hope that
-    // `ticks_fired` is 1, the system may miss ticks when running in real-time
-    // mode. We multiply the velocity by this value to compensate for missed
-    // ticks.
-    // position->coords.z += velocity->value * ticks_fired;
-
-    // direction based on rules
-    // get entities within range of current position
-    // steer away from other boids
-    // steer to move in same direction as nearby boids
-    // steer towards center of nearby boids
-    System_Double3 position_sd3{position->coords.x, position->coords.y,
-                                position->coords.z};
-    auto absolute_sphere_constraint =
-        System_Query_Constraint_CreateAbsoluteSphere(position_sd3,
-                                                     vision_radius);
-    auto query_handle = std::unique_ptr<System_Query_Handle_Data,
-                                        decltype(&System_Query_Destroy)>{
-        System_Query_Create(&absolute_sphere_constraint), System_Query_Destroy};
-
-    if (!query_handle) {
-      SendLogMessage(system_handle, LOG_LEVEL_ERROR,
-                     "Failed to create absolute sphere query result");
-      return SYSTEM_STATUS_CODE_ERROR;
-    }
+// Command line options, given as `--name=value`
+struct Options {
+  Movement::Configuration system = DefaultConfiguration();
+  // Messages below this level are discarded; matches the simulation
+  // configuration's default_log_level
+  System_LogLevel log_level = LOG_LEVEL_INFO;
+  // How the boids are placed at the start of the run
+  Spawn::Parameters spawn = DefaultSpawnParameters();
+  // Where to write the profiled ticks as a Chrome trace once the run ends;
+  // empty writes nothing
+  std::string trace_output;
+};
+
+void PrintUsage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--threads=<count>] [--log-level=LOG_LEVEL_<level>]"
+               " [--entities=<count>]"
+               " [--layout=grid|uniform|clustered|poisson]"
+               " [--world-bounds=<x>,<z>] [--seed=<seed>] [--deterministic]"
+               " [--cache-owned-state] [--delta-updates]"
+               " [--delta-epsilon=<distance>] [--delta-quantum=<step>]"
+               " [--lod-interval=<ticks>] [--lod-isolated=<neighbours>]"
+               " [--lod-interest=<x>,<z>,<radius> ...]"
+               " [--hash-interval=<ticks>] [--verlet-skin=<distance>]"
+               " [--spatial-index=grid|tree] [--tree-rebuild=<ticks>]"
+               " [--max-substeps=<count>] [--catch-up=fixed|adaptive]"
+               " [--catch-up-budget-ms=<milliseconds>]"
+               " [--profile-ticks=<count>] [--profile-summary=<ticks>]"
+               " [--trace-output=<trace.json>]"
+               " [--metrics-output=<metrics.prom>]"
+               " [--metrics-interval=<seconds>]"
+            << std::endl;
+}
 
-    while (!System_Query_IterationFinished(query_handle.get())) {
-
-      // Get neighbour boid's position component
-      auto neighbour_position = std::make_unique<Position>();
-      if (auto rc = System_Query_GetComponent(
-              query_handle.get(), Position::kComponentId,
-              reinterpret_cast<uint8_t *>(neighbour_position.get()),
-              sizeof(*neighbour_position));
-          rc != SYSTEM_STATUS_CODE_SUCCESS) {
-        SendLogMessage(system_handle, LOG_LEVEL_ERROR,
-                       "Failed to get neighbour boid's position");
-        return SYSTEM_STATUS_CODE_ABORT;
-      }
-
-      // Get neighbour boid's direction component
-      auto neighbour_acceleration = std::make_unique<Acceleration>();
-      if (auto rc = System_Query_GetComponent(
-              query_handle.get(), Acceleration::kComponentId,
-              reinterpret_cast<uint8_t *>(neighbour_acceleration.get()),
-              sizeof(*neighbour_acceleration));
-          rc != SYSTEM_STATUS_CODE_SUCCESS) {
-        SendLogMessage(system_handle, LOG_LEVEL_ERROR,
-                       "Failed to get neighbour boid's acceleration");
-        return SYSTEM_STATUS_CODE_ABORT;
-      }
-
-      // steer away from other boids
-      // steer to move in same direction as nearby boids
-      // steer towards center of nearby boids
-      if (auto rc = System_Query_NextEntity(query_handle.get());
-          rc != SYSTEM_STATUS_CODE_SUCCESS) {
-        SendLogMessage(system_handle, LOG_LEVEL_ERROR,
-                       "Failed to increment query handle");
-        return SYSTEM_STATUS_CODE_ABORT;
+Options ParseOptions(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const char *argument = argv[i];
+    if (std::strncmp(argument, "--threads=", 10) == 0) {
+      const long thread_count = std::strtol(argument + 10, nullptr, 10);
+      if (thread_count < 1) {
+        std::cerr << "Thread count must be at least 1: " << argument
+                  << std::endl;
+        exit(1);
       }
-    }
-
-    // Send updated position to Lattice
-    if (auto rc = System_UpdateComponent(
-            entity_iterator, Position::kComponentId,
-            reinterpret_cast<uint8_t *>(position.get()), sizeof(Position));
-        rc != SYSTEM_STATUS_CODE_SUCCESS) {
-      SendLogMessage(system_handle, LOG_LEVEL_ERROR,
-                     "Failed to update current entity position");
-      return SYSTEM_STATUS_CODE_ABORT;
-    }
-    
-    // Send updated velocity to Lattice
-    if (auto rc = System_UpdateComponent(
-            entity_iterator, Velocity::kComponentId,
-            reinterpret_cast<uint8_t *>(velocity.get()), sizeof(Velocity));
-        rc != SYSTEM_STATUS_CODE_SUCCESS) {
-      SendLogMessage(system_handle, LOG_LEVEL_ERROR,
-                     "Failed to update current entity velocity");
-      return SYSTEM_STATUS_CODE_ABORT;
-    }
-
-    // // Send updated direction to Lattice
-    // if (auto rc = System_UpdateComponent(
-    //         entity_iterator, Direction::kComponentId,
-    //         reinterpret_cast<uint8_t *>(direction.get()), sizeof(Direction));
-    //     rc != SYSTEM_STATUS_CODE_SUCCESS) {
-    //   SendLogMessage(system_handle, LOG_LEVEL_ERROR,
-    //                  "Failed to update current entity position");
-    //   return SYSTEM_STATUS_CODE_ABORT;
-    // }
-
-    // Advance the entity iterator
-    if (auto rc = System_NextEntity(entity_iterator);
-        rc != SYSTEM_STATUS_CODE_SUCCESS) {
-      SendLogMessage(system_handle, LOG_LEVEL_ERROR,
-                     "Failed to advance the entity iterator");
-      return SYSTEM_STATUS_CODE_ABORT;
+      options.system.thread_count = static_cast<std::size_t>(thread_count);
+    } else if (std::strncmp(argument, "--log-level=", 12) == 0) {
+      if (!Logging::ParseLogLevel(argument + 12, &options.log_level)) {
+        std::cerr << "Unknown log level: " << argument << std::endl;
+        exit(1);
+      }
+    } else if (std::strncmp(argument, "--entities=", 11) == 0) {
+      const long entity_count = std::strtol(argument + 11, nullptr, 10);
+      if (entity_count < 0) {
+        std::cerr << "Entity count must not be negative: " << argument
+                  << std::endl;
+        exit(1);
+      }
+      options.spawn.entity_count = static_cast<std::size_t>(entity_count);
+    } else if (std::strncmp(argument, "--layout=", 9) == 0) {
+      if (!Spawn::ParseLayout(argument + 9, &options.spawn.layout)) {
+        std::cerr << "Unknown spawn layout: " << argument << std::endl;
+        exit(1);
+      }
+    } else if (std::strncmp(argument, "--world-bounds=", 15) == 0) {
+      auto &bounds = options.spawn.world_bounds;
+      if (std::sscanf(argument + 15, "%lf,%lf", &bounds.x, &bounds.z) != 2 ||
+          bounds.x <= 0 || bounds.z <= 0) {
+        std::cerr << "World bounds must be two positive extents: " << argument
+                  << std::endl;
+        exit(1);
+      }
+    } else if (std::strncmp(argument, "--seed=", 7) == 0) {
+      char *end = nullptr;
+      options.spawn.seed = std::strtoull(argument + 7, &end, 0);
+      if (end == argument + 7 || *end) {
+        std::cerr << "Seed must be an unsigned integer: " << argument
+                  << std::endl;
+        exit(1);
+      }
+    } else if (std::strcmp(argument, "--deterministic") == 0) {
+      options.system.deterministic = true;
+    } else if (std::strcmp(argument, "--cache-owned-state") == 0) {
+      options.system.cache_owned_state = true;
+    } else if (std::strncmp(argument, "--lod-interval=", 15) == 0) {
+      const long interval = std::strtol(argument + 15, nullptr, 10);
+      if (interval < 0) {
+        std::cerr << "Level of detail interval must not be negative: "
+                  << argument << std::endl;
+        exit(1);
+      }
+      options.system.lod.interval = static_cast<uint32_t>(interval);
+    } else if (std::strncmp(argument, "--lod-isolated=", 15) == 0) {
+      const long neighbours = std::strtol(argument + 15, nullptr, 10);
+      if (neighbours < 0) {
+        std::cerr << "Isolated neighbour count must not be negative: "
+                  << argument << std::endl;
+        exit(1);
+      }
+      options.system.lod.isolated_neighbours =
+          static_cast<uint32_t>(neighbours);
+    } else if (std::strncmp(argument, "--lod-interest=", 15) == 0) {
+      Lod::PointOfInterest point{};
+      if (std::sscanf(argument + 15, "%lf,%lf,%lf", &point.centre.x,
+                      &point.centre.z, &point.radius) != 3 ||
+          !(point.radius > 0)) {
+        std::cerr << "Point of interest must be an x, a z and a positive "
+                     "radius: "
+                  << argument << std::endl;
+        exit(1);
+      }
+      options.system.lod.points_of_interest.push_back(point);
+    } else if (std::strcmp(argument, "--delta-updates") == 0) {
+      options.system.delta_updates = true;
+    } else if (std::strncmp(argument, "--delta-epsilon=", 16) == 0) {
+      char *end = nullptr;
+      const double epsilon = std::strtod(argument + 16, &end);
+      if (end == argument + 16 || *end || !(epsilon >= 0)) {
+        std::cerr << "Delta epsilon must not be negative: " << argument
+                  << std::endl;
+        exit(1);
+      }
+      options.system.delta_filter.epsilon = epsilon;
+    } else if (std::strncmp(argument, "--delta-quantum=", 16) == 0) {
+      char *end = nullptr;
+      const double quantum = std::strtod(argument + 16, &end);
+      if (end == argument + 16 || *end || !(quantum >= 0)) {
+        std::cerr << "Delta quantum must not be negative: " << argument
+                  << std::endl;
+        exit(1);
+      }
+      options.system.delta_filter.quantum = quantum;
+    } else if (std::strncmp(argument, "--hash-interval=", 16) == 0) {
+      const long hash_interval = std::strtol(argument + 16, nullptr, 10);
+      if (hash_interval < 0) {
+        std::cerr << "Hash interval must not be negative: " << argument
+                  << std::endl;
+        exit(1);
+      }
+      options.system.hash_interval = static_cast<uint32_t>(hash_interval);
+    } else if (std::strncmp(argument, "--verlet-skin=", 14) == 0) {
+      char *end = nullptr;
+      const double skin = std::strtod(argument + 14, &end);
+      if (end == argument + 14 || *end || !(skin >= 0)) {
+        std::cerr << "Verlet skin must be a non-negative distance: "
+                  << argument << std::endl;
+        exit(1);
+      }
+      options.system.verlet_skin = skin;
+    } else if (std::strncmp(argument, "--spatial-index=", 16) == 0) {
+      if (!Movement::ParseSpatialIndex(argument + 16,
+                                       &options.system.spatial_index)) {
+        std::cerr << "Unknown spatial index: " << argument << std::endl;
+        exit(1);
+      }
+    } else if (std::strncmp(argument, "--tree-rebuild=", 15) == 0) {
+      const long interval = std::strtol(argument + 15, nullptr, 10);
+      if (interval < 0) {
+        std::cerr << "Tree rebuild interval must not be negative: "
+                  << argument << std::endl;
+        exit(1);
+      }
+      options.system.tree_rebuild_interval = static_cast<uint32_t>(interval);
+    } else if (std::strncmp(argument, "--max-substeps=", 15) == 0) {
+      const long max_substeps = std::strtol(argument + 15, nullptr, 10);
+      if (max_substeps < 1) {
+        std::cerr << "Sub-step cap must be at least 1: " << argument
+                  << std::endl;
+        exit(1);
+      }
+      options.system.max_substeps = static_cast<uint32_t>(max_substeps);
+    } else if (std::strncmp(argument, "--catch-up=", 11) == 0) {
+      if (!Movement::ParseCatchUpMode(argument + 11,
+                                      &options.system.catch_up_mode)) {
+        std::cerr << "Unknown catch-up mode: " << argument << std::endl;
+        exit(1);
+      }
+    } else if (std::strncmp(argument, "--catch-up-budget-ms=", 21) == 0) {
+      char *end = nullptr;
+      const double budget = std::strtod(argument + 21, &end);
+      if (end == argument + 21 || *end || !(budget > 0)) {
+        std::cerr << "Catch-up budget must be a positive duration: "
+                  << argument << std::endl;
+        exit(1);
+      }
+      options.system.catch_up_budget_ms = budget;
+    } else if (std::strncmp(argument, "--profile-ticks=", 16) == 0) {
+      const long ticks = std::strtol(argument + 16, nullptr, 10);
+      if (ticks < 0) {
+        std::cerr << "Profiled tick count must not be negative: " << argument
+                  << std::endl;
+        exit(1);
+      }
+      options.system.profile_ticks = static_cast<uint32_t>(ticks);
+    } else if (std::strncmp(argument, "--profile-summary=", 18) == 0) {
+      const long interval = std::strtol(argument + 18, nullptr, 10);
+      if (interval < 0) {
+        std::cerr << "Profile summary interval must not be negative: "
+                  << argument << std::endl;
+        exit(1);
+      }
+      options.system.profile_summary_interval =
+          static_cast<uint32_t>(interval);
+    } else if (std::strncmp(argument, "--trace-output=", 15) == 0) {
+      options.trace_output = argument + 15;
+    } else if (std::strncmp(argument, "--metrics-output=", 17) == 0) {
+      options.system.metrics_path = argument + 17;
+    } else if (std::strncmp(argument, "--metrics-interval=", 19) == 0) {
+      char *end = nullptr;
+      const double interval = std::strtod(argument + 19, &end);
+      if (end == argument + 19 || *end || !(interval >= 0)) {
+        std::cerr << "Metrics interval must not be negative: " << argument
+                  << std::endl;
+        exit(1);
+      }
+      options.system.metrics_interval_seconds = interval;
+    } else {
+      std::cerr << "Unknown argument: " << argument << std::endl;
+      PrintUsage(argv[0]);
+      exit(1);
     }
   }
-
-  return SYSTEM_STATUS_CODE_SUCCESS;
+  return options;
 }
 
 } // namespace
 
-int main() {
+int main(int argc, char **argv) {
+  const auto options = ParseOptions(argc, argv);
+  auto &logger = Logging::DefaultLogger();
+  logger.set_level(options.log_level);
+
   // Create system handle
   RAIISystemHandle system_handle{System_Init(), System_Destroy};
-  SendLogMessage(system_handle.get(), LOG_LEVEL_INFO,
-                 "My movement system started");
+  MOVEMENT_LOG(LOG_LEVEL_INFO, "My movement system started");
+
+  // Create the worker pool and per-run state before the first tick
+  MovementSystem movement_system{options.system};
+  MOVEMENT_LOG(LOG_LEVEL_INFO,
+               "My movement system using %zu threads and the %s flocking "
+               "kernel",
+               movement_system.pool.thread_count(),
+               Flocking::ToString(movement_system.kernel.instruction_set()));
+  MOVEMENT_LOG(LOG_LEVEL_INFO, "My movement system seed: %llu%s",
+               static_cast<unsigned long long>(options.spawn.seed),
+               options.system.deterministic ? " (deterministic)" : "");
+  logger.Flush(system_handle.get());
 
   // Populate the simulation
-  CreateEntities(system_handle.get());
+  if (auto rc = Movement::CreateEntities(system_handle.get(),
+                                         movement_system.pool, options.spawn);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    logger.Flush(system_handle.get());
+    return 1;
+  }
 
   // Run the system
   System_StatusCode run_status_code =
-      SYSTEM_RUN(system_handle.get(), TickCallback, nullptr);
-  SendLogMessage(system_handle.get(), LOG_LEVEL_INFO,
-                 "My movement system finished with status code: " +
-                     std::to_string(run_status_code));
+      SYSTEM_RUN(system_handle.get(), Movement::TickCallback, &movement_system);
+  MOVEMENT_LOG(LOG_LEVEL_INFO,
+               "My movement system finished with status code: %d",
+               run_status_code);
+
+  if (!options.trace_output.empty()) {
+    if (!movement_system.profiler.enabled()) {
+      MOVEMENT_LOG(LOG_LEVEL_WARN,
+                   "No trace written: the profiler is off (see "
+                   "--profile-ticks)");
+    } else if (std::FILE *file =
+                   std::fopen(options.trace_output.c_str(), "w")) {
+      movement_system.profiler.WriteChromeTrace(file);
+      std::fclose(file);
+      MOVEMENT_LOG(LOG_LEVEL_INFO, "Wrote %zu profiled ticks to %s",
+                   movement_system.profiler.kept(),
+                   options.trace_output.c_str());
+    } else {
+      MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to open %s",
+                   options.trace_output.c_str());
+    }
+  }
 
   // Return an exit code based on the run status code
   const auto exit_code = run_status_code == SYSTEM_STATUS_CODE_SUCCESS ? 0 : 1;
-  SendLogMessage(system_handle.get(), LOG_LEVEL_INFO,
-                 "My movement system exiting with code: " +
-                     std::to_string(run_status_code));
+  MOVEMENT_LOG(LOG_LEVEL_INFO, "My movement system exiting with code: %d",
+               exit_code);
+  logger.Flush(system_handle.get());
   return exit_code;
 }
@@ -0,0 +1,264 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <improbable/system/c_system_error.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Health metrics of a running movement system, exported in the Prometheus
+// text format so a scraper can alert on tick latency and on the system
+// falling behind real time. Everything here is recorded and exported on the
+// tick thread, or before the run starts, so nothing is synchronised.
+namespace Metrics {
+
+// A log-linear histogram in the style of HdrHistogram. Values are counted in
+// integer units of `resolution`; below 2^kSubBucketBits units every value has
+// its own bucket, and above it each power of two is split into
+// 2^kSubBucketBits buckets, so quantiles are reported to within about 3% of
+// the recorded values. Larger values than the top bucket are counted in it.
+//
+// Quantiles describe the window since the last ResetWindow(); the count and
+// sum cover the whole run, as Prometheus expects of a summary.
+class Histogram {
+public:
+  static constexpr int kSubBucketBits = 5;
+  static constexpr std::uint64_t kSubBuckets = 1u << kSubBucketBits;
+  // Powers of two above the linear range; with a resolution of 1ns the top
+  // bucket starts at about three days
+  static constexpr int kOctaves = 48;
+  static constexpr std::size_t kBucketCount = (kOctaves + 1) * kSubBuckets;
+
+  explicit Histogram(double resolution) : resolution_(resolution) {}
+
+  void Record(double value) {
+    if (!(value >= 0)) {
+      return;
+    }
+    const double units = std::floor(value / resolution_);
+    const auto index =
+        units >= static_cast<double>(UINT64_MAX)
+            ? kBucketCount - 1
+            : std::min(BucketIndex(static_cast<std::uint64_t>(units)),
+                       kBucketCount - 1);
+    ++buckets_[index];
+    ++window_count_;
+    window_max_ = std::max(window_max_, value);
+    ++total_count_;
+    total_sum_ += value;
+  }
+
+  // The value below which a fraction `q` of the window's values fall, or 0
+  // for an empty window. Reports the middle of the bucket it lands in.
+  double Quantile(double q) const {
+    if (window_count_ == 0) {
+      return 0;
+    }
+    const auto rank = static_cast<std::uint64_t>(
+        std::max(1.0, std::ceil(q * static_cast<double>(window_count_))));
+    std::uint64_t seen = 0;
+    for (std::size_t index = 0; index < kBucketCount; ++index) {
+      seen += buckets_[index];
+      if (seen >= rank) {
+        return std::min(BucketMiddle(index) * resolution_, window_max_);
+      }
+    }
+    return window_max_;
+  }
+
+  std::uint64_t window_count() const { return window_count_; }
+  double window_max() const { return window_max_; }
+  std::uint64_t total_count() const { return total_count_; }
+  double total_sum() const { return total_sum_; }
+
+  void ResetWindow() {
+    std::fill(buckets_, buckets_ + kBucketCount, 0);
+    window_count_ = 0;
+    window_max_ = 0;
+  }
+
+private:
+  static std::size_t BucketIndex(std::uint64_t units) {
+    if (units < kSubBuckets) {
+      return static_cast<std::size_t>(units);
+    }
+    const int shift = 63 - __builtin_clzll(units) - kSubBucketBits;
+    return static_cast<std::size_t>((shift + 1) * kSubBuckets +
+                                    ((units >> shift) - kSubBuckets));
+  }
+
+  static double BucketMiddle(std::size_t index) {
+    if (index < kSubBuckets) {
+      return static_cast<double>(index);
+    }
+    const auto shift = index / kSubBuckets - 1;
+    const double lower =
+        std::ldexp(static_cast<double>(index % kSubBuckets + kSubBuckets),
+                   static_cast<int>(shift));
+    return lower + 0.5 * (std::ldexp(1.0, static_cast<int>(shift)) - 1);
+  }
+
+  double resolution_;
+  std::uint64_t buckets_[kBucketCount] = {};
+  std::uint64_t window_count_ = 0;
+  double window_max_ = 0;
+  std::uint64_t total_count_ = 0;
+  double total_sum_ = 0;
+};
+
+// What TickCallback measured about one tick
+struct TickSample {
+  double seconds = 0;
+  std::uint64_t boids = 0;
+  std::uint64_t neighbours = 0;
+  std::uint32_t ticks_fired = 1;
+  System_StatusCode status = SYSTEM_STATUS_CODE_SUCCESS;
+  // Component updates sent and held back as unchanged, over the whole run
+  std::uint64_t component_updates = 0;
+  std::uint64_t suppressed_component_updates = 0;
+};
+
+class Registry {
+public:
+  // Status codes run from 0 to SYSTEM_STATUS_CODE_ABORT
+  static constexpr std::size_t kStatusCodeCount = 101;
+
+  void RecordTick(const TickSample &sample) {
+    ++ticks_;
+    missed_ticks_ += sample.ticks_fired > 1 ? sample.ticks_fired - 1 : 0;
+    if (sample.status != SYSTEM_STATUS_CODE_SUCCESS) {
+      ++failed_ticks_;
+    }
+    boids_ = sample.boids;
+    component_updates_ = sample.component_updates;
+    suppressed_component_updates_ = sample.suppressed_component_updates;
+    tick_seconds_.Record(sample.seconds);
+    if (sample.boids > 0) {
+      const auto boids = static_cast<double>(sample.boids);
+      entity_seconds_.Record(sample.seconds / boids);
+      neighbours_per_boid_.Record(static_cast<double>(sample.neighbours) /
+                                  boids);
+    }
+  }
+
+  // A System API call that returned `code`
+  void CountApiError(System_StatusCode code) {
+    const auto index = static_cast<std::size_t>(code);
+    ++api_errors_[index < kStatusCodeCount ? index : kStatusCodeCount - 1];
+  }
+
+  void CountQuery() { ++queries_; }
+
+  // Writes every metric in the Prometheus text exposition format, then starts
+  // a new quantile window
+  void WritePrometheus(std::FILE *file) {
+    WriteCounter(file, "movement_ticks_total", "Tick callbacks run", ticks_);
+    WriteCounter(file, "movement_failed_ticks_total",
+                 "Tick callbacks that returned an error", failed_ticks_);
+    WriteCounter(file, "movement_missed_ticks_total",
+                 "Ticks fired beyond one per callback, because the system "
+                 "fell behind real time",
+                 missed_ticks_);
+    WriteCounter(file, "movement_queries_total", "System API queries created",
+                 queries_);
+    WriteCounter(file, "movement_component_updates_total",
+                 "Component updates sent to the runtime", component_updates_);
+    WriteCounter(file, "movement_suppressed_component_updates_total",
+                 "Component updates held back because the component had not "
+                 "changed",
+                 suppressed_component_updates_);
+    std::fprintf(file,
+                 "# HELP movement_api_errors_total System API calls that "
+                 "failed, by status code\n"
+                 "# TYPE movement_api_errors_total counter\n");
+    for (std::size_t code = 0; code < kStatusCodeCount; ++code) {
+      if (api_errors_[code] > 0) {
+        std::fprintf(file, "movement_api_errors_total{code=\"%s\"} %llu\n",
+                     System_StatusCodeToString(
+                         static_cast<System_StatusCode>(code)),
+                     static_cast<unsigned long long>(api_errors_[code]));
+      }
+    }
+    std::fprintf(file,
+                 "# HELP movement_boids Boids ticked by the last tick\n"
+                 "# TYPE movement_boids gauge\n"
+                 "movement_boids %llu\n",
+                 static_cast<unsigned long long>(boids_));
+    WriteSummary(file, "movement_tick_seconds",
+                 "Wall time of a tick callback", tick_seconds_);
+    WriteSummary(file, "movement_entity_tick_seconds",
+                 "Wall time of a tick callback per boid", entity_seconds_);
+    WriteSummary(file, "movement_neighbours_per_boid",
+                 "Mean neighbours in view of each boid in a tick",
+                 neighbours_per_boid_);
+  }
+
+private:
+  static void WriteCounter(std::FILE *file, const char *name,
+                           const char *help, std::uint64_t value) {
+    std::fprintf(file, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name,
+                 help, name, name, static_cast<unsigned long long>(value));
+  }
+
+  // As a summary over the window, with the window's maximum as a gauge
+  static void WriteSummary(std::FILE *file, const char *name,
+                           const char *help, Histogram &histogram) {
+    std::fprintf(file, "# HELP %s %s\n# TYPE %s summary\n", name, help, name);
+    for (const double q : {0.5, 0.9, 0.99, 0.999}) {
+      std::fprintf(file, "%s{quantile=\"%g\"} %.9g\n", name, q,
+                   histogram.Quantile(q));
+    }
+    std::fprintf(file, "%s_sum %.9g\n%s_count %llu\n", name,
+                 histogram.total_sum(), name,
+                 static_cast<unsigned long long>(histogram.total_count()));
+    std::fprintf(file, "# HELP %s_max Largest value since the last scrape\n"
+                       "# TYPE %s_max gauge\n%s_max %.9g\n",
+                 name, name, name, histogram.window_max());
+    histogram.ResetWindow();
+  }
+
+  std::uint64_t ticks_ = 0;
+  std::uint64_t failed_ticks_ = 0;
+  std::uint64_t missed_ticks_ = 0;
+  std::uint64_t queries_ = 0;
+  std::uint64_t boids_ = 0;
+  std::uint64_t component_updates_ = 0;
+  std::uint64_t suppressed_component_updates_ = 0;
+  std::uint64_t api_errors_[kStatusCodeCount] = {};
+  Histogram tick_seconds_{1e-9};
+  Histogram entity_seconds_{1e-12};
+  Histogram neighbours_per_boid_{1e-3};
+};
+
+// The registry the movement system and its harnesses share
+inline Registry &DefaultRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+inline void CountApiError(System_StatusCode code) {
+  DefaultRegistry().CountApiError(code);
+}
+
+// Replaces the file at `path` with the registry's metrics. The metrics go to
+// a temporary file that is renamed over `path`, so a scraper never reads a
+// half-written file; this is the layout node_exporter's textfile collector
+// reads. Returns false if the file could not be written.
+inline bool WriteTextFile(Registry &registry, const std::string &path) {
+  const std::string temporary = path + ".tmp";
+  std::FILE *file = std::fopen(temporary.c_str(), "w");
+  if (!file) {
+    return false;
+  }
+  registry.WritePrometheus(file);
+  const bool written = std::fclose(file) == 0;
+  return written && std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+} // namespace Metrics
+
+#endif // METRICS_H
@@ -0,0 +1,1582 @@
+#ifndef MOVEMENT_SYSTEM_H
+#define MOVEMENT_SYSTEM_H
+
+#include <improbable/standard_library.h>
+#include <improbable/system/c_query.h>
+#include <improbable/system/c_system.h>
+#include <improbable/system/c_system_error.h>
+#include <myschema.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boid_state.h"
+#include "component_access.h"
+#include "flocking_kernel.h"
+#include "lod_scheduler.h"
+#include "logging.h"
+#include "metrics.h"
+#include "neighbour_list.h"
+#include "random.h"
+#include "runtime_extensions.h"
+#include "scratch_arena.h"
+#include "spatial_grid.h"
+#include "spatial_tree.h"
+#include "spawn.h"
+#include "thread_pool.h"
+#include "tick_profiler.h"
+
+// The movement system's tick, split out of main.cpp so that harnesses such as
+// the tick benchmark can drive it directly
+namespace Movement {
+
+// The layer that owns the boids' components
+constexpr char kLayer[] = "movement_layer";
+
+constexpr double vision_radius = 1;
+constexpr double field_of_vision = 1;
+constexpr double separation_weight = 0.05;
+constexpr double alignment_weight = 0.5;
+constexpr double cohesion_weight = 0.1;
+constexpr double max_speed = 0.2;
+
+// Boids per chunk handed to a worker during the compute stage; large enough
+// to amortise claiming a chunk, small enough to balance dense regions
+constexpr std::size_t kFlockingGrain = 256;
+
+// Populates the simulation with boids as `parameters` describe, generating
+// their components on the pool's threads
+inline System_StatusCode CreateEntities(System_Handle system_handle,
+                                        Threading::ThreadPool &pool,
+                                        const Spawn::Parameters &parameters) {
+  const auto start = std::chrono::steady_clock::now();
+  Spawn::Buffers buffers;
+  const auto generated = Spawn::Generate(parameters, pool, buffers);
+  if (generated < parameters.entity_count) {
+    MOVEMENT_LOG(LOG_LEVEL_WARN,
+                 "Only %zu of %zu boids fit the %s layout's minimum spacing",
+                 generated, parameters.entity_count,
+                 Spawn::ToString(parameters.layout));
+  }
+  const auto generated_at = std::chrono::steady_clock::now();
+
+  if (auto rc = Spawn::Submit(system_handle, buffers, kLayer);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    Metrics::CountApiError(rc);
+    MOVEMENT_LOG(LOG_LEVEL_ERROR,
+                 "System failed to create entity (received status code: %d)",
+                 rc);
+    return rc;
+  }
+  const auto submitted_at = std::chrono::steady_clock::now();
+
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+  MOVEMENT_LOG(LOG_LEVEL_INFO,
+               "Spawned %zu boids (%s layout) in %.1f ms: %.1f ms generating, "
+               "%.1f ms submitting",
+               generated, Spawn::ToString(parameters.layout),
+               Milliseconds(submitted_at - start).count(),
+               Milliseconds(generated_at - start).count(),
+               Milliseconds(submitted_at - generated_at).count());
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+// Rows moved per bulk component call. The batch's columns are grown by this
+// much ahead of each call, before the runtime says how many rows it filled.
+constexpr uint32_t kBulkRows = 4096;
+
+// The columns of `boids` from `row` on, as the bulk component calls see
+// them: position x, y and z, velocity x, y and z, then acceleration
+inline std::array<System_ComponentColumnType, 7>
+BoidColumns(Boids::BoidState &boids, std::size_t row) {
+  using Components::FieldColumn;
+  return {FieldColumn<Position, offsetof(Position, coords.x)>(
+              boids.position_x.data() + row),
+          FieldColumn<Position, offsetof(Position, coords.y)>(
+              boids.position_y.data() + row),
+          FieldColumn<Position, offsetof(Position, coords.z)>(
+              boids.position_z.data() + row),
+          FieldColumn<Velocity, offsetof(Velocity, value.x)>(
+              boids.velocity_x.data() + row),
+          FieldColumn<Velocity, offsetof(Velocity, value.y)>(
+              boids.velocity_y.data() + row),
+          FieldColumn<Velocity, offsetof(Velocity, value.z)>(
+              boids.velocity_z.data() + row),
+          FieldColumn<Acceleration, offsetof(Acceleration, value)>(
+              boids.acceleration.data() + row)};
+}
+
+// Replaces `boids` with every remaining entity of a bulk source, a chunk at a
+// time. `get_bulk(columns, column_count, capacity, &count)` is
+// System_GetComponentsBulk or System_Query_GetComponentsBulk on the source;
+// only the first `column_count` of BoidColumns are filled, and the rest are
+// left zero.
+template <typename GetBulk>
+inline System_StatusCode GetBoidsBulk(GetBulk &&get_bulk,
+                                      uint32_t column_count,
+                                      Boids::BoidState &boids) {
+  boids.clear();
+  for (;;) {
+    const auto row = boids.size();
+    boids.resize(row + kBulkRows);
+    const auto columns = BoidColumns(boids, row);
+    uint32_t count = 0;
+    if (auto rc = get_bulk(columns.data(), column_count, kBulkRows, &count);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      boids.resize(row);
+      return rc;
+    }
+    boids.resize(row + count);
+    if (count < kBulkRows) {
+      break;
+    }
+  }
+  for (std::size_t i = 0; i < boids.size(); ++i) {
+    boids.entity_index[i] = static_cast<uint32_t>(i);
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+// Handles a bulk call's failure. A runtime without the bulk extension answers
+// NOT_IMPLEMENTED, after which `bulk_access` is cleared and every transfer
+// uses the per-entity calls; returns whether that is what happened.
+inline bool FallBackFromBulk(System_StatusCode rc, bool *bulk_access) {
+  Metrics::CountApiError(rc);
+  if (rc != SYSTEM_STATUS_CODE_NOT_IMPLEMENTED) {
+    return false;
+  }
+  MOVEMENT_LOG(LOG_LEVEL_INFO, "The runtime has no bulk component access; "
+                               "using per-entity calls");
+  *bulk_access = false;
+  return true;
+}
+
+// Replaces `indices` with the entity index of every remaining entity of a
+// source, a page at a time. `get_indices(indices, capacity, &count)` is
+// System_GetEntityIndices or System_Query_GetEntityIndices on the source.
+template <typename GetIndices>
+inline System_StatusCode
+GetEntityIndices(GetIndices &&get_indices,
+                 std::vector<System_EntityIndex> &indices) {
+  indices.clear();
+  for (;;) {
+    const auto row = indices.size();
+    indices.resize(row + kBulkRows);
+    uint32_t count = 0;
+    if (auto rc = get_indices(indices.data() + row, kBulkRows, &count);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      indices.resize(row);
+      return rc;
+    }
+    indices.resize(row + count);
+    if (count < kBulkRows) {
+      return SYSTEM_STATUS_CODE_SUCCESS;
+    }
+  }
+}
+
+// The boids this system writes, kept between ticks so that their components
+// need not be fetched back from the runtime, which only ever holds what this
+// system last stored. The batch itself is the front buffer: row i belongs to
+// `entities[i]`. When the runtime's entities change, the batch is rebuilt in
+// `next` from the rows that survive plus fetches of the new ones, and the two
+// are swapped.
+struct OwnedState {
+  static constexpr uint32_t kNoRow = UINT32_MAX;
+
+  // Cleared once the runtime turns out not to report entity indices
+  bool supported = true;
+  // Whether the batch and `entities` hold what the runtime holds: set when a
+  // tick's store succeeds, and cleared when a tick fails or a consistency
+  // check finds them differing
+  bool valid = false;
+  // Whether the last gather rebuilt the batch instead of keeping it, so that
+  // its rows may belong to other entities than the tick before
+  bool rebuilt = false;
+  std::vector<System_EntityIndex> entities;
+  // This tick's entities, and the back buffer the batch is rebuilt in
+  std::vector<System_EntityIndex> next_entities;
+  Boids::BoidState next;
+  // Batch row of each entity index while rebuilding, otherwise all kNoRow
+  std::vector<uint32_t> row_of;
+  // The batch row each row of `next` is copied from, or 0 for new entities,
+  // and the rows of `next` to fetch
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> missing;
+  // The neighbour query's matches
+  std::vector<System_EntityIndex> query_entities;
+  // The back buffer the rows last sent are rebuilt in, with delta updates
+  Boids::BoidState next_sent;
+};
+
+// The spatial index the neighbour search runs over
+enum class SpatialIndex {
+  // A uniform grid with cells of the vision radius, rebuilt every tick
+  kGrid,
+  // A bounding volume hierarchy, which adapts to clustered flocks and is
+  // refit between rebuilds
+  kTree,
+};
+
+inline const char *ToString(SpatialIndex index) {
+  switch (index) {
+  case SpatialIndex::kTree:
+    return "tree";
+  case SpatialIndex::kGrid:
+    break;
+  }
+  return "grid";
+}
+
+// Parses a spatial index name as returned by ToString. Returns false if the
+// name is not an index.
+inline bool ParseSpatialIndex(const char *name, SpatialIndex *index) {
+  for (const auto candidate : {SpatialIndex::kGrid, SpatialIndex::kTree}) {
+    if (std::strcmp(name, ToString(candidate)) == 0) {
+      *index = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Every boid in the world this tick, bucketed by vision radius so neighbour
+// lookups are in-process cell scans rather than one runtime query per entity
+struct NeighbourSnapshot {
+  // Boids in query order, as gathered
+  Boids::BoidState gathered;
+  // The same boids permuted into the index's order, so each candidate range
+  // from it is a contiguous run of rows
+  Boids::BoidState sorted;
+  SpatialIndex index = SpatialIndex::kGrid;
+  Spatial::UniformGrid grid;
+  Spatial::BoundingVolumeTree tree;
+  // The tree is rebuilt on every this many indexings and refit in between
+  uint32_t tree_rebuild_interval = 1;
+  uint32_t tree_refits = 0;
+};
+
+using QueryHandle =
+    std::unique_ptr<System_Query_Handle_Data, decltype(&System_Query_Destroy)>;
+
+// A query for every boid in the world. Returns null, having logged the
+// failure, if the runtime refuses it.
+inline QueryHandle CreateBoidQuery() {
+  // Only entities with every boid component, so the runtime skips any that
+  // lack one instead of a fetch failing on them. Runtimes without compound
+  // constraints get the Acceleration constraint alone, which matches the
+  // same entities in a world of boids.
+  auto components = Components::Constraints<Acceleration, Velocity, Position>();
+  const auto boid_constraint = System_Query_CompoundConstraint_CreateAnd(
+      components.data(), static_cast<uint32_t>(components.size()));
+  QueryHandle query_handle{Extensions::QueryCreateCompound(&boid_constraint),
+                           System_Query_Destroy};
+  if (!query_handle) {
+    query_handle.reset(System_Query_Create(&components[0].simple_constraint));
+  }
+
+  if (!query_handle) {
+    Metrics::CountApiError(SYSTEM_STATUS_CODE_ERROR);
+    MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to create boid component query");
+    return query_handle;
+  }
+  Metrics::DefaultRegistry().CountQuery();
+  return query_handle;
+}
+
+// Whether the world's boids are exactly the owned batch, in the same order,
+// in which case the batch already holds the neighbour snapshot. Consumes
+// `query_handle`.
+inline System_StatusCode MatchesOwnedBatch(System_Query_Handle query_handle,
+                                           OwnedState &owned, bool *matches) {
+  *matches = false;
+  const auto rc = GetEntityIndices(
+      [&](System_EntityIndex *indices, uint32_t capacity, uint32_t *count) {
+        return Extensions::QueryGetEntityIndices(query_handle, indices,
+                                                 capacity, count);
+      },
+      owned.query_entities);
+  if (rc == SYSTEM_STATUS_CODE_SUCCESS) {
+    *matches = owned.query_entities == owned.entities;
+    return rc;
+  }
+  Metrics::CountApiError(rc);
+  if (rc == SYSTEM_STATUS_CODE_NOT_IMPLEMENTED) {
+    return SYSTEM_STATUS_CODE_SUCCESS;
+  }
+  MOVEMENT_LOG(LOG_LEVEL_ERROR,
+               "Failed to get the boid query's entity indices (received "
+               "status code: %d)",
+               rc);
+  return SYSTEM_STATUS_CODE_ABORT;
+}
+
+// Gathers the position and velocity of every boid, in query order, with a
+// single component query. Uses the bulk call while `bulk_access` is set.
+// Given the owned `batch` of this tick, whose entities `owned` holds, the
+// snapshot is copied from the batch instead if the query matches exactly
+// those entities; `*fetched` is set to whether it was fetched.
+inline System_StatusCode QueryNeighbours(Boids::BoidState &gathered,
+                                         bool *bulk_access,
+                                         const Boids::BoidState *batch,
+                                         OwnedState *owned, bool *fetched) {
+  gathered.clear();
+  *fetched = true;
+
+  auto query_handle = CreateBoidQuery();
+  if (!query_handle) {
+    return SYSTEM_STATUS_CODE_ERROR;
+  }
+
+  if (batch) {
+    bool matches = false;
+    if (auto rc = MatchesOwnedBatch(query_handle.get(), *owned, &matches);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      return rc;
+    }
+    if (matches) {
+      // Acceleration included; the snapshot's is unused either way
+      gathered = *batch;
+      *fetched = false;
+      return SYSTEM_STATUS_CODE_SUCCESS;
+    }
+    // The match consumed the query
+    query_handle = CreateBoidQuery();
+    if (!query_handle) {
+      return SYSTEM_STATUS_CODE_ERROR;
+    }
+  }
+
+  if (*bulk_access) {
+    // Positions and velocities only; neighbours' accelerations are unused
+    const auto rc = GetBoidsBulk(
+        [&](const System_ComponentColumnType *columns, uint32_t column_count,
+            uint32_t capacity, uint32_t *count) {
+          return Extensions::QueryGetComponentsBulk(
+              query_handle.get(), columns, column_count, capacity, count);
+        },
+        6, gathered);
+    if (rc == SYSTEM_STATUS_CODE_SUCCESS) {
+      return rc;
+    }
+    if (!FallBackFromBulk(rc, bulk_access)) {
+      MOVEMENT_LOG(LOG_LEVEL_ERROR,
+                   "Failed to get neighbour boids in bulk (received status "
+                   "code: %d)",
+                   rc);
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+  }
+
+  while (!System_Query_IterationFinished(query_handle.get())) {
+    Position position;
+    Velocity velocity;
+    if (auto status = Components::Get(query_handle.get(), position, velocity);
+        !status.ok()) {
+      Metrics::CountApiError(status.code);
+      MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to get neighbour boid's %s",
+                   status.component);
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+
+    gathered.PushBack(position, velocity, Acceleration{},
+                      static_cast<uint32_t>(gathered.size()));
+
+    if (auto rc = System_Query_NextEntity(query_handle.get());
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      Metrics::CountApiError(rc);
+      MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to increment query handle");
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+  }
+
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+// Indexes `boids` in the snapshot's tree: refits it if it holds as many
+// boids and is not due a rebuild, and rebuilds it otherwise
+inline void IndexTree(NeighbourSnapshot &snapshot,
+                      const Boids::BoidState &boids) {
+  auto &tree = snapshot.tree;
+  if (tree.size() == boids.size() &&
+      ++snapshot.tree_refits < snapshot.tree_rebuild_interval) {
+    tree.Refit(boids.position_x.data(), boids.position_y.data(),
+               boids.position_z.data());
+    return;
+  }
+  tree.Build(boids.position_x.data(), boids.position_y.data(),
+             boids.position_z.data(), boids.size());
+  snapshot.tree_refits = 0;
+}
+
+// Buckets the gathered boids into a grid with cells of `cell_size`, with its
+// tables in `arena`, and permutes them into its order. With the tree as the
+// snapshot's index they are indexed in the tree instead.
+inline void IndexNeighbourSnapshot(NeighbourSnapshot &snapshot,
+                                   double cell_size,
+                                   Memory::ScratchArena &arena) {
+  const auto &gathered = snapshot.gathered;
+  if (snapshot.index == SpatialIndex::kTree) {
+    IndexTree(snapshot, gathered);
+    snapshot.sorted.Permute(gathered, snapshot.tree.order());
+    return;
+  }
+  snapshot.grid.Build(gathered.position_x.data(), gathered.position_y.data(),
+                      gathered.position_z.data(), gathered.size(), cell_size,
+                      arena);
+  snapshot.sorted.Permute(gathered, snapshot.grid.order());
+}
+
+// Gathers every boid and rebuilds the neighbour grid from them, with its
+// tables in `arena`. `batch`, `owned` and `fetched` are as for
+// QueryNeighbours.
+inline System_StatusCode
+GatherNeighbourSnapshot(NeighbourSnapshot &snapshot,
+                        Memory::ScratchArena &arena, bool *bulk_access,
+                        const Boids::BoidState *batch, OwnedState *owned,
+                        bool *fetched) {
+  if (auto rc = QueryNeighbours(snapshot.gathered, bulk_access, batch, owned,
+                                fetched);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    return rc;
+  }
+  IndexNeighbourSnapshot(snapshot, vision_radius, arena);
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+// As GatherNeighbourSnapshot, but keeping `lists` current instead of
+// searching the grid every tick. While the lists still cover every boid's
+// neighbours, the gathered boids are only permuted into the order the lists
+// were built against; otherwise the grid is rebuilt at the lists' radius and
+// the lists with it. Sets `rebuilt` to whether they were. Given `owned`,
+// `boids` is the owned batch it describes, as for QueryNeighbours.
+inline System_StatusCode
+GatherNeighbourLists(Threading::ThreadPool &pool,
+                     const Boids::BoidState &boids,
+                     NeighbourSnapshot &snapshot, Spatial::VerletLists &lists,
+                     Memory::ScratchArena &arena, bool *bulk_access,
+                     OwnedState *owned, bool *fetched, bool *rebuilt) {
+  if (auto rc = QueryNeighbours(snapshot.gathered, bulk_access,
+                                owned ? &boids : nullptr, owned, fetched);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    return rc;
+  }
+  *rebuilt = !lists.Covers(pool, boids, snapshot.gathered);
+  if (*rebuilt) {
+    IndexNeighbourSnapshot(snapshot, lists.list_radius(), arena);
+    lists.Build(pool, boids, snapshot.gathered, snapshot.grid,
+                snapshot.sorted);
+  } else {
+    snapshot.sorted.Permute(snapshot.gathered, lists.order());
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+// Re-indexes the snapshot over the batch itself, for the sub-steps of a
+// catch-up tick after the first. The gathered snapshot is the world as of the
+// start of the tick, while the batch holds every boid this system moves and
+// has been advanced since. With `reuse_grid` the grid from the previous
+// sub-step, which must have been built over the same batch, is kept and only
+// the boids' state is refreshed; boids that have since crossed into another
+// cell may then be missed. A reused tree is refit instead, which misses none.
+inline void IndexBatchSnapshot(NeighbourSnapshot &snapshot,
+                               const Boids::BoidState &boids, bool reuse_grid,
+                               Memory::ScratchArena &arena) {
+  if (snapshot.index == SpatialIndex::kTree) {
+    if (reuse_grid) {
+      snapshot.tree.Refit(boids.position_x.data(), boids.position_y.data(),
+                          boids.position_z.data());
+    } else {
+      IndexTree(snapshot, boids);
+    }
+    snapshot.sorted.Permute(boids, snapshot.tree.order());
+    return;
+  }
+  if (!reuse_grid) {
+    snapshot.grid.Build(boids.position_x.data(), boids.position_y.data(),
+                        boids.position_z.data(), boids.size(), vision_radius,
+                        arena);
+  }
+  snapshot.sorted.Permute(boids, snapshot.grid.order());
+}
+
+// Gather stage: walks the entity iterator once, copying every entity's
+// components into structure-of-arrays columns so the flocking compute runs
+// without C API calls. While `bulk_access` is set the runtime fills the
+// columns directly, a few thousand entities per call.
+inline System_StatusCode GatherBoids(System_EntityIterator entity_iterator,
+                                     Boids::BoidState &boids,
+                                     bool *bulk_access) {
+  if (*bulk_access) {
+    const auto rc = GetBoidsBulk(
+        [&](const System_ComponentColumnType *columns, uint32_t column_count,
+            uint32_t capacity, uint32_t *count) {
+          return Extensions::GetComponentsBulk(entity_iterator, columns,
+                                               column_count, capacity, count);
+        },
+        7, boids);
+    if (rc == SYSTEM_STATUS_CODE_SUCCESS) {
+      return rc;
+    }
+    if (!FallBackFromBulk(rc, bulk_access)) {
+      MOVEMENT_LOG(LOG_LEVEL_ERROR,
+                   "Failed to get boid components in bulk (received status "
+                   "code: %d)",
+                   rc);
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+  }
+  boids.clear();
+
+  while (!System_IterationFinished(entity_iterator)) {
+    // Get the current entity's components
+    Position position;
+    Velocity velocity;
+    Acceleration acceleration;
+    if (auto status = Components::Get(entity_iterator, position, velocity,
+                                      acceleration);
+        !status.ok()) {
+      Metrics::CountApiError(status.code);
+      MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to get current entity %s",
+                   status.component);
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+
+    boids.PushBack(position, velocity, acceleration,
+                   static_cast<uint32_t>(boids.size()));
+
+    // Advance the entity iterator
+    if (auto rc = System_NextEntity(entity_iterator);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      Metrics::CountApiError(rc);
+      MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to advance the entity iterator");
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+// Fetches the components of the rows of `boids` listed in `missing`, in
+// ascending order, from the entities at those positions of `entity_iterator`
+inline System_StatusCode FetchRows(System_EntityIterator entity_iterator,
+                                   const std::vector<uint32_t> &missing,
+                                   Boids::BoidState &boids) {
+  uint32_t row = 0;
+  for (const auto target : missing) {
+    for (; row < target; ++row) {
+      if (auto rc = System_NextEntity(entity_iterator);
+          rc != SYSTEM_STATUS_CODE_SUCCESS) {
+        Metrics::CountApiError(rc);
+        MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to advance the entity iterator");
+        return SYSTEM_STATUS_CODE_ABORT;
+      }
+    }
+    Position position;
+    Velocity velocity;
+    Acceleration acceleration;
+    if (auto status = Components::Get(entity_iterator, position, velocity,
+                                      acceleration);
+        !status.ok()) {
+      Metrics::CountApiError(status.code);
+      MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to get new entity %s",
+                   status.component);
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+    boids.SetPosition(target, position);
+    boids.SetVelocity(target, velocity);
+    boids.acceleration[target] = acceleration.value;
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+// Compares `samples` rows of the owned batch, picked afresh each tick, with
+// what the runtime holds for their entities, fetching each through a query
+// for its entity index. Entities that have since been deleted are skipped.
+// Sets `consistent` to whether every sampled row matched exactly.
+inline System_StatusCode CheckOwnedState(const Boids::BoidState &boids,
+                                         const OwnedState &owned,
+                                         uint64_t tick, uint32_t samples,
+                                         bool *consistent) {
+  *consistent = true;
+  for (uint32_t sample = 0; sample < samples && !boids.empty(); ++sample) {
+    const auto row = static_cast<std::size_t>(
+        Random::Mix(tick * Random::kGoldenGamma + sample) % boids.size());
+    auto constraint =
+        System_Query_Constraint_CreateEntityIndex(owned.entities[row]);
+    QueryHandle query_handle{System_Query_Create(&constraint),
+                             System_Query_Destroy};
+    Metrics::DefaultRegistry().CountQuery();
+    if (!query_handle) {
+      Metrics::CountApiError(SYSTEM_STATUS_CODE_ERROR);
+      MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to create entity index query");
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+    if (System_Query_IterationFinished(query_handle.get())) {
+      continue;
+    }
+    Position position;
+    Velocity velocity;
+    Acceleration acceleration;
+    if (auto status = Components::Get(query_handle.get(), position, velocity,
+                                      acceleration);
+        !status.ok()) {
+      Metrics::CountApiError(status.code);
+      MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to get sampled entity %s",
+                   status.component);
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+    if (!(position == boids.GetPosition(row) &&
+          velocity == boids.GetVelocity(row) &&
+          acceleration == boids.GetAcceleration(row))) {
+      *consistent = false;
+      return SYSTEM_STATUS_CODE_SUCCESS;
+    }
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+// Gather stage for a system that keeps its owned state. The runtime reports
+// which entities the iterator visits; if they are the entities of the batch,
+// in the same order, nothing is fetched. Otherwise the batch is rebuilt in
+// the back buffer from the rows that remain, and only the new entities'
+// components are fetched. With no state kept yet every boid is gathered.
+// Given `sent`, the rows the runtime holds for the batch, it is kept in step:
+// rebuilt alongside the batch, with fetched rows as the runtime gave them.
+// Returns NOT_IMPLEMENTED, with `entity_iterator` untouched, if the runtime
+// does not report entity indices. Sets `fetched` to the boids fetched.
+inline System_StatusCode GatherOwnedBoids(System_EntityIterator entity_iterator,
+                                          Boids::BoidState &boids,
+                                          OwnedState &owned, bool *bulk_access,
+                                          Boids::BoidState *sent,
+                                          std::size_t *fetched) {
+  // From a copy, so the iterator is left for fetching from
+  System_EntityIterator index_iterator = nullptr;
+  if (auto rc = System_CopyEntityIterator(entity_iterator, &index_iterator);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    Metrics::CountApiError(rc);
+    MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to copy the entity iterator");
+    return SYSTEM_STATUS_CODE_ABORT;
+  }
+  if (auto rc = GetEntityIndices(
+          [&](System_EntityIndex *indices, uint32_t capacity,
+              uint32_t *count) {
+            return Extensions::GetEntityIndices(index_iterator, indices,
+                                                capacity, count);
+          },
+          owned.next_entities);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    Metrics::CountApiError(rc);
+    if (rc != SYSTEM_STATUS_CODE_NOT_IMPLEMENTED) {
+      MOVEMENT_LOG(LOG_LEVEL_ERROR,
+                   "Failed to get the entity iterator's entity indices "
+                   "(received status code: %d)",
+                   rc);
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+    return rc;
+  }
+
+  if (!owned.valid) {
+    if (auto rc = GatherBoids(entity_iterator, boids, bulk_access);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      return rc;
+    }
+    if (boids.size() != owned.next_entities.size()) {
+      MOVEMENT_LOG(LOG_LEVEL_ERROR,
+                   "Gathered %zu boids from an iterator of %zu entities",
+                   boids.size(), owned.next_entities.size());
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+    owned.entities.swap(owned.next_entities);
+    owned.rebuilt = true;
+    if (sent) {
+      *sent = boids;
+    }
+    *fetched = boids.size();
+    return SYSTEM_STATUS_CODE_SUCCESS;
+  }
+
+  *fetched = 0;
+  owned.rebuilt = owned.next_entities != owned.entities;
+  if (!owned.rebuilt) {
+    return SYSTEM_STATUS_CODE_SUCCESS;
+  }
+
+  // Match this tick's entities to the rows they had
+  auto &row_of = owned.row_of;
+  for (std::size_t row = 0; row < owned.entities.size(); ++row) {
+    const auto entity = owned.entities[row];
+    if (entity >= row_of.size()) {
+      row_of.resize(entity + 1, OwnedState::kNoRow);
+    }
+    row_of[entity] = static_cast<uint32_t>(row);
+  }
+  const auto count = owned.next_entities.size();
+  owned.order.resize(count);
+  owned.missing.clear();
+  for (std::size_t row = 0; row < count; ++row) {
+    const auto entity = owned.next_entities[row];
+    const auto source =
+        entity < row_of.size() ? row_of[entity] : OwnedState::kNoRow;
+    if (source == OwnedState::kNoRow) {
+      owned.missing.push_back(static_cast<uint32_t>(row));
+    }
+    owned.order[row] = source == OwnedState::kNoRow ? 0 : source;
+  }
+  for (const auto entity : owned.entities) {
+    row_of[entity] = OwnedState::kNoRow;
+  }
+
+  auto &next = owned.next;
+  if (boids.empty()) {
+    next.resize(count);
+  } else {
+    next.Select(boids, owned.order.data(), count);
+  }
+  for (std::size_t row = 0; row < count; ++row) {
+    next.entity_index[row] = static_cast<uint32_t>(row);
+  }
+  if (auto rc = FetchRows(entity_iterator, owned.missing, next);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    return rc;
+  }
+  if (sent) {
+    auto &next_sent = owned.next_sent;
+    if (sent->empty()) {
+      next_sent.resize(count);
+    } else {
+      next_sent.Select(*sent, owned.order.data(), count);
+    }
+    for (const auto row : owned.missing) {
+      next_sent.SetPosition(row, next.GetPosition(row));
+      next_sent.SetVelocity(row, next.GetVelocity(row));
+      next_sent.acceleration[row] = next.acceleration[row];
+    }
+    std::swap(*sent, next_sent);
+  }
+  std::swap(boids, next);
+  owned.entities.swap(owned.next_entities);
+  *fetched = owned.missing.size();
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+// Compute stage: runs the flocking rules over the gathered batch and advances
+// it by `dt` ticks. No runtime calls happen here.
+// Each boid only reads the neighbour snapshot and writes its own row, so
+// chunks of boids run on the worker pool without synchronisation. Candidates
+// come from `lists` if it is given, and from the snapshot's index otherwise;
+// with `cull_view`, grid cells outside each boid's view cone are skipped,
+// which requires every candidate to lie in the cell the grid put it in.
+// The tree is searched without culling.
+// Given `lod`, boids its plan does not tick in full are only dead-reckoned.
+// Returns the number of neighbours accepted across all boids.
+inline uint64_t ComputeFlocking(Threading::ThreadPool &pool,
+                                const Flocking::Kernel &kernel,
+                                const NeighbourSnapshot &neighbours,
+                                const Spatial::VerletLists *lists,
+                                bool cull_view, Lod::Scheduler *lod,
+                                Boids::BoidState &boids, double dt) {
+  const auto &candidates = neighbours.sorted;
+  std::atomic<uint64_t> neighbour_count{0};
+
+  pool.ParallelFor(
+      boids.size(), kFlockingGrain, [&](std::size_t begin, std::size_t end) {
+        uint64_t chunk_neighbours = 0;
+        for (std::size_t i = begin; i < end; ++i) {
+          if (lod && !lod->Full(i)) {
+            // No steering: carry on at the current velocity
+            kernel.Integrate(Flocking::SteeringSums{}, boids, i, dt);
+            continue;
+          }
+          const auto subject = kernel.MakeSubject(boids, i);
+
+          // Sum separation, alignment and cohesion over the boids in view
+          Flocking::SteeringSums sums;
+          const auto accumulate = [&](std::size_t range_begin,
+                                      std::size_t range_end) {
+            kernel.Accumulate(subject, candidates, range_begin, range_end,
+                              sums);
+          };
+          if (lists) {
+            kernel.Accumulate(subject, candidates, lists->neighbours(i),
+                              lists->neighbour_count(i), sums);
+          } else if (neighbours.index == SpatialIndex::kTree) {
+            neighbours.tree.ForEachCandidateRange(
+                subject.x, subject.y, subject.z, vision_radius, accumulate);
+          } else {
+            // Skip the cells wholly outside the boid's view before testing
+            // their boids one by one
+            const auto cone =
+                cull_view ? kernel.MakeViewCone(subject,
+                                                neighbours.grid.cell_radius())
+                          : Flocking::ViewCone{};
+            if (cone.enabled()) {
+              neighbours.grid.ForEachCandidateRange(
+                  subject.x, subject.y, subject.z, vision_radius,
+                  [&](double x, double y, double z) {
+                    return cone.MayHold(x, y, z);
+                  },
+                  accumulate);
+            } else {
+              neighbours.grid.ForEachCandidateRange(
+                  subject.x, subject.y, subject.z, vision_radius, accumulate);
+            }
+          }
+
+          kernel.Integrate(sums, boids, i, dt);
+          // The kernel's lanes count in doubles, which hold whole numbers
+          // exactly; everything past it counts in integers
+          const auto seen = static_cast<uint32_t>(sums.count);
+          chunk_neighbours += seen;
+          if (lod) {
+            lod->RecordNeighbours(i, seen);
+          }
+        }
+        neighbour_count.fetch_add(chunk_neighbours, std::memory_order_relaxed);
+      });
+  return neighbour_count.load(std::memory_order_relaxed);
+}
+
+// Which of a boid's components the store stage sends, as bits
+enum ComponentChanges : uint8_t {
+  kNothingChanged = 0,
+  kPositionChanged = 1,
+  kVelocityChanged = 2,
+  kAllChanged = kPositionChanged | kVelocityChanged,
+};
+
+// When a component computed this tick counts as changed from the value last
+// sent to the runtime. Each field is rounded to a multiple of `quantum`, if
+// it is above 0, and then differs if it moved further than `epsilon`.
+struct DeltaFilter {
+  double epsilon = 0;
+  double quantum = 0;
+
+  bool Differs(double sent, double computed) const {
+    if (quantum > 0) {
+      sent = std::round(sent / quantum) * quantum;
+      computed = std::round(computed / quantum) * quantum;
+    }
+    // NaNs always differ
+    return !(std::abs(computed - sent) <= epsilon);
+  }
+};
+
+// Marks the components of each boid that changed since the value in `sent`,
+// the row the runtime holds, in `changes`, and copies them into `sent`, as
+// they are about to be sent. The batch keeps what was computed, so a boid
+// whose steps are each too small to send still moves, and is sent once it
+// has moved far enough from the value last sent. Returns the number of
+// component updates that need not be sent.
+inline uint64_t FilterUnchanged(Threading::ThreadPool &pool,
+                                const DeltaFilter &filter,
+                                const Boids::BoidState &boids,
+                                Boids::BoidState &sent,
+                                std::vector<uint8_t> &changes) {
+  changes.resize(boids.size());
+  std::atomic<uint64_t> suppressed{0};
+  pool.ParallelFor(
+      boids.size(), kFlockingGrain, [&](std::size_t begin, std::size_t end) {
+        uint64_t chunk_suppressed = 0;
+        for (std::size_t i = begin; i < end; ++i) {
+          uint8_t changed = kNothingChanged;
+          if (filter.Differs(sent.position_x[i], boids.position_x[i]) ||
+              filter.Differs(sent.position_y[i], boids.position_y[i]) ||
+              filter.Differs(sent.position_z[i], boids.position_z[i])) {
+            changed |= kPositionChanged;
+            sent.SetPosition(i, boids.GetPosition(i));
+          } else {
+            ++chunk_suppressed;
+          }
+          if (filter.Differs(sent.velocity_x[i], boids.velocity_x[i]) ||
+              filter.Differs(sent.velocity_y[i], boids.velocity_y[i]) ||
+              filter.Differs(sent.velocity_z[i], boids.velocity_z[i])) {
+            changed |= kVelocityChanged;
+            sent.SetVelocity(i, boids.GetVelocity(i));
+          } else {
+            ++chunk_suppressed;
+          }
+          changes[i] = changed;
+        }
+        suppressed.fetch_add(chunk_suppressed, std::memory_order_relaxed);
+      });
+  return suppressed.load(std::memory_order_relaxed);
+}
+
+// Sends the components `changed` marks for one boid
+inline Components::Status StoreChanged(System_EntityIterator store_iterator,
+                                       const Boids::BoidState &boids,
+                                       std::size_t row, uint8_t changed) {
+  switch (changed) {
+  case kAllChanged:
+    return Components::Store(store_iterator, boids.GetPosition(row),
+                             boids.GetVelocity(row));
+  case kPositionChanged:
+    return Components::Store(store_iterator, boids.GetPosition(row));
+  case kVelocityChanged:
+    return Components::Store(store_iterator, boids.GetVelocity(row));
+  default:
+    return Components::Status{};
+  }
+}
+
+// Store stage: replays a copy of the tick's entity iterator, which visits the
+// entities in the same order as the gather, and sends each result to Lattice.
+// With `changes`, only the components it marks are sent. While `bulk_access`
+// is set the batch goes in one call per run of boids with the same changes.
+inline System_StatusCode StoreBoids(System_EntityIterator store_iterator,
+                                    const Boids::BoidState &boids,
+                                    const std::vector<uint8_t> *changes,
+                                    bool *bulk_access) {
+  const auto changed = [&](std::size_t row) {
+    return changes ? (*changes)[row] : uint8_t{kAllChanged};
+  };
+  if (*bulk_access) {
+    std::size_t row = 0;
+    auto rc = SYSTEM_STATUS_CODE_SUCCESS;
+    while (rc == SYSTEM_STATUS_CODE_SUCCESS && row < boids.size()) {
+      const auto mask = changed(row);
+      auto end = changes ? row + 1 : boids.size();
+      while (end < boids.size() && changed(end) == mask) {
+        ++end;
+      }
+      // Position columns come first, then velocity; a run with nothing to
+      // send only moves the iterator past its boids. The update only reads
+      // the columns.
+      const auto columns =
+          BoidColumns(const_cast<Boids::BoidState &>(boids), row);
+      const uint32_t first = mask == kVelocityChanged ? 3 : 0;
+      const uint32_t column_count = (mask & kPositionChanged ? 3 : 0) +
+                                    (mask & kVelocityChanged ? 3 : 0);
+      rc = Extensions::UpdateComponentsBulk(
+          store_iterator, columns.data() + first, column_count,
+          static_cast<uint32_t>(end - row));
+      if (rc == SYSTEM_STATUS_CODE_SUCCESS) {
+        row = end;
+      }
+    }
+    if (rc == SYSTEM_STATUS_CODE_SUCCESS) {
+      return rc;
+    }
+    // Only the first call can find the runtime without the extension
+    if (row > 0 || !FallBackFromBulk(rc, bulk_access)) {
+      if (row > 0) {
+        Metrics::CountApiError(rc);
+      }
+      if (rc == SYSTEM_STATUS_CODE_OUT_OF_RANGE) {
+        MOVEMENT_LOG(LOG_LEVEL_ERROR,
+                     "Store iterator finished before the gathered batch");
+      } else {
+        MOVEMENT_LOG(LOG_LEVEL_ERROR,
+                     "Failed to update boid components in bulk (received "
+                     "status code: %d)",
+                     rc);
+      }
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+  }
+  for (std::size_t i = 0; i < boids.size(); ++i) {
+    if (System_IterationFinished(store_iterator)) {
+      MOVEMENT_LOG(LOG_LEVEL_ERROR,
+                   "Store iterator finished before the gathered batch");
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+
+    // Send updated position and velocity to Lattice
+    if (auto status = StoreChanged(store_iterator, boids, i, changed(i));
+        !status.ok()) {
+      Metrics::CountApiError(status.code);
+      MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to update current entity %s",
+                   status.component);
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+
+    // Advance the store iterator
+    if (auto rc = System_NextEntity(store_iterator);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      Metrics::CountApiError(rc);
+      MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to advance the store iterator");
+      return SYSTEM_STATUS_CODE_ABORT;
+    }
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+// A 64-bit fingerprint of every boid's position, velocity and acceleration,
+// in gather order. Rows are hashed independently on the pool and combined by
+// integer addition, so the result does not depend on the thread count; any
+// change to any bit of the state changes it with high probability.
+inline uint64_t HashBoidState(Threading::ThreadPool &pool,
+                              const Boids::BoidState &boids) {
+  std::atomic<uint64_t> sum{0};
+  pool.ParallelFor(
+      boids.size(), kFlockingGrain, [&](std::size_t begin, std::size_t end) {
+        const auto bits = [](double value) {
+          uint64_t word;
+          std::memcpy(&word, &value, sizeof(word));
+          return word;
+        };
+        uint64_t chunk_sum = 0;
+        for (std::size_t i = begin; i < end; ++i) {
+          uint64_t hash = Random::Mix(i * Random::kGoldenGamma);
+          for (const double value :
+               {boids.position_x[i], boids.position_y[i], boids.position_z[i],
+                boids.velocity_x[i], boids.velocity_y[i], boids.velocity_z[i],
+                boids.acceleration[i]}) {
+            hash = Random::Mix(hash ^ bits(value));
+          }
+          chunk_sum += hash;
+        }
+        sum.fetch_add(chunk_sum, std::memory_order_relaxed);
+      });
+  return Random::Mix(sum.load(std::memory_order_relaxed) + boids.size());
+}
+
+// What the most recent tick did, for harnesses and diagnostics
+struct TickStatistics {
+  // Ticks run so far, including this one
+  uint64_t tick = 0;
+  std::size_t boid_count = 0;
+  std::size_t neighbour_snapshot_size = 0;
+  uint64_t neighbour_count = 0;
+  // HashBoidState after the tick, if it was a hashing tick; otherwise 0
+  uint64_t state_hash = 0;
+  // Whether this tick rebuilt the Verlet neighbour lists, and how many ticks
+  // so far have; both stay 0 with the lists disabled
+  bool neighbour_lists_rebuilt = false;
+  uint64_t neighbour_list_builds = 0;
+  // Sub-steps the tick was integrated in, and whether any of them reused the
+  // previous sub-step's grid; neighbour_count is averaged over the sub-steps
+  uint32_t substeps = 1;
+  bool catch_up_reused_grid = false;
+  // Boids the gather fetched from the runtime, and whether the neighbour
+  // snapshot was fetched rather than copied from the batch; with the owned
+  // state kept, both are usually nothing
+  std::size_t boids_fetched = 0;
+  bool neighbours_fetched = true;
+  // Consistency checks so far that found the kept state differing from the
+  // runtime's
+  uint64_t owned_state_divergences = 0;
+  // Component updates the store sent, and those it held back because the
+  // component had not changed; totals over the run
+  uint64_t component_updates = 0;
+  uint64_t suppressed_component_updates = 0;
+  // Boids the level of detail scheduler dead-reckoned this tick
+  std::size_t lod_reduced = 0;
+};
+
+// How a tick that fired more than once catches up on the ticks it missed
+enum class CatchUpMode {
+  // One sub-step per tick fired, up to the configured cap, each searching for
+  // neighbours afresh
+  kFixed,
+  // As kFixed while the sub-steps fit the catch-up budget. Beyond it, sub-steps
+  // after the second reuse the previous sub-step's grid, and if that is still
+  // too slow, fewer and longer sub-steps are taken.
+  kAdaptive,
+};
+
+inline const char *ToString(CatchUpMode mode) {
+  switch (mode) {
+  case CatchUpMode::kAdaptive:
+    return "adaptive";
+  case CatchUpMode::kFixed:
+    break;
+  }
+  return "fixed";
+}
+
+// Parses a catch-up mode name as returned by ToString. Returns false if the
+// name is not a mode.
+inline bool ParseCatchUpMode(const char *name, CatchUpMode *mode) {
+  for (const auto candidate : {CatchUpMode::kFixed, CatchUpMode::kAdaptive}) {
+    if (std::strcmp(name, ToString(candidate)) == 0) {
+      *mode = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+// How a MovementSystem runs
+struct Configuration {
+  // Threads working on the compute stage, including the tick thread
+  std::size_t thread_count = 1;
+  // Use the scalar kernel, whose results do not depend on which SIMD
+  // instructions the machine has. Every boid's update is already independent
+  // of the thread count and of which worker ran it, so with a fixed seed and
+  // the same binary this makes runs bit-for-bit repeatable anywhere.
+  bool deterministic = false;
+  // Hash the boid state and log it every this many ticks; 0 never does
+  uint32_t hash_interval = 0;
+  // Cache each boid's neighbours in Verlet lists reaching this far past the
+  // vision radius, and only search for neighbours again once some boid has
+  // moved half of it; 0 searches every tick. Larger skins rebuild less often
+  // but test more candidates per boid.
+  double verlet_skin = 0;
+  // A tick that fired several times, because the runtime fell behind in
+  // real-time mode, integrates them in up to this many equal sub-steps rather
+  // than one long step. Each sub-step re-searches for neighbours, so the
+  // cost of a catch-up tick grows with the cap.
+  uint32_t max_substeps = 8;
+  CatchUpMode catch_up_mode = CatchUpMode::kFixed;
+  // With kAdaptive, the wall-clock time the flocking compute of a catch-up
+  // tick should fit in, in milliseconds
+  double catch_up_budget_ms = 50;
+  // Move components with the runtime's bulk calls, if it has them, rather
+  // than one call per entity and component
+  bool bulk_component_access = true;
+  // Keep the boids this system writes between ticks rather than fetching
+  // them back from the runtime, which only holds what the system stored.
+  // Only entities new to the system are fetched, and the neighbour snapshot
+  // is copied from the batch while the world holds no other boids. Needs the
+  // runtime's entity index extension; without it everything is fetched.
+  bool cache_owned_state = false;
+  // With cache_owned_state, compare this many of the kept boids with the
+  // runtime every consistency_check_interval ticks, and fetch every boid
+  // again if any differs; an interval of 0 never checks
+  uint32_t consistency_check_samples = 16;
+  uint32_t consistency_check_interval = 10;
+  // Only send a boid's Position or Velocity when it changed from the value
+  // last sent, as delta_filter judges, so that boids at rest cost no writes.
+  // The system keeps moving boids by what it computed, so small steps add up
+  // until they are sent. That needs cache_owned_state: a system that fetches
+  // its boids every tick only has the values last sent to go on, and only
+  // holds back components that are exactly equal. The default filter only
+  // does that anyway.
+  bool delta_updates = false;
+  DeltaFilter delta_filter = {};
+  // Level of detail: with an interval above 1, isolated boids, or with
+  // points of interest the boids outside all of them, only steer once in
+  // that many ticks, and are dead-reckoned in between
+  Lod::Parameters lod = Lod::Parameters();
+  // Keep per-phase timings of the last this many ticks, for the summary log
+  // and a Chrome trace; 0 turns the profiler off. Its ring is allocated up
+  // front, at about 120 bytes a tick.
+  uint32_t profile_ticks = 0;
+  // With the profiler on, log a summary of the last this many ticks every
+  // this many ticks; 0 never does
+  uint32_t profile_summary_interval = 0;
+  // Write health metrics in the Prometheus text format to this file every
+  // metrics_interval_seconds, replacing it each time; empty writes none
+  std::string metrics_path = "";
+  double metrics_interval_seconds = 10;
+  // Skip grid cells that lie wholly outside a boid's field of vision in the
+  // neighbour search. It accepts exactly the same neighbours either way, but
+  // splits the candidates into different runs, so the SIMD kernels sum them
+  // in a different order and the results can differ in the last bits.
+  bool cull_view_cone = true;
+  // The index the neighbour search runs over. The grid caps its table at a
+  // few cells per boid, so when clusters sit far apart in a large world its
+  // cells grow to hold whole clusters; the tree's lookups cost the same
+  // wherever the boids are, but more than the grid's at the default density.
+  // The Verlet lists are built over the grid, so with a skin it is used.
+  SpatialIndex spatial_index = SpatialIndex::kGrid;
+  // With the tree, rebuild it once in this many ticks and only refit its
+  // boxes to the boids' new positions in between; 0 or 1 rebuilds every tick
+  uint32_t tree_rebuild_interval = 8;
+};
+
+// Smoothed wall-clock cost of each kind of sub-step, from which the adaptive
+// catch-up mode predicts what a catch-up tick will cost
+struct SubstepCosts {
+  // The first sub-step of a tick, searching the gathered snapshot
+  double first_ms = 0;
+  // A later sub-step that rebuilds the grid over the batch
+  double search_ms = 0;
+  // A later sub-step that reuses the previous sub-step's grid
+  double reuse_ms = 0;
+
+  static void Update(double &average, double sample_ms) {
+    average = average > 0 ? average + 0.25 * (sample_ms - average) : sample_ms;
+  }
+};
+
+// How one tick is split into sub-steps
+struct CatchUpPlan {
+  uint32_t substeps = 1;
+  // Ticks each sub-step advances the boids by
+  double dt = 1;
+  // Whether sub-steps after the second reuse the previous sub-step's grid
+  bool reuse_grid = false;
+};
+
+// Splits `ticks_fired` ticks into sub-steps. The sub-steps always cover every
+// tick fired; only how many there are, and how carefully each searches for
+// neighbours, depends on the mode and the measured `costs`.
+inline CatchUpPlan PlanCatchUp(const Configuration &configuration,
+                               uint32_t ticks_fired,
+                               const SubstepCosts &costs) {
+  CatchUpPlan plan;
+  plan.substeps =
+      std::max(1u, std::min(ticks_fired, configuration.max_substeps));
+  if (configuration.catch_up_mode == CatchUpMode::kAdaptive &&
+      plan.substeps > 1) {
+    // Budget left after the first sub-step, and how many sub-steps of each
+    // kind fit in it; costs not measured yet are assumed to fit
+    const double budget_ms =
+        std::max(0.0, configuration.catch_up_budget_ms - costs.first_ms);
+    const auto fitting = [](double budget_ms, double cost_ms) {
+      return cost_ms > 0 ? std::floor(budget_ms / cost_ms) : HUGE_VAL;
+    };
+    if (1 + fitting(budget_ms, costs.search_ms) < plan.substeps) {
+      const double substeps =
+          budget_ms < costs.search_ms
+              ? 1
+              : 2 + fitting(budget_ms - costs.search_ms, costs.reuse_ms);
+      plan.substeps = static_cast<uint32_t>(
+          std::min(substeps, static_cast<double>(plan.substeps)));
+      plan.reuse_grid = plan.substeps > 2;
+    }
+  }
+  plan.dt = static_cast<double>(ticks_fired) / plan.substeps;
+  return plan;
+}
+
+// State the movement system keeps for its whole run. It is owned by main()
+// (or a harness) and reaches every tick through the callback's
+// `user_context`; batches are kept between ticks so their storage is reused,
+// and anything that only lives for one tick comes from `scratch`. In steady
+// state a tick makes no heap allocations.
+struct MovementSystem {
+  explicit MovementSystem(const Configuration &configuration)
+      : configuration(configuration), pool(configuration.thread_count),
+        kernel(Flocking::Parameters{vision_radius, field_of_vision,
+                                    separation_weight, alignment_weight,
+                                    cohesion_weight, max_speed},
+               configuration.deterministic
+                   ? Flocking::InstructionSet::kScalar
+                   : Flocking::DetectInstructionSet()),
+        neighbour_lists(vision_radius, configuration.verlet_skin),
+        bulk_access(configuration.bulk_component_access),
+        lod(configuration.lod), profiler(configuration.profile_ticks) {
+    neighbours.index = neighbour_lists.enabled() ? SpatialIndex::kGrid
+                                                 : configuration.spatial_index;
+    neighbours.tree_rebuild_interval = configuration.tree_rebuild_interval;
+  }
+
+  const Configuration configuration;
+  Threading::ThreadPool pool;
+  Flocking::Kernel kernel;
+  NeighbourSnapshot neighbours;
+  Spatial::VerletLists neighbour_lists;
+  Boids::BoidState boids;
+  OwnedState owned;
+  // With delta updates, the Position and Velocity the runtime holds for each
+  // row of the batch, and the components of each boid that are sent
+  Boids::BoidState sent;
+  std::vector<uint8_t> changes;
+  // Reset at the start of every tick
+  Memory::ScratchArena scratch;
+  SubstepCosts substep_costs;
+  // Cleared once the runtime turns out not to support bulk calls
+  bool bulk_access;
+  Lod::Scheduler lod;
+  TickStatistics last_tick;
+  Profiling::TickProfiler profiler;
+  // When the metrics file was last written
+  std::chrono::steady_clock::time_point metrics_written;
+};
+
+// One tick of the movement system: gather, compute and store
+inline System_StatusCode Tick(MovementSystem &system,
+                              System_EntityIterator entity_iterator,
+                              uint32_t ticks_fired) {
+  MOVEMENT_LOG_EVERY(LOG_LEVEL_DEBUG, std::chrono::seconds(1),
+                     "My movement system ticking");
+  auto &neighbours = system.neighbours;
+  auto &boids = system.boids;
+  system.scratch.Reset();
+
+  // Take a copy of the iterator before the gather consumes it, so the store
+  // stage can replay the same entities
+  System_EntityIterator store_iterator = nullptr;
+  if (auto rc = System_CopyEntityIterator(entity_iterator, &store_iterator);
+      rc != SYSTEM_STATUS_CODE_SUCCESS) {
+    Metrics::CountApiError(rc);
+    MOVEMENT_LOG(LOG_LEVEL_ERROR, "Failed to copy the entity iterator");
+    return SYSTEM_STATUS_CODE_ABORT;
+  }
+
+  // The runtime only holds the batch again once this tick's store succeeds
+  auto &owned = system.owned;
+  const auto &configuration = system.configuration;
+  bool keep_owned = configuration.cache_owned_state && owned.supported;
+  auto *sent = configuration.delta_updates ? &system.sent : nullptr;
+  {
+    MOVEMENT_PROFILE_PHASE(system.profiler, Profiling::Phase::kGather);
+    const auto check_interval = configuration.consistency_check_interval;
+    if (keep_owned && owned.valid && check_interval > 0 &&
+        (system.last_tick.tick + 1) % check_interval == 0) {
+      bool consistent = true;
+      // With delta updates the runtime holds what was last sent, not the
+      // batch
+      if (auto rc = CheckOwnedState(sent ? *sent : boids, owned,
+                                    system.last_tick.tick + 1,
+                                    configuration.consistency_check_samples,
+                                    &consistent);
+          rc != SYSTEM_STATUS_CODE_SUCCESS) {
+        owned.valid = false;
+        return rc;
+      }
+      if (!consistent) {
+        ++system.last_tick.owned_state_divergences;
+        MOVEMENT_LOG_EVERY(LOG_LEVEL_WARN, std::chrono::seconds(10),
+                           "Kept boid state differs from the runtime's; "
+                           "fetching every boid again");
+        owned.valid = false;
+      }
+    }
+
+    auto rc = SYSTEM_STATUS_CODE_NOT_IMPLEMENTED;
+    if (keep_owned) {
+      rc = GatherOwnedBoids(entity_iterator, boids, owned, &system.bulk_access,
+                            sent, &system.last_tick.boids_fetched);
+      if (rc == SYSTEM_STATUS_CODE_NOT_IMPLEMENTED) {
+        MOVEMENT_LOG(LOG_LEVEL_INFO, "The runtime has no entity indices; "
+                                     "fetching every boid each tick");
+        owned.supported = false;
+        keep_owned = false;
+      }
+    }
+    if (rc == SYSTEM_STATUS_CODE_NOT_IMPLEMENTED) {
+      rc = GatherBoids(entity_iterator, boids, &system.bulk_access);
+      system.last_tick.boids_fetched = boids.size();
+      if (sent && rc == SYSTEM_STATUS_CODE_SUCCESS) {
+        *sent = boids;
+      }
+    }
+    owned.valid = false;
+    if (rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      return rc;
+    }
+    // Without owned state only a change in the boid count is noticed
+    if (keep_owned && owned.rebuilt) {
+      system.lod.Forget();
+    }
+  }
+
+  // Index every boid once up front instead of querying per entity
+  auto &lists = system.neighbour_lists;
+  bool lists_rebuilt = false;
+  {
+    MOVEMENT_PROFILE_PHASE(system.profiler, Profiling::Phase::kNeighbours);
+    auto *batch_owned = keep_owned ? &owned : nullptr;
+    auto &fetched = system.last_tick.neighbours_fetched;
+    if (auto rc =
+            lists.enabled()
+                ? GatherNeighbourLists(system.pool, boids, neighbours, lists,
+                                       system.scratch, &system.bulk_access,
+                                       batch_owned, &fetched, &lists_rebuilt)
+                : GatherNeighbourSnapshot(
+                      neighbours, system.scratch, &system.bulk_access,
+                      keep_owned ? &boids : nullptr, batch_owned, &fetched);
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      return rc;
+    }
+  }
+
+  ++system.last_tick.tick;
+  system.last_tick.boid_count = boids.size();
+  system.last_tick.neighbour_snapshot_size = neighbours.sorted.size();
+  system.last_tick.neighbour_lists_rebuilt = lists_rebuilt;
+  system.last_tick.neighbour_list_builds = lists.build_count();
+
+  // While we hope that `ticks_fired` is 1, the system may miss ticks when
+  // running in real-time mode. We advance by this many ticks to compensate,
+  // in sub-steps so that a long gap does not become one unstable step.
+  auto &costs = system.substep_costs;
+  const auto plan = PlanCatchUp(system.configuration, ticks_fired, costs);
+  if (plan.substeps > 1 || ticks_fired > 1) {
+    MOVEMENT_LOG_EVERY(LOG_LEVEL_WARN, std::chrono::seconds(1),
+                       "Catching up %u ticks in %u sub-steps (%s%s)",
+                       ticks_fired, plan.substeps,
+                       ToString(system.configuration.catch_up_mode),
+                       plan.reuse_grid ? ", reusing grids" : "");
+  }
+  Lod::Scheduler *lod = nullptr;
+  system.last_tick.lod_reduced = 0;
+  uint64_t neighbour_count = 0;
+  for (uint32_t step = 0; step < plan.substeps; ++step) {
+    MOVEMENT_PROFILE_PHASE(system.profiler, Profiling::Phase::kSteering);
+    // Planned within the first sub-step's steering, which it belongs to, but
+    // outside the sub-step costs the catch-up plan is fitted to
+    if (step == 0 && system.lod.enabled()) {
+      system.last_tick.lod_reduced = system.lod.Plan(
+          system.pool, boids, system.last_tick.tick, kFlockingGrain);
+      lod = &system.lod;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const bool reuse_grid = plan.reuse_grid && step >= 2;
+    if (step > 0) {
+      IndexBatchSnapshot(neighbours, boids, reuse_grid, system.scratch);
+    }
+    // A reused grid no longer bounds the boids that moved out of its cells
+    neighbour_count += ComputeFlocking(
+        system.pool, system.kernel, neighbours,
+        step == 0 && lists.enabled() ? &lists : nullptr,
+        system.configuration.cull_view_cone && !reuse_grid, lod, boids,
+        plan.dt);
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    SubstepCosts::Update(step == 0    ? costs.first_ms
+                         : reuse_grid ? costs.reuse_ms
+                                      : costs.search_ms,
+                         elapsed.count());
+  }
+  system.last_tick.substeps = plan.substeps;
+  system.last_tick.catch_up_reused_grid = plan.reuse_grid;
+  system.last_tick.neighbour_count = neighbour_count / plan.substeps;
+  if (lists.enabled()) {
+    MOVEMENT_LOG_EVERY(
+        LOG_LEVEL_DEBUG, std::chrono::seconds(10),
+        "Neighbour lists rebuilt on %llu of %llu ticks (%.1f%%), %zu entries",
+        static_cast<unsigned long long>(lists.build_count()),
+        static_cast<unsigned long long>(system.last_tick.tick),
+        100.0 * static_cast<double>(lists.build_count()) /
+            static_cast<double>(system.last_tick.tick),
+        lists.size());
+  }
+
+  const auto hash_interval = system.configuration.hash_interval;
+  system.last_tick.state_hash = 0;
+  if (hash_interval > 0 && system.last_tick.tick % hash_interval == 0) {
+    MOVEMENT_PROFILE_PHASE(system.profiler, Profiling::Phase::kHash);
+    system.last_tick.state_hash = HashBoidState(system.pool, boids);
+    MOVEMENT_LOG(LOG_LEVEL_INFO, "Tick %llu state hash %016llx (%zu boids)",
+                 static_cast<unsigned long long>(system.last_tick.tick),
+                 static_cast<unsigned long long>(system.last_tick.state_hash),
+                 boids.size());
+  }
+
+  MOVEMENT_PROFILE_PHASE(system.profiler, Profiling::Phase::kStore);
+  const std::vector<uint8_t> *changes = nullptr;
+  uint64_t suppressed = 0;
+  if (configuration.delta_updates) {
+    // Without kept state the batch was fetched from what was last sent, so
+    // anything held back would be lost; only exact repeats are
+    const auto filter = keep_owned ? configuration.delta_filter : DeltaFilter{};
+    suppressed =
+        FilterUnchanged(system.pool, filter, boids, *sent, system.changes);
+    changes = &system.changes;
+  }
+  auto &statistics = system.last_tick;
+  statistics.component_updates += 2 * boids.size() - suppressed;
+  statistics.suppressed_component_updates += suppressed;
+  if (configuration.delta_updates) {
+    const auto total =
+        statistics.component_updates + statistics.suppressed_component_updates;
+    MOVEMENT_LOG_EVERY(
+        LOG_LEVEL_DEBUG, std::chrono::seconds(10),
+        "Held back %llu of %llu component updates (%.1f%%) as unchanged",
+        static_cast<unsigned long long>(statistics.suppressed_component_updates),
+        static_cast<unsigned long long>(total),
+        total > 0 ? 100.0 *
+                        static_cast<double>(
+                            statistics.suppressed_component_updates) /
+                        static_cast<double>(total)
+                  : 0.0);
+  }
+  const auto rc = StoreBoids(store_iterator, boids, changes,
+                             &system.bulk_access);
+  owned.valid = keep_owned && rc == SYSTEM_STATUS_CODE_SUCCESS;
+  return rc;
+}
+
+// Logs the mean phase timings over the last summary interval, if one has just
+// completed
+inline void LogProfileSummary(const MovementSystem &system) {
+  const auto interval = system.configuration.profile_summary_interval;
+  const auto &profiler = system.profiler;
+  if (!profiler.enabled() || interval == 0 ||
+      profiler.recorded() % interval != 0) {
+    return;
+  }
+  const auto summary = profiler.Summarise(interval);
+  char phases[256];
+  std::size_t length = 0;
+  for (std::size_t phase = 0;
+       phase < Profiling::kPhaseCount && length < sizeof(phases); ++phase) {
+    const int written = std::snprintf(
+        phases + length, sizeof(phases) - length, "%s%s %.3f",
+        phase > 0 ? ", " : "",
+        Profiling::ToString(static_cast<Profiling::Phase>(phase)),
+        summary.mean_phase_ms[phase]);
+    length += written > 0 ? static_cast<std::size_t>(written) : 0;
+  }
+  MOVEMENT_LOG(LOG_LEVEL_INFO,
+               "Tick profile over %zu ticks: mean %.3f ms, max %.3f ms (%s ms)",
+               summary.ticks, summary.mean_tick_ms, summary.max_tick_ms,
+               phases);
+}
+
+// Records the tick in the metrics registry, and writes the metrics file if it
+// is due. The file is small, so writing it on the tick thread costs well
+// under a millisecond every few seconds.
+inline void RecordMetrics(MovementSystem &system,
+                          std::chrono::steady_clock::time_point start,
+                          uint32_t ticks_fired, System_StatusCode rc) {
+  const auto now = std::chrono::steady_clock::now();
+  auto &registry = Metrics::DefaultRegistry();
+  const auto &tick = system.last_tick;
+  registry.RecordTick(Metrics::TickSample{
+      std::chrono::duration<double>(now - start).count(), tick.boid_count,
+      tick.neighbour_count, ticks_fired, rc, tick.component_updates,
+      tick.suppressed_component_updates});
+
+  const auto &configuration = system.configuration;
+  if (configuration.metrics_path.empty() ||
+      now - system.metrics_written <
+          std::chrono::duration<double>(
+              configuration.metrics_interval_seconds)) {
+    return;
+  }
+  system.metrics_written = now;
+  if (!Metrics::WriteTextFile(registry, configuration.metrics_path)) {
+    MOVEMENT_LOG_EVERY(LOG_LEVEL_WARN, std::chrono::minutes(1),
+                       "Failed to write metrics to %s",
+                       configuration.metrics_path.c_str());
+  }
+}
+
+// The callback that fires every system tick. Messages logged during the tick,
+// from any thread, are sent to the runtime in one batch once it is done.
+inline System_StatusCode TickCallback(System_Handle system_handle,
+                                      System_EntityIterator entity_iterator,
+                                      void *user_context,
+                                      uint32_t ticks_fired) {
+  auto &system = *static_cast<MovementSystem *>(user_context);
+  const auto start = std::chrono::steady_clock::now();
+  system.profiler.BeginTick(system.last_tick.tick + 1);
+  const auto rc = Tick(system, entity_iterator, ticks_fired);
+  {
+    MOVEMENT_PROFILE_PHASE(system.profiler, Profiling::Phase::kLogFlush);
+    Logging::DefaultLogger().Flush(system_handle);
+  }
+  if (rc == SYSTEM_STATUS_CODE_SUCCESS) {
+    const auto &tick = system.last_tick;
+    system.profiler.EndTick(Profiling::TickCounters{
+        tick.boid_count, tick.neighbour_count, tick.substeps,
+        tick.neighbour_lists_rebuilt});
+    // Sent with the next tick's messages
+    LogProfileSummary(system);
+  }
+  RecordMetrics(system, start, ticks_fired, rc);
+  return rc;
+}
+
+} // namespace Movement
+
+#endif // MOVEMENT_SYSTEM_H
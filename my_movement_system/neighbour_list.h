@@ -0,0 +1,196 @@
+#ifndef NEIGHBOUR_LIST_H
+#define NEIGHBOUR_LIST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "boid_state.h"
+#include "spatial_grid.h"
+#include "thread_pool.h"
+
+namespace Spatial {
+
+// Verlet neighbour lists. Each subject's list holds every candidate within
+// `radius + skin` of it when the lists were built. Until some subject or
+// candidate has moved more than half the skin, any pair now within `radius`
+// was within `radius + skin` at the build, so the lists still hold every
+// neighbour and no spatial search is needed. Slow flocks rebuild once every
+// `skin / (2 * speed)` ticks or so.
+//
+// Subjects and candidates are matched to their build-time positions by row,
+// so both must arrive in the same order every tick. A boid replaced by
+// another at the same row almost always shows up as a large move and
+// triggers a rebuild, as does any change in either count.
+class VerletLists {
+public:
+  // Rows per chunk handed to a worker while building or checking the lists
+  static constexpr std::size_t kGrain = 1024;
+
+  // A skin of 0 disables the lists
+  VerletLists(double radius, double skin)
+      : radius_(radius), skin_(skin),
+        list_radius_sq_((radius + skin) * (radius + skin)),
+        limit_sq_(0.25 * skin * skin) {}
+
+  bool enabled() const { return skin_ > 0; }
+  double radius() const { return radius_; }
+  double skin() const { return skin_; }
+  // The radius the lists are built with, and so the grid cell size to use
+  double list_radius() const { return radius_ + skin_; }
+
+  // Whether the lists built last still hold every neighbour of every subject
+  // within `radius`, for subjects and candidates in their gathered order
+  bool Covers(Threading::ThreadPool &pool, const Boids::BoidState &subjects,
+              const Boids::BoidState &candidates) const {
+    if (!built_ || subjects.size() != subject_positions_.size() ||
+        candidates.size() != candidate_positions_.size()) {
+      return false;
+    }
+    return !subject_positions_.MovedFarther(pool, subjects, limit_sq_) &&
+           !candidate_positions_.MovedFarther(pool, candidates, limit_sq_);
+  }
+
+  // Rebuilds every subject's list. `candidates` are in gathered order, and
+  // `sorted` is them permuted by the order of `grid`, which was built over
+  // them with cells of `list_radius()`. The lists index rows of `sorted`.
+  void Build(Threading::ThreadPool &pool, const Boids::BoidState &subjects,
+             const Boids::BoidState &candidates, const UniformGrid &grid,
+             const Boids::BoidState &sorted) {
+    subject_positions_.Assign(subjects);
+    candidate_positions_.Assign(candidates);
+    order_.assign(grid.order(), grid.order() + grid.size());
+
+    // Count each subject's neighbours, then fill the lists in a second pass
+    // over the same cells, so subjects can be processed in parallel
+    offsets_.resize(subjects.size() + 1);
+    offsets_[0] = 0;
+    pool.ParallelFor(subjects.size(), kGrain,
+                     [&](std::size_t begin, std::size_t end) {
+                       for (std::size_t i = begin; i < end; ++i) {
+                         std::size_t count = 0;
+                         ForEachNeighbour(subjects, i, grid, sorted,
+                                          [&](std::size_t) { ++count; });
+                         offsets_[i + 1] = count;
+                       }
+                     });
+    for (std::size_t i = 0; i < subjects.size(); ++i) {
+      offsets_[i + 1] += offsets_[i];
+    }
+    rows_.resize(offsets_.back());
+    pool.ParallelFor(subjects.size(), kGrain,
+                     [&](std::size_t begin, std::size_t end) {
+                       for (std::size_t i = begin; i < end; ++i) {
+                         auto *out = rows_.data() + offsets_[i];
+                         ForEachNeighbour(subjects, i, grid, sorted,
+                                          [&](std::size_t row) {
+                                            *out++ =
+                                                static_cast<std::uint32_t>(row);
+                                          });
+                       }
+                     });
+    built_ = true;
+    ++build_count_;
+  }
+
+  // The grid order at the last build: the gathered row of each sorted row.
+  // Permute each tick's candidates with it to keep the lists' rows valid.
+  const std::uint32_t *order() const { return order_.data(); }
+
+  // Subject i's neighbours, as rows of the sorted candidates in ascending
+  // cell order
+  const std::uint32_t *neighbours(std::size_t i) const {
+    return rows_.data() + offsets_[i];
+  }
+  std::size_t neighbour_count(std::size_t i) const {
+    return offsets_[i + 1] - offsets_[i];
+  }
+
+  // Entries across all lists
+  std::size_t size() const { return rows_.size(); }
+  // Builds since construction
+  std::uint64_t build_count() const { return build_count_; }
+
+private:
+  // Positions of a set of boids, by row, as of the last build
+  struct Positions {
+    Boids::Column<double> x;
+    Boids::Column<double> y;
+    Boids::Column<double> z;
+
+    std::size_t size() const { return x.size(); }
+
+    void Assign(const Boids::BoidState &boids) {
+      x.assign(boids.position_x.begin(), boids.position_x.end());
+      y.assign(boids.position_y.begin(), boids.position_y.end());
+      z.assign(boids.position_z.begin(), boids.position_z.end());
+    }
+
+    // Whether any boid is more than sqrt(limit_sq) from where it was
+    bool MovedFarther(Threading::ThreadPool &pool,
+                      const Boids::BoidState &boids, double limit_sq) const {
+      std::atomic<bool> moved{false};
+      pool.ParallelFor(
+          boids.size(), kGrain, [&](std::size_t begin, std::size_t end) {
+            if (moved.load(std::memory_order_relaxed)) {
+              return;
+            }
+            double max_sq = 0;
+            for (std::size_t i = begin; i < end; ++i) {
+              const double dx = boids.position_x[i] - x[i];
+              const double dy = boids.position_y[i] - y[i];
+              const double dz = boids.position_z[i] - z[i];
+              max_sq = std::max(max_sq, (dx * dx + dy * dy) + dz * dz);
+            }
+            if (!(max_sq <= limit_sq)) {
+              moved.store(true, std::memory_order_relaxed);
+            }
+          });
+      return moved.load(std::memory_order_relaxed);
+    }
+  };
+
+  // Calls `visit(row)` for each sorted row within the list radius of subject
+  // i, in ascending row order within each grid range
+  template <typename Visitor>
+  void ForEachNeighbour(const Boids::BoidState &subjects, std::size_t i,
+                        const UniformGrid &grid,
+                        const Boids::BoidState &sorted,
+                        Visitor &&visit) const {
+    const double x = subjects.position_x[i];
+    const double y = subjects.position_y[i];
+    const double z = subjects.position_z[i];
+    grid.ForEachCandidateRange(
+        x, y, z, list_radius(), [&](std::size_t begin, std::size_t end) {
+          for (std::size_t row = begin; row < end; ++row) {
+            const double dx = sorted.position_x[row] - x;
+            const double dy = sorted.position_y[row] - y;
+            const double dz = sorted.position_z[row] - z;
+            if ((dx * dx + dy * dy) + dz * dz <= list_radius_sq_) {
+              visit(row);
+            }
+          }
+        });
+  }
+
+  double radius_;
+  double skin_;
+  double list_radius_sq_;
+  // (skin / 2)^2, the squared displacement that invalidates the lists
+  double limit_sq_;
+  bool built_ = false;
+  std::uint64_t build_count_ = 0;
+
+  Positions subject_positions_;
+  Positions candidate_positions_;
+  std::vector<std::uint32_t> order_;
+  // Subject i's list is rows_[offsets_[i], offsets_[i + 1])
+  std::vector<std::size_t> offsets_;
+  std::vector<std::uint32_t> rows_;
+};
+
+} // namespace Spatial
+
+#endif // NEIGHBOUR_LIST_H
@@ -1,30 +1,180 @@
 #ifndef RANDOM_H
 #define RANDOM_H
 
-#include <random>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <type_traits>
 
-// Magic to infer Integer/Real distribution from the type parameter
-// https://stackoverflow.com/a/55275707/14789685
-template <class T>
-using uniform_distribution = typename std::conditional<
-    std::is_floating_point<T>::value, std::uniform_real_distribution<T>,
-    typename std::conditional<std::is_integral<T>::value,
-                              std::uniform_int_distribution<T>,
-                              void>::type>::type;
-
+// Deterministic random numbers for the simulation. Everything derives from a
+// 64-bit simulation seed, so a run can be repeated exactly.
+//
+// There are two kinds of generator:
+// * Xoshiro256, a small, fast sequential engine. Give each fixed piece of
+//   work its own stream of it, numbered by the work rather than by the
+//   thread that happens to run it.
+// * CounterRng, which maps (seed, stream, counter) straight to a number with
+//   no state at all. Use it where the number belongs to something with an
+//   index, such as boid i on tick t, so it does not depend on which thread
+//   draws it or in what order.
 namespace Random {
 
-std::mt19937_64 &getEngine() {
+// SplitMix64's output function: a bijective mix of all 64 bits, so counters
+// that differ in one bit give unrelated outputs
+inline constexpr std::uint64_t Mix(std::uint64_t value) {
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9u;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EBu;
+  return value ^ (value >> 31);
+}
+
+// Spreads consecutive seeds or stream numbers over the whole state space
+constexpr std::uint64_t kGoldenGamma = 0x9E3779B97F4A7C15u;
+
+// Sebastiano Vigna's SplitMix64. Good enough on its own for seeding, and used
+// here to expand one 64-bit seed into a larger generator state.
+class SplitMix64 {
+public:
+  using result_type = std::uint64_t;
+
+  explicit constexpr SplitMix64(std::uint64_t seed) : state_(seed) {}
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  constexpr result_type operator()() { return Mix(state_ += kGoldenGamma); }
+
+private:
+  std::uint64_t state_;
+};
+
+// Blackman and Vigna's xoshiro256**: 256 bits of state, period 2^256 - 1,
+// and a handful of shifts and multiplies per number. Satisfies
+// UniformRandomBitGenerator, so it also drives <random> distributions.
+class Xoshiro256 {
+public:
+  using result_type = std::uint64_t;
+
+  // Stream `stream` of the sequence picked by `seed`. Distinct streams are
+  // seeded from distinct SplitMix64 sequences, so they do not overlap in
+  // practice.
+  explicit Xoshiro256(std::uint64_t seed, std::uint64_t stream = 0) {
+    SplitMix64 seeder(Mix(seed) ^ Mix(stream * kGoldenGamma + 1));
+    for (auto &word : state_) {
+      word = seeder();
+    }
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  result_type operator()() {
+    const std::uint64_t result = RotateLeft(state_[1] * 5, 7) * 9;
+    const std::uint64_t t = state_[1] << 17;
+    state_[2] ^= state_[0];
+    state_[3] ^= state_[1];
+    state_[1] ^= state_[2];
+    state_[0] ^= state_[3];
+    state_[2] ^= t;
+    state_[3] = RotateLeft(state_[3], 45);
+    return result;
+  }
+
+private:
+  static constexpr std::uint64_t RotateLeft(std::uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+  }
+
+  std::uint64_t state_[4];
+};
+
+// A stateless generator: the number for a counter is a keyed hash of it.
+// Two rounds of Mix under independent keys keep neighbouring counters, the
+// usual pattern for per-boid and per-tick draws, uncorrelated.
+class CounterRng {
+public:
+  explicit constexpr CounterRng(std::uint64_t seed, std::uint64_t stream = 0)
+      : key_(Mix(seed) ^ Mix(stream * kGoldenGamma + 1)),
+        key2_(Mix(key_ + kGoldenGamma)) {}
+
+  constexpr std::uint64_t operator()(std::uint64_t counter) const {
+    return Mix(Mix(counter ^ key_) + key2_);
+  }
+
+private:
+  std::uint64_t key_;
+  std::uint64_t key2_;
+};
+
+// The top 53 bits of `bits` as a double in [0, 1)
+inline constexpr double ToUnitDouble(std::uint64_t bits) {
+  return static_cast<double>(bits >> 11) * 0x1.0p-53;
+}
+
+// A double in [min, max) from any engine
+template <typename Engine> double Uniform(Engine &engine, double min,
+                                          double max) {
+  return min + (max - min) * ToUnitDouble(engine());
+}
+
+// An integer in [min, max] from any engine, by Lemire's nearly divisionless
+// multiply-and-reject method
+template <typename Engine>
+std::uint64_t UniformInt(Engine &engine, std::uint64_t min, std::uint64_t max) {
+  const std::uint64_t range = max - min + 1;
+  if (range == 0) {
+    return engine();
+  }
+  unsigned __int128 product =
+      static_cast<unsigned __int128>(engine()) * range;
+  auto low = static_cast<std::uint64_t>(product);
+  if (low < range) {
+    const std::uint64_t threshold = (0 - range) % range;
+    while (low < threshold) {
+      product = static_cast<unsigned __int128>(engine()) * range;
+      low = static_cast<std::uint64_t>(product);
+    }
+  }
+  return min + static_cast<std::uint64_t>(product >> 64);
+}
+
+// Writes the numbers for counters [first_counter, first_counter + count),
+// scaled into [min, max), to `out`. Each element depends only on its
+// counter, so the result is the same however the range is split up.
+inline void FillUniform(const CounterRng &generator,
+                        std::uint64_t first_counter, double min, double max,
+                        double *out, std::size_t count) {
+  const double scale = max - min;
+  for (std::size_t i = 0; i < count; ++i) {
+    out[i] = min + scale * ToUnitDouble(generator(first_counter + i));
+  }
+}
 
-  static thread_local std::random_device rd;
-  static thread_local std::mt19937_64 engine(rd);
-  return engine(rd);
+// As FillUniform, but writing to every `stride`th double of `out`, for
+// filling one field of an array of structs
+inline void FillUniformStrided(const CounterRng &generator,
+                               std::uint64_t first_counter, double min,
+                               double max, double *out, std::size_t stride,
+                               std::size_t count) {
+  const double scale = max - min;
+  for (std::size_t i = 0; i < count; ++i) {
+    out[i * stride] = min + scale * ToUnitDouble(generator(first_counter + i));
+  }
 }
 
-template <typename T> T generateNumberBetween(T min, T max) {
-  uniform_distribution<T> distribution(min, max);
-  return distribution(getEngine());
+template <typename T, typename Engine>
+T generateNumberBetween(T min, T max, Engine &engine) {
+  static_assert(std::is_arithmetic<T>::value, "T must be a number");
+  if constexpr (std::is_floating_point<T>::value) {
+    return static_cast<T>(Uniform(engine, min, max));
+  } else {
+    return static_cast<T>(
+        UniformInt(engine, static_cast<std::uint64_t>(min),
+                   static_cast<std::uint64_t>(max)));
+  }
 }
 
 } // namespace Random
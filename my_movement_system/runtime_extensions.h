@@ -0,0 +1,104 @@
+#ifndef RUNTIME_EXTENSIONS_H
+#define RUNTIME_EXTENSIONS_H
+
+#include <improbable/system/c_query.h>
+#include <improbable/system/c_system.h>
+#include <improbable/system/c_system_error.h>
+
+#include <cstdint>
+
+// The System API extensions declared in system_sdk_headers are only provided
+// by runtimes that implement them, such as the local runtime. A system that
+// referenced them directly would fail to load in any other runtime, so they
+// are referenced weakly: the dynamic linker resolves a missing one to null
+// instead of refusing the system. Calls go through the wrappers below, which
+// answer as a runtime without the extension would, and the callers fall back
+// to the core API.
+#pragma weak System_GetComponentsBulk
+#pragma weak System_UpdateComponentsBulk
+#pragma weak System_Query_GetComponentsBulk
+#pragma weak System_GetEntityIndices
+#pragma weak System_Query_GetEntityIndices
+#pragma weak System_Query_CreateCompound
+
+namespace Extensions {
+
+// BULK COMPONENT ACCESS: NOT_IMPLEMENTED if the runtime does not provide it
+
+inline System_StatusCode
+GetComponentsBulk(System_EntityIterator entity_iterator,
+                  const System_ComponentColumnType *columns,
+                  uint32_t column_count, uint32_t max_entity_count,
+                  uint32_t *entity_count_out) {
+  if (!System_GetComponentsBulk) {
+    return SYSTEM_STATUS_CODE_NOT_IMPLEMENTED;
+  }
+  return System_GetComponentsBulk(entity_iterator, columns, column_count,
+                                  max_entity_count, entity_count_out);
+}
+
+inline System_StatusCode
+UpdateComponentsBulk(System_EntityIterator entity_iterator,
+                     const System_ComponentColumnType *columns,
+                     uint32_t column_count, uint32_t entity_count) {
+  if (!System_UpdateComponentsBulk) {
+    return SYSTEM_STATUS_CODE_NOT_IMPLEMENTED;
+  }
+  return System_UpdateComponentsBulk(entity_iterator, columns, column_count,
+                                     entity_count);
+}
+
+inline System_StatusCode
+QueryGetComponentsBulk(System_Query_Handle query_handle,
+                       const System_ComponentColumnType *columns,
+                       uint32_t column_count, uint32_t max_entity_count,
+                       uint32_t *entity_count_out) {
+  if (!System_Query_GetComponentsBulk) {
+    return SYSTEM_STATUS_CODE_NOT_IMPLEMENTED;
+  }
+  return System_Query_GetComponentsBulk(query_handle, columns, column_count,
+                                        max_entity_count, entity_count_out);
+}
+
+// ENTITY INDICES: NOT_IMPLEMENTED if the runtime does not provide them
+
+inline System_StatusCode
+GetEntityIndices(System_EntityIterator entity_iterator,
+                 System_EntityIndex *entity_indices_out,
+                 uint32_t max_entity_count, uint32_t *entity_count_out) {
+  if (!System_GetEntityIndices) {
+    return SYSTEM_STATUS_CODE_NOT_IMPLEMENTED;
+  }
+  return System_GetEntityIndices(entity_iterator, entity_indices_out,
+                                 max_entity_count, entity_count_out);
+}
+
+inline System_StatusCode
+QueryGetEntityIndices(System_Query_Handle query_handle,
+                      System_EntityIndex *entity_indices_out,
+                      uint32_t max_entity_count, uint32_t *entity_count_out) {
+  if (!System_Query_GetEntityIndices) {
+    return SYSTEM_STATUS_CODE_NOT_IMPLEMENTED;
+  }
+  return System_Query_GetEntityIndices(query_handle, entity_indices_out,
+                                       max_entity_count, entity_count_out);
+}
+
+// COMPOUND CONSTRAINTS: null, as for a refused query, if the runtime does not
+// provide them
+
+inline bool HasCompoundConstraints() {
+  return System_Query_CreateCompound != nullptr;
+}
+
+inline System_Query_Handle
+QueryCreateCompound(const System_Query_CompoundConstraint *constraint) {
+  if (!HasCompoundConstraints()) {
+    return nullptr;
+  }
+  return System_Query_CreateCompound(constraint);
+}
+
+} // namespace Extensions
+
+#endif // RUNTIME_EXTENSIONS_H
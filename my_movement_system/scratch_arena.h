@@ -0,0 +1,135 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+namespace Memory {
+
+// Bump allocator for storage that only lives for one tick. Allocation is a
+// pointer increment and nothing is freed individually; `Reset()` releases
+// everything at once at the start of the next tick.
+//
+// A tick that needs more than the current block chains extra blocks. The next
+// `Reset()` folds them into a single block big enough for that tick, so once
+// the arena has seen the largest tick it stops touching the heap altogether.
+//
+// The arena is not thread safe. Allocate on the tick thread and hand workers
+// pointers into the result.
+class ScratchArena {
+public:
+  static constexpr std::size_t kDefaultAlignment = 64;
+
+  explicit ScratchArena(std::size_t initial_capacity = 0) {
+    if (initial_capacity > 0) {
+      current_ = NewBlock(initial_capacity, nullptr);
+    }
+  }
+
+  ~ScratchArena() { FreeBlocks(current_); }
+
+  ScratchArena(const ScratchArena &) = delete;
+  ScratchArena &operator=(const ScratchArena &) = delete;
+
+  // Returns `bytes` of uninitialised storage aligned to `alignment`, which
+  // must be a power of two no larger than kDefaultAlignment
+  void *Allocate(std::size_t bytes, std::size_t alignment = kDefaultAlignment) {
+    if (current_) {
+      const std::size_t offset = (offset_ + alignment - 1) & ~(alignment - 1);
+      if (offset + bytes <= current_->capacity) {
+        offset_ = offset + bytes;
+        used_ += bytes;
+        ++allocation_count_;
+        return current_->data() + offset;
+      }
+    }
+
+    // Chain a block at least twice the size of the last so a growing tick
+    // only overflows a logarithmic number of times
+    const std::size_t capacity =
+        std::max(bytes, current_ ? 2 * current_->capacity : bytes);
+    current_ = NewBlock(capacity, current_);
+    offset_ = bytes;
+    used_ += bytes;
+    ++allocation_count_;
+    return current_->data();
+  }
+
+  // Uninitialised storage for `count` objects of type T. Nothing allocated
+  // from the arena is destroyed, so T must be trivially destructible.
+  template <typename T> T *AllocateArray(std::size_t count) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "Arena storage is never destroyed");
+    static_assert(alignof(T) <= kDefaultAlignment, "Alignment too large");
+    return static_cast<T *>(
+        Allocate(count * sizeof(T), std::max(alignof(T), alignof(double))));
+  }
+
+  // Releases every allocation. If the last tick chained blocks, they are
+  // replaced by one block holding everything that tick allocated.
+  void Reset() {
+    if (current_ && current_->previous) {
+      // Leave room for every allocation to be padded to the default alignment
+      const std::size_t capacity =
+          std::max(high_water_mark_, used_) +
+          allocation_count_ * kDefaultAlignment;
+      FreeBlocks(current_);
+      current_ = NewBlock(capacity, nullptr);
+    }
+    high_water_mark_ = std::max(high_water_mark_, used_);
+    offset_ = 0;
+    used_ = 0;
+    allocation_count_ = 0;
+  }
+
+  // Bytes handed out since the last reset, excluding alignment padding
+  std::size_t used() const { return used_; }
+  // The most bytes any tick has used
+  std::size_t high_water_mark() const {
+    return std::max(high_water_mark_, used_);
+  }
+  // Total bytes held in blocks
+  std::size_t capacity() const {
+    std::size_t total = 0;
+    for (const Block *block = current_; block; block = block->previous) {
+      total += block->capacity;
+    }
+    return total;
+  }
+
+private:
+  // Blocks are one heap allocation each: this header followed by the data,
+  // starting on the next default-aligned boundary
+  struct alignas(kDefaultAlignment) Block {
+    Block *previous;
+    std::size_t capacity;
+
+    std::byte *data() { return reinterpret_cast<std::byte *>(this + 1); }
+  };
+
+  Block *NewBlock(std::size_t capacity, Block *previous) {
+    void *memory = ::operator new(sizeof(Block) + capacity,
+                                  std::align_val_t{kDefaultAlignment});
+    return new (memory) Block{previous, capacity};
+  }
+
+  void FreeBlocks(Block *block) {
+    while (block) {
+      Block *previous = block->previous;
+      ::operator delete(block, std::align_val_t{kDefaultAlignment});
+      block = previous;
+    }
+  }
+
+  Block *current_ = nullptr;
+  std::size_t offset_ = 0;
+  std::size_t used_ = 0;
+  std::size_t allocation_count_ = 0;
+  std::size_t high_water_mark_ = 0;
+};
+
+} // namespace Memory
+
+#endif // SCRATCH_ARENA_H
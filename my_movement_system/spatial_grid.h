@@ -0,0 +1,218 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "scratch_arena.h"
+
+namespace Spatial {
+
+// A uniform grid over a snapshot of positions, rebuilt once per tick. Points
+// are bucketed into cubic cells with a counting sort, so a radius lookup only
+// scans the block of cells overlapping the query sphere instead of every
+// entity in the world. Its tables are allocated from a scratch arena, so a
+// grid is only valid until that arena is next reset.
+//
+// The grid is a broadphase only: it produces the cell-sorted order of the
+// points and, for a query, the ranges of that order that may hold neighbours.
+// Callers keep their data permuted into the sorted order (see `order()`) and
+// apply the exact distance test themselves.
+class UniformGrid {
+public:
+  // Upper bound on cells per indexed point; sparse worlds get coarser cells
+  // rather than a huge, mostly empty cell table.
+  static constexpr std::size_t kMaxCellsPerPoint = 4;
+  // Upper bound on cells along any one axis
+  static constexpr double kMaxCellsAlong = 1e6;
+
+  // Buckets `count` positions, given as coordinate columns, into cells with an
+  // edge of `cell_size`. Lookups are cheapest when `cell_size` matches the
+  // radius they will use.
+  void Build(const double *x, const double *y, const double *z,
+             std::size_t count, double cell_size,
+             Memory::ScratchArena &arena) {
+    count_ = count;
+    order_ = arena.AllocateArray<std::uint32_t>(count);
+    if (count == 0) {
+      cell_starts_ = arena.AllocateArray<std::uint32_t>(2);
+      cell_starts_[0] = cell_starts_[1] = 0;
+      dims_[0] = dims_[1] = dims_[2] = 1;
+      return;
+    }
+
+    double lower[3] = {x[0], y[0], z[0]};
+    double upper[3] = {x[0], y[0], z[0]};
+    for (std::size_t i = 1; i < count; ++i) {
+      lower[0] = std::min(lower[0], x[i]);
+      lower[1] = std::min(lower[1], y[i]);
+      lower[2] = std::min(lower[2], z[i]);
+      upper[0] = std::max(upper[0], x[i]);
+      upper[1] = std::max(upper[1], y[i]);
+      upper[2] = std::max(upper[2], z[i]);
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+      origin_[axis] = lower[axis];
+    }
+
+    // Grow the cells until the table fits the budget for this many points
+    const std::size_t max_cells = kMaxCellsPerPoint * count + 64;
+    for (;;) {
+      for (int axis = 0; axis < 3; ++axis) {
+        dims_[axis] = CellsAlong(upper[axis] - lower[axis], cell_size);
+      }
+      if (static_cast<std::size_t>(dims_[0]) * dims_[1] * dims_[2] <=
+          max_cells) {
+        break;
+      }
+      cell_size *= 2;
+    }
+    cell_size_ = cell_size;
+    inverse_cell_size_ = 1.0 / cell_size;
+
+    // Counting sort of the points by linear cell index
+    const std::size_t cell_count =
+        static_cast<std::size_t>(dims_[0]) * dims_[1] * dims_[2];
+    // Sized for the budget rather than this build's cells, so the arena's
+    // footprint only depends on the point count and a spreading flock does
+    // not grow it tick after tick
+    cell_starts_ = arena.AllocateArray<std::uint32_t>(max_cells + 1);
+    std::fill(cell_starts_, cell_starts_ + cell_count + 1, 0);
+    auto *point_cells = arena.AllocateArray<std::uint32_t>(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto cell = LinearCell(CellCoord(x[i], 0), CellCoord(y[i], 1),
+                                   CellCoord(z[i], 2));
+      point_cells[i] = cell;
+      ++cell_starts_[cell + 1];
+    }
+    for (std::size_t cell = 0; cell < cell_count; ++cell) {
+      cell_starts_[cell + 1] += cell_starts_[cell];
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+      order_[cell_starts_[point_cells[i]]++] = static_cast<std::uint32_t>(i);
+    }
+    // The scatter advanced every start to the next cell's start; shift back
+    for (std::size_t cell = cell_count; cell > 0; --cell) {
+      cell_starts_[cell] = cell_starts_[cell - 1];
+    }
+    cell_starts_[0] = 0;
+  }
+
+  // Calls `visit(begin, end)` for each range of sorted slots whose cells
+  // overlap the sphere of `radius` around (x, y, z). Every point within the
+  // sphere lies in exactly one range; the ranges also hold points outside it.
+  template <typename Visitor>
+  void ForEachCandidateRange(double x, double y, double z, double radius,
+                             Visitor &&visit) const {
+    ForEachCandidateRange(
+        x, y, z, radius, [](double, double, double) { return true; }, visit);
+  }
+
+  // As above, but leaves out cells for which `may_hold(cx, cy, cz)`, given
+  // the cell's centre, is false. The test must be conservative: false only
+  // if no point the caller wants can lie within `cell_radius()` of the
+  // centre. Rejected cells are trimmed from the ends of each row of the
+  // block, so the rows stay contiguous ranges.
+  template <typename CellTest, typename Visitor>
+  void ForEachCandidateRange(double x, double y, double z, double radius,
+                             CellTest &&may_hold, Visitor &&visit) const {
+    if (count_ == 0) {
+      return;
+    }
+    const int span =
+        std::max(1, static_cast<int>(std::ceil(radius * inverse_cell_size_)));
+    const int cx = CellCoord(x, 0);
+    const int cy = CellCoord(y, 1);
+    const int cz = CellCoord(z, 2);
+
+    // Cells adjacent along x are adjacent in the sorted order, so each row of
+    // the block is visited as one contiguous range
+    const int x_begin = std::max(cx - span, 0);
+    const int x_end = std::min(cx + span, dims_[0] - 1);
+    for (int cell_z = std::max(cz - span, 0);
+         cell_z <= std::min(cz + span, dims_[2] - 1); ++cell_z) {
+      const double centre_z = CellCentre(cell_z, 2);
+      for (int cell_y = std::max(cy - span, 0);
+           cell_y <= std::min(cy + span, dims_[1] - 1); ++cell_y) {
+        const double centre_y = CellCentre(cell_y, 1);
+        int first = x_begin;
+        int last = x_end;
+        while (first <= last &&
+               !may_hold(CellCentre(first, 0), centre_y, centre_z)) {
+          ++first;
+        }
+        while (last > first &&
+               !may_hold(CellCentre(last, 0), centre_y, centre_z)) {
+          --last;
+        }
+        if (first > last) {
+          continue;
+        }
+        const auto begin = cell_starts_[LinearCell(first, cell_y, cell_z)];
+        const auto end = cell_starts_[LinearCell(last, cell_y, cell_z) + 1];
+        if (begin != end) {
+          visit(static_cast<std::size_t>(begin), static_cast<std::size_t>(end));
+        }
+      }
+    }
+  }
+
+  // The cell-sorted order of the points: slot i holds build-time point
+  // `order()[i]`
+  const std::uint32_t *order() const { return order_; }
+
+  std::size_t size() const { return count_; }
+  double cell_size() const { return cell_size_; }
+  // Radius of the ball around a cell's centre that contains the whole cell
+  double cell_radius() const { return 0.5 * std::sqrt(3.0) * cell_size_; }
+
+private:
+  // Cells along an axis, capped as the runtime's position grid is so that a
+  // distant outlier cannot overflow the count; the cell size grows until the
+  // table fits anyway. An infinite or NaN extent gets a single cell.
+  static int CellsAlong(double extent, double cell_size) {
+    const double cells = std::floor(extent / cell_size);
+    if (!std::isfinite(cells)) {
+      return 1;
+    }
+    return static_cast<int>(std::min(cells, kMaxCellsAlong)) + 1;
+  }
+
+  // Cell coordinate of `value` along `axis`, clamped so that positions
+  // outside the built bounds still map to the nearest edge cell. NaNs map
+  // to the first cell; they are never anyone's neighbour.
+  int CellCoord(double value, int axis) const {
+    const double cell =
+        std::floor((value - origin_[axis]) * inverse_cell_size_);
+    if (!(cell >= 0)) {
+      return 0;
+    }
+    return static_cast<int>(
+        std::min(cell, static_cast<double>(dims_[axis] - 1)));
+  }
+
+  double CellCentre(int cell, int axis) const {
+    return origin_[axis] + (cell + 0.5) * cell_size_;
+  }
+
+  std::uint32_t LinearCell(int x, int y, int z) const {
+    return static_cast<std::uint32_t>(x + dims_[0] * (y + dims_[1] * z));
+  }
+
+  double origin_[3] = {0, 0, 0};
+  double cell_size_ = 1;
+  double inverse_cell_size_ = 1;
+  int dims_[3] = {1, 1, 1};
+  std::size_t count_ = 0;
+
+  // Offsets into the sorted order; cell c holds slots [cell_starts_[c],
+  // cell_starts_[c + 1])
+  std::uint32_t *cell_starts_ = nullptr;
+  std::uint32_t *order_ = nullptr;
+};
+
+} // namespace Spatial
+
+#endif // SPATIAL_GRID_H
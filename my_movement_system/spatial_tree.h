@@ -0,0 +1,299 @@
+#ifndef SPATIAL_TREE_H
+#define SPATIAL_TREE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace Spatial {
+
+// A bounding volume hierarchy over a snapshot of positions. Each node splits
+// its points at the median of its widest axis, so the tree follows the
+// points wherever they are: a dense cluster gets deep, small boxes and the
+// empty space around it costs nothing, where a uniform grid sizes its cells
+// for the world and pays for every empty one. Leaves hold at least half of
+// `leaf_size` points and at most `leaf_size`, so a tree over n points has
+// fewer than 4n / leaf_size nodes.
+//
+// Like UniformGrid, the tree is a broadphase over the points' sorted order:
+// every node's points are a contiguous run of `order()`, and callers keep
+// their data permuted into that order. Its storage is kept between builds,
+// so rebuilding over a steady number of points does not allocate.
+//
+// A tree can be refit to new positions of the same points instead of
+// rebuilt. Refitting recomputes every box from the points it holds, so
+// lookups stay exact, but the split no longer follows the points, and the
+// boxes of a moving flock grow and overlap until the next build.
+//
+// A NaN coordinate is no position: it sorts after every number and stays
+// out of the boxes, so such a point is never a candidate nor a neighbour.
+class BoundingVolumeTree {
+public:
+  static constexpr std::size_t kDefaultLeafSize = 32;
+
+  // Builds the tree over `count` positions, given as coordinate columns
+  void Build(const double *x, const double *y, const double *z,
+             std::size_t count, std::size_t leaf_size = kDefaultLeafSize) {
+    leaf_size_ = std::max<std::size_t>(leaf_size, 1);
+    order_.resize(count);
+    std::iota(order_.begin(), order_.end(), 0u);
+    nodes_.clear();
+    if (count == 0) {
+      return;
+    }
+    nodes_.reserve(4 * count / leaf_size_ + 1);
+    const double *columns[3] = {x, y, z};
+    BuildNode(columns, 0, static_cast<std::uint32_t>(count));
+  }
+
+  // Recomputes every box from the positions the build-time points now hold,
+  // keeping the tree's shape. The points must be the ones it was built over.
+  void Refit(const double *x, const double *y, const double *z) {
+    // Children follow their parents, so a reverse sweep sees them first
+    for (std::size_t index = nodes_.size(); index-- > 0;) {
+      auto &node = nodes_[index];
+      if (node.right == 0) {
+        FitLeaf(x, y, z, node);
+        continue;
+      }
+      const auto &left = nodes_[index + 1];
+      const auto &right = nodes_[node.right];
+      for (int axis = 0; axis < 3; ++axis) {
+        node.lower[axis] = std::min(left.lower[axis], right.lower[axis]);
+        node.upper[axis] = std::max(left.upper[axis], right.upper[axis]);
+      }
+    }
+  }
+
+  // Calls `visit(begin, end)` for each range of sorted slots whose leaves
+  // overlap the sphere of `radius` around (x, y, z). Every point within the
+  // sphere lies in exactly one range; the ranges also hold points outside
+  // it. A node wholly inside the sphere is visited without descending into
+  // it, and neighbouring nodes that are both visited make one range, so a
+  // dense cluster costs a few ranges however many leaves it spans.
+  template <typename Visitor>
+  void ForEachCandidateRange(double x, double y, double z, double radius,
+                             Visitor &&visit) const {
+    if (nodes_.empty()) {
+      return;
+    }
+    const double radius_sq = radius * radius;
+    std::uint32_t range_begin = 0;
+    std::uint32_t range_end = 0;
+    const auto add = [&](const Node &node) {
+      if (node.begin != range_end) {
+        if (range_begin != range_end) {
+          visit(static_cast<std::size_t>(range_begin),
+                static_cast<std::size_t>(range_end));
+        }
+        range_begin = node.begin;
+      }
+      range_end = node.end;
+    };
+    // Nodes on the stack overlap the sphere, and are visited left to right,
+    // in slot order
+    std::uint32_t stack[kMaxDepth];
+    std::size_t depth = 0;
+    if (DistanceSq(nodes_[0], x, y, z) <= radius_sq) {
+      stack[depth++] = 0;
+    }
+    while (depth > 0) {
+      const auto index = stack[--depth];
+      const auto &node = nodes_[index];
+      if (node.right == 0 || FarthestSq(node, x, y, z) <= radius_sq) {
+        add(node);
+        continue;
+      }
+      if (DistanceSq(nodes_[node.right], x, y, z) <= radius_sq) {
+        stack[depth++] = node.right;
+      }
+      if (DistanceSq(nodes_[index + 1], x, y, z) <= radius_sq) {
+        stack[depth++] = index + 1;
+      }
+    }
+    if (range_begin != range_end) {
+      visit(static_cast<std::size_t>(range_begin),
+            static_cast<std::size_t>(range_end));
+    }
+  }
+
+  // Finds the up to `k` points nearest to (x, y, z) and within `radius` of
+  // it, given the points' coordinates in sorted order. Writes their slots
+  // and squared distances, nearest first, to `slots` and `distances_sq`,
+  // which must have room for `k`, and returns how many were found. Points
+  // at the same distance are kept in slot order.
+  std::size_t KNearest(const double *sorted_x, const double *sorted_y,
+                       const double *sorted_z, double x, double y, double z,
+                       std::size_t k, double radius, std::uint32_t *slots,
+                       double *distances_sq) const {
+    if (nodes_.empty() || k == 0) {
+      return 0;
+    }
+    std::size_t found = 0;
+    const auto bound_sq = [&] {
+      return found < k ? radius * radius : distances_sq[k - 1];
+    };
+    std::uint32_t stack[kMaxDepth];
+    std::size_t depth = 0;
+    stack[depth++] = 0;
+    while (depth > 0) {
+      const auto index = stack[--depth];
+      const auto &node = nodes_[index];
+      if (DistanceSq(node, x, y, z) > bound_sq()) {
+        continue;
+      }
+      if (node.right != 0) {
+        // Descend into the nearer child first, so the bound tightens early
+        const auto left = index + 1;
+        const bool left_first = DistanceSq(nodes_[left], x, y, z) <=
+                                DistanceSq(nodes_[node.right], x, y, z);
+        stack[depth++] = left_first ? node.right : left;
+        stack[depth++] = left_first ? left : node.right;
+        continue;
+      }
+      for (auto slot = node.begin; slot < node.end; ++slot) {
+        const double dx = sorted_x[slot] - x;
+        const double dy = sorted_y[slot] - y;
+        const double dz = sorted_z[slot] - z;
+        const double distance_sq = dx * dx + dy * dy + dz * dz;
+        if (!(distance_sq <= bound_sq()) ||
+            (found == k && distance_sq == distances_sq[k - 1] &&
+             slot > slots[k - 1])) {
+          continue;
+        }
+        // Insertion into the short sorted list of the nearest so far
+        std::size_t at = found < k ? found++ : k - 1;
+        while (at > 0 && (distances_sq[at - 1] > distance_sq ||
+                          (distances_sq[at - 1] == distance_sq &&
+                           slots[at - 1] > slot))) {
+          distances_sq[at] = distances_sq[at - 1];
+          slots[at] = slots[at - 1];
+          --at;
+        }
+        distances_sq[at] = distance_sq;
+        slots[at] = slot;
+      }
+    }
+    return found;
+  }
+
+  // The tree-sorted order of the points: slot i holds build-time point
+  // `order()[i]`
+  const std::uint32_t *order() const { return order_.data(); }
+
+  std::size_t size() const { return order_.size(); }
+  std::size_t node_count() const { return nodes_.size(); }
+  // Bytes of storage the tree holds on to
+  std::size_t memory_bytes() const {
+    return nodes_.capacity() * sizeof(Node) +
+           order_.capacity() * sizeof(std::uint32_t);
+  }
+
+private:
+  // Median splits halve every node, so no path from the root is longer than
+  // the bits of a 32-bit slot, and a traversal stack holds at most one
+  // pending sibling per level
+  static constexpr std::size_t kMaxDepth = 64;
+
+  struct Node {
+    double lower[3];
+    double upper[3];
+    // Slots of the sorted order the node holds
+    std::uint32_t begin;
+    std::uint32_t end;
+    // The right child; the left child is the next node. 0 for a leaf, as the
+    // root is no node's child.
+    std::uint32_t right;
+  };
+
+  static double DistanceSq(const Node &node, double x, double y, double z) {
+    const double point[3] = {x, y, z};
+    double distance_sq = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+      // At most one side is outside, unless the box is empty and its
+      // distance infinite
+      const double outside = std::max(node.lower[axis] - point[axis], 0.0) +
+                             std::max(point[axis] - node.upper[axis], 0.0);
+      distance_sq += outside * outside;
+    }
+    return distance_sq;
+  }
+
+  // Squared distance from the point to the farthest corner of the node
+  static double FarthestSq(const Node &node, double x, double y, double z) {
+    const double point[3] = {x, y, z};
+    double distance_sq = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+      const double farthest = std::max(point[axis] - node.lower[axis],
+                                       node.upper[axis] - point[axis]);
+      distance_sq += farthest * farthest;
+    }
+    return distance_sq;
+  }
+
+  void FitLeaf(const double *x, const double *y, const double *z,
+               Node &node) const {
+    const double *columns[3] = {x, y, z};
+    for (int axis = 0; axis < 3; ++axis) {
+      const double *column = columns[axis];
+      // NaNs fail both comparisons; a leaf of nothing else has an empty box
+      double lower = HUGE_VAL;
+      double upper = -HUGE_VAL;
+      for (auto slot = node.begin; slot < node.end; ++slot) {
+        const double value = column[order_[slot]];
+        if (value < lower) {
+          lower = value;
+        }
+        if (value > upper) {
+          upper = value;
+        }
+      }
+      node.lower[axis] = lower;
+      node.upper[axis] = upper;
+    }
+  }
+
+  // Builds the subtree over slots [begin, end); returns its root
+  std::uint32_t BuildNode(const double *const *columns, std::uint32_t begin,
+                          std::uint32_t end) {
+    const auto index = static_cast<std::uint32_t>(nodes_.size());
+    nodes_.push_back(Node{{0, 0, 0}, {0, 0, 0}, begin, end, 0});
+    FitLeaf(columns[0], columns[1], columns[2], nodes_[index]);
+    if (end - begin <= leaf_size_) {
+      return index;
+    }
+
+    int widest = 0;
+    for (int axis = 1; axis < 3; ++axis) {
+      const auto &node = nodes_[index];
+      if (node.upper[axis] - node.lower[axis] >
+          node.upper[widest] - node.lower[widest]) {
+        widest = axis;
+      }
+    }
+    const double *column = columns[widest];
+    const auto middle = begin + (end - begin) / 2;
+    std::nth_element(order_.begin() + begin, order_.begin() + middle,
+                     order_.begin() + end,
+                     [column](std::uint32_t a, std::uint32_t b) {
+                       return column[a] < column[b] ||
+                              (std::isnan(column[b]) && !std::isnan(column[a]));
+                     });
+    BuildNode(columns, begin, middle);
+    const auto right = BuildNode(columns, middle, end);
+    nodes_[index].right = right;
+    return index;
+  }
+
+  std::size_t leaf_size_ = kDefaultLeafSize;
+  // Nodes in depth-first order, root first
+  std::vector<Node> nodes_;
+  std::vector<std::uint32_t> order_;
+};
+
+} // namespace Spatial
+
+#endif // SPATIAL_TREE_H
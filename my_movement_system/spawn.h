@@ -0,0 +1,401 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <improbable/standard_library.h>
+#include <improbable/system/c_system.h>
+#include <improbable/system/c_system_error.h>
+#include <myschema.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "component_access.h"
+#include "random.h"
+#include "thread_pool.h"
+
+// Populates the world with boids. Component buffers for the whole population
+// are generated up front, in parallel, and then submitted to the runtime in a
+// single pass of entity creations.
+namespace Spawn {
+
+enum class Layout {
+  // Rows and columns `spacing` apart, starting at the origin
+  kGrid,
+  // Independently and uniformly distributed over the world bounds
+  kUniform,
+  // Normally distributed around a number of uniformly placed centres
+  kClustered,
+  // Uniform, but no two boids closer than a minimum distance
+  kPoissonDisc,
+};
+
+inline const char *ToString(Layout layout) {
+  switch (layout) {
+  case Layout::kGrid:
+    return "grid";
+  case Layout::kUniform:
+    return "uniform";
+  case Layout::kClustered:
+    return "clustered";
+  case Layout::kPoissonDisc:
+    return "poisson";
+  }
+  return "unknown";
+}
+
+// Parses a layout name as returned by ToString. Returns false if the name is
+// not a layout.
+inline bool ParseLayout(const char *name, Layout *layout) {
+  for (const auto candidate : {Layout::kGrid, Layout::kUniform,
+                               Layout::kClustered, Layout::kPoissonDisc}) {
+    if (std::string_view(name) == ToString(candidate)) {
+      *layout = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+// The extent of the world along x and z, as in the simulation configuration's
+// `world_bounds`. The world is centred on the origin; boids spawn at y = 0.
+struct WorldBounds {
+  double x = 99;
+  double z = 99;
+};
+
+struct Parameters {
+  Layout layout = Layout::kGrid;
+  std::size_t entity_count = 0;
+  WorldBounds world_bounds;
+  // Picks the population; the same seed gives the same boids whatever the
+  // thread count
+  std::uint64_t seed = 0;
+
+  // kGrid: distance between neighbouring rows and columns
+  double spacing = 1;
+  // kClustered: number of cluster centres, and the standard deviation of the
+  // boids' distance from theirs
+  std::size_t cluster_count = 16;
+  double cluster_radius = 2;
+
+  // Each velocity component along x and z is drawn from this range
+  double min_velocity = 0.1;
+  double max_velocity = 0.2;
+  double acceleration = 0.1;
+};
+
+// The initial components of every boid; index i of each buffer belongs to
+// the same boid
+struct Buffers {
+  std::vector<Position> positions;
+  std::vector<Velocity> velocities;
+  std::vector<Acceleration> accelerations;
+
+  std::size_t size() const { return positions.size(); }
+};
+
+namespace Internal {
+
+// Boids per generation task. Each task draws from its own random stream, so
+// the result does not depend on how tasks are spread over threads.
+constexpr std::size_t kBlockSize = 4096;
+
+// Random streams: positions use stream `block` (or `tile`), whole-population
+// choices such as cluster centres kSharedStream, and velocity components are
+// drawn per boid from the counter-based kVelocity*Stream
+constexpr std::uint64_t kSharedStream = std::uint64_t{1} << 40;
+constexpr std::uint64_t kVelocityXStream = kSharedStream + 1;
+constexpr std::uint64_t kVelocityZStream = kSharedStream + 2;
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Fraction of the world's area the Poisson-disc layout covers with each
+// boid's exclusion disc (of radius min_distance / 2). Random sequential
+// addition jams at about 0.55; staying well below keeps dart throwing quick.
+constexpr double kPoissonDiscCoverage = 0.35;
+// Darts thrown per boid a tile still needs before the tile gives up
+constexpr std::size_t kPoissonDiscAttempts = 64;
+// Tile edge in acceleration-grid cells
+constexpr int kPoissonDiscTileCells = 32;
+
+inline double Clamp(double value, double extent) {
+  return std::clamp(value, -extent / 2, extent / 2);
+}
+
+inline void FillPositions(const Parameters &parameters,
+                          Threading::ThreadPool &pool, Buffers &buffers) {
+  const auto &bounds = parameters.world_bounds;
+  const std::size_t count = parameters.entity_count;
+  const std::size_t blocks = (count + kBlockSize - 1) / kBlockSize;
+
+  std::vector<Coordinates> centres(
+      std::max<std::size_t>(1, parameters.cluster_count));
+  if (parameters.layout == Layout::kClustered) {
+    Random::Xoshiro256 engine(parameters.seed, kSharedStream);
+    for (auto &centre : centres) {
+      centre = Coordinates{
+          Random::generateNumberBetween(-bounds.x / 2, bounds.x / 2, engine),
+          0,
+          Random::generateNumberBetween(-bounds.z / 2, bounds.z / 2, engine)};
+    }
+  }
+
+  const auto side_length =
+      std::max<std::size_t>(1, static_cast<std::size_t>(std::sqrt(count)));
+  pool.ParallelFor(blocks, 1, [&](std::size_t block_begin,
+                                  std::size_t block_end) {
+    for (std::size_t block = block_begin; block < block_end; ++block) {
+      Random::Xoshiro256 engine(parameters.seed, block);
+      std::normal_distribution<double> offset(0, parameters.cluster_radius);
+      const std::size_t end = std::min(count, (block + 1) * kBlockSize);
+      for (std::size_t i = block * kBlockSize; i < end; ++i) {
+        auto &coords = buffers.positions[i].coords;
+        switch (parameters.layout) {
+        case Layout::kGrid:
+          coords = Coordinates{
+              static_cast<double>(i / side_length) * parameters.spacing, 0,
+              static_cast<double>(i % side_length) * parameters.spacing};
+          break;
+        case Layout::kUniform:
+          coords = Coordinates{
+              Random::generateNumberBetween(-bounds.x / 2, bounds.x / 2,
+                                            engine),
+              0,
+              Random::generateNumberBetween(-bounds.z / 2, bounds.z / 2,
+                                            engine)};
+          break;
+        case Layout::kClustered: {
+          const auto &centre = centres[Random::generateNumberBetween<
+              std::size_t>(0, centres.size() - 1, engine)];
+          coords = Coordinates{Clamp(centre.x + offset(engine), bounds.x), 0,
+                               Clamp(centre.z + offset(engine), bounds.z)};
+          break;
+        }
+        case Layout::kPoissonDisc:
+          break;
+        }
+      }
+    }
+  });
+}
+
+// Dart throwing over square tiles of an acceleration grid whose cells hold at
+// most one boid. Tiles are coloured in a 2x2 pattern; tiles of one colour are
+// a whole tile apart, further than any disc reaches, so all tiles of a colour
+// are filled in parallel and then the next colour sees their boids. Returns
+// the number of boids placed, which may fall short of the request.
+inline std::size_t FillPoissonDisc(const Parameters &parameters,
+                                   Threading::ThreadPool &pool,
+                                   Buffers &buffers) {
+  const auto &bounds = parameters.world_bounds;
+  const std::size_t count = parameters.entity_count;
+  const double area = bounds.x * bounds.z;
+  // N discs of radius d / 2 cover kPoissonDiscCoverage of the area
+  const double min_distance =
+      2 * std::sqrt(kPoissonDiscCoverage * area / (kPi * count));
+  const double cell_size = min_distance / std::sqrt(2.0);
+  const int columns =
+      std::max(1, static_cast<int>(std::ceil(bounds.x / cell_size)));
+  const int rows =
+      std::max(1, static_cast<int>(std::ceil(bounds.z / cell_size)));
+  const double cell_x = bounds.x / columns;
+  const double cell_z = bounds.z / rows;
+  // How many cells away a boid closer than min_distance can be
+  const int reach = static_cast<int>(
+      std::ceil(min_distance / std::min(cell_x, cell_z)));
+  const int tile_columns =
+      (columns + kPoissonDiscTileCells - 1) / kPoissonDiscTileCells;
+  const int tile_rows =
+      (rows + kPoissonDiscTileCells - 1) / kPoissonDiscTileCells;
+  const std::size_t tile_count =
+      static_cast<std::size_t>(tile_columns) * tile_rows;
+
+  // The boids each tile is asked for, in proportion to its area
+  std::vector<std::size_t> targets(tile_count);
+  std::vector<std::vector<Coordinates>> placed(tile_count);
+  for (int tile_row = 0; tile_row < tile_rows; ++tile_row) {
+    for (int tile_column = 0; tile_column < tile_columns; ++tile_column) {
+      const int width = std::min(kPoissonDiscTileCells,
+                                 columns - tile_column * kPoissonDiscTileCells);
+      const int height = std::min(kPoissonDiscTileCells,
+                                  rows - tile_row * kPoissonDiscTileCells);
+      const auto tile =
+          static_cast<std::size_t>(tile_row) * tile_columns + tile_column;
+      targets[tile] = static_cast<std::size_t>(width) * height;
+    }
+  }
+  // Spread the request over the tiles by largest remainder
+  const double cells = static_cast<double>(columns) * rows;
+  std::size_t assigned = 0;
+  for (auto &target : targets) {
+    const double share = static_cast<double>(target) * count / cells;
+    target = static_cast<std::size_t>(share);
+    assigned += target;
+  }
+  for (std::size_t tile = 0; assigned < count; tile = (tile + 1) % tile_count) {
+    ++targets[tile];
+    ++assigned;
+  }
+
+  // Index + 1 of the boid in each cell (within its tile's list), or 0
+  std::vector<std::uint32_t> grid(static_cast<std::size_t>(columns) * rows, 0);
+  std::vector<std::uint32_t> owner(grid.size(), 0);
+  const double min_distance_sq = min_distance * min_distance;
+
+  for (int colour = 0; colour < 4; ++colour) {
+    std::vector<std::size_t> tiles;
+    for (int tile_row = colour / 2; tile_row < tile_rows; tile_row += 2) {
+      for (int tile_column = colour % 2; tile_column < tile_columns;
+           tile_column += 2) {
+        tiles.push_back(static_cast<std::size_t>(tile_row) * tile_columns +
+                        tile_column);
+      }
+    }
+
+    pool.ParallelFor(tiles.size(), 1, [&](std::size_t begin, std::size_t end) {
+      for (std::size_t t = begin; t < end; ++t) {
+        const std::size_t tile = tiles[t];
+        const int column_begin =
+            static_cast<int>(tile % tile_columns) * kPoissonDiscTileCells;
+        const int row_begin =
+            static_cast<int>(tile / tile_columns) * kPoissonDiscTileCells;
+        const int column_end =
+            std::min(columns, column_begin + kPoissonDiscTileCells);
+        const int row_end = std::min(rows, row_begin + kPoissonDiscTileCells);
+
+        Random::Xoshiro256 engine(parameters.seed, tile);
+        auto &points = placed[tile];
+        points.reserve(targets[tile]);
+        for (std::size_t attempt = 0;
+             points.size() < targets[tile] &&
+             attempt < kPoissonDiscAttempts * targets[tile];
+             ++attempt) {
+          const double x = Random::generateNumberBetween(
+              column_begin * cell_x, column_end * cell_x, engine);
+          const double z = Random::generateNumberBetween(
+              row_begin * cell_z, row_end * cell_z, engine);
+          const int column = std::min(column_end - 1,
+                                      static_cast<int>(x / cell_x));
+          const int row = std::min(row_end - 1, static_cast<int>(z / cell_z));
+          if (grid[static_cast<std::size_t>(row) * columns + column]) {
+            continue;
+          }
+
+          // A cell is no wider than min_distance / sqrt(2), so it holds at
+          // most one boid
+          bool clear = true;
+          for (int r = std::max(0, row - reach);
+               clear && r <= std::min(rows - 1, row + reach); ++r) {
+            for (int c = std::max(0, column - reach);
+                 c <= std::min(columns - 1, column + reach); ++c) {
+              const auto cell = static_cast<std::size_t>(r) * columns + c;
+              if (const auto slot = grid[cell]) {
+                const auto &other = placed[owner[cell]][slot - 1];
+                const double dx = other.x - x;
+                const double dz = other.z - z;
+                if (dx * dx + dz * dz < min_distance_sq) {
+                  clear = false;
+                  break;
+                }
+              }
+            }
+          }
+          if (!clear) {
+            continue;
+          }
+          points.push_back(Coordinates{x, 0, z});
+          const auto cell = static_cast<std::size_t>(row) * columns + column;
+          grid[cell] = static_cast<std::uint32_t>(points.size());
+          owner[cell] = static_cast<std::uint32_t>(tile);
+        }
+      }
+    });
+  }
+
+  std::size_t filled = 0;
+  for (const auto &points : placed) {
+    for (const auto &point : points) {
+      buffers.positions[filled++].coords = Coordinates{
+          point.x - bounds.x / 2, point.y, point.z - bounds.z / 2};
+    }
+  }
+  return filled;
+}
+
+} // namespace Internal
+
+// Generates the initial components of `parameters.entity_count` boids on the
+// pool's threads. Returns the number generated, which only falls short of the
+// request if a Poisson-disc layout could not fit every boid.
+inline std::size_t Generate(const Parameters &parameters,
+                            Threading::ThreadPool &pool, Buffers &buffers) {
+  const std::size_t count = parameters.entity_count;
+  buffers.positions.resize(count);
+  buffers.velocities.resize(count);
+  buffers.accelerations.assign(count, Acceleration{parameters.acceleration});
+
+  std::size_t generated = count;
+  if (parameters.layout == Layout::kPoissonDisc && count > 0) {
+    generated = Internal::FillPoissonDisc(parameters, pool, buffers);
+  } else {
+    Internal::FillPositions(parameters, pool, buffers);
+  }
+  buffers.positions.resize(generated);
+  buffers.velocities.resize(generated);
+  buffers.accelerations.resize(generated);
+
+  // Velocity components are a pure function of the boid's index, filled a
+  // block at a time
+  static_assert(sizeof(Velocity) == 3 * sizeof(double),
+                "Velocity must be three packed doubles");
+  const Random::CounterRng velocity_x(parameters.seed,
+                                      Internal::kVelocityXStream);
+  const Random::CounterRng velocity_z(parameters.seed,
+                                      Internal::kVelocityZStream);
+  const std::size_t blocks =
+      (generated + Internal::kBlockSize - 1) / Internal::kBlockSize;
+  pool.ParallelFor(blocks, 1, [&](std::size_t block_begin,
+                                  std::size_t block_end) {
+    const std::size_t begin = block_begin * Internal::kBlockSize;
+    const std::size_t end =
+        std::min(generated, block_end * Internal::kBlockSize);
+    auto *components = &buffers.velocities[begin].value.x;
+    Random::FillUniformStrided(velocity_x, begin, parameters.min_velocity,
+                               parameters.max_velocity, components, 3,
+                               end - begin);
+    for (std::size_t i = begin; i < end; ++i) {
+      buffers.velocities[i].value.y = 0;
+    }
+    Random::FillUniformStrided(velocity_z, begin, parameters.min_velocity,
+                               parameters.max_velocity, components + 2, 3,
+                               end - begin);
+  });
+  return generated;
+}
+
+// Creates an entity for every boid in `buffers`, writable by `layer`. The
+// entities appear on the next tick.
+inline System_StatusCode Submit(System_Handle system_handle,
+                                Buffers &buffers, const char *layer) {
+  for (std::size_t i = 0; i < buffers.size(); ++i) {
+    auto components =
+        Components::Instances(layer, buffers.positions[i],
+                              buffers.velocities[i], buffers.accelerations[i]);
+    if (auto rc = System_CreateEntity(system_handle, components.data(),
+                                      components.size());
+        rc != SYSTEM_STATUS_CODE_SUCCESS) {
+      return rc;
+    }
+  }
+  return SYSTEM_STATUS_CODE_SUCCESS;
+}
+
+} // namespace Spawn
+
+#endif // SPAWN_H
@@ -0,0 +1,216 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Threading {
+
+// A fixed set of worker threads that live for the whole simulation and run
+// data-parallel loops. Each loop's index space is split evenly between the
+// participants up front; a participant takes `grain`-sized chunks from the
+// front of its own range and, once that is empty, steals the back half of
+// another participant's range. Dense regions of the flock therefore do not
+// leave the other threads idle.
+class ThreadPool {
+public:
+  // `thread_count` is the number of participants including the thread that
+  // calls ParallelFor, so a count of 1 runs everything inline
+  explicit ThreadPool(std::size_t thread_count)
+      : queues_(new WorkQueue[thread_count > 0 ? thread_count : 1]) {
+    for (std::size_t worker = 1; worker < thread_count; ++worker) {
+      threads_.emplace_back([this, worker] { WorkerLoop(worker); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto &thread : threads_) {
+      thread.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  std::size_t thread_count() const { return threads_.size() + 1; }
+
+  // Calls `body(begin, end)` over disjoint chunks covering [0, count), at
+  // most `grain` items each, and returns once every chunk has run. `body` is
+  // called concurrently from several threads. Only one loop may run at a time.
+  template <typename Body>
+  void ParallelFor(std::size_t count, std::size_t grain, Body &&body) {
+    if (count == 0) {
+      return;
+    }
+    if (threads_.empty() || count <= grain) {
+      body(std::size_t{0}, count);
+      return;
+    }
+    using BodyType = std::remove_reference_t<Body>;
+    Run(
+        count, grain > 0 ? grain : 1,
+        [](void *context, std::size_t begin, std::size_t end) {
+          (*static_cast<BodyType *>(context))(begin, end);
+        },
+        const_cast<void *>(static_cast<const void *>(&body)));
+  }
+
+private:
+  using ChunkFunction = void (*)(void *, std::size_t, std::size_t);
+
+  // A participant's remaining range, packed as (begin, end) into one word so
+  // the owner and thieves can both claim work with a single compare-exchange
+  struct alignas(64) WorkQueue {
+    std::atomic<std::uint64_t> range{0};
+  };
+
+  static std::uint64_t Pack(std::uint64_t begin, std::uint64_t end) {
+    return begin | (end << 32);
+  }
+  static std::size_t Begin(std::uint64_t range) { return range & 0xFFFFFFFFu; }
+  static std::size_t End(std::uint64_t range) { return range >> 32; }
+
+  void Run(std::size_t count, std::size_t grain, ChunkFunction function,
+           void *context) {
+    const std::size_t participants = thread_count();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (std::size_t worker = 0; worker < participants; ++worker) {
+        queues_[worker].range.store(
+            Pack(count * worker / participants,
+                 count * (worker + 1) / participants),
+            std::memory_order_relaxed);
+      }
+      function_ = function;
+      context_ = context;
+      grain_ = grain;
+      remaining_.store(count, std::memory_order_relaxed);
+      busy_workers_ = threads_.size();
+      ++generation_;
+    }
+    wake_.notify_all();
+
+    Work(0);
+
+    // Workers may still be scanning for work to steal; the queues cannot be
+    // reset for the next loop until all of them have left this one
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return busy_workers_ == 0; });
+  }
+
+  void WorkerLoop(std::size_t worker) {
+    std::uint64_t seen_generation = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&] {
+          return stopping_ || generation_ != seen_generation;
+        });
+        if (stopping_) {
+          return;
+        }
+        seen_generation = generation_;
+      }
+
+      Work(worker);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--busy_workers_ == 0) {
+        done_.notify_one();
+      }
+    }
+  }
+
+  void Work(std::size_t worker) {
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    for (;;) {
+      if (TakeFront(worker, begin, end) || Steal(worker, begin, end)) {
+        function_(context_, begin, end);
+        remaining_.fetch_sub(end - begin, std::memory_order_acq_rel);
+        continue;
+      }
+      if (remaining_.load(std::memory_order_acquire) == 0) {
+        return;
+      }
+      // Every range is empty but the last chunks are still running
+      std::this_thread::yield();
+    }
+  }
+
+  bool TakeFront(std::size_t worker, std::size_t &begin, std::size_t &end) {
+    auto &range = queues_[worker].range;
+    auto current = range.load(std::memory_order_acquire);
+    for (;;) {
+      const auto front = Begin(current);
+      const auto back = End(current);
+      if (front >= back) {
+        return false;
+      }
+      const auto split = front + grain_ < back ? front + grain_ : back;
+      if (range.compare_exchange_weak(current, Pack(split, back),
+                                      std::memory_order_acq_rel)) {
+        begin = front;
+        end = split;
+        return true;
+      }
+    }
+  }
+
+  // Moves the back half of the first non-empty victim range into this
+  // worker's own (empty) range and takes a chunk from it
+  bool Steal(std::size_t thief, std::size_t &begin, std::size_t &end) {
+    const std::size_t participants = thread_count();
+    for (std::size_t offset = 1; offset < participants; ++offset) {
+      auto &range = queues_[(thief + offset) % participants].range;
+      auto current = range.load(std::memory_order_acquire);
+      for (;;) {
+        const auto front = Begin(current);
+        const auto back = End(current);
+        if (front >= back) {
+          break;
+        }
+        const auto middle = front + (back - front) / 2;
+        if (range.compare_exchange_weak(current, Pack(front, middle),
+                                        std::memory_order_acq_rel)) {
+          queues_[thief].range.store(Pack(middle, back),
+                                     std::memory_order_release);
+          return TakeFront(thief, begin, end);
+        }
+      }
+    }
+    return false;
+  }
+
+  std::unique_ptr<WorkQueue[]> queues_;
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  std::uint64_t generation_ = 0;
+  std::size_t busy_workers_ = 0;
+  bool stopping_ = false;
+
+  // The loop currently running; written under `mutex_` before workers wake
+  ChunkFunction function_ = nullptr;
+  void *context_ = nullptr;
+  std::size_t grain_ = 1;
+  std::atomic<std::size_t> remaining_{0};
+};
+
+} // namespace Threading
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,265 @@
+#ifndef TICK_PROFILER_H
+#define TICK_PROFILER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+// Build with -DMOVEMENT_PROFILING=0 to compile the profiler out: phase scopes
+// expand to nothing and the profiler never records, whatever the
+// configuration asks for.
+#ifndef MOVEMENT_PROFILING
+#define MOVEMENT_PROFILING 1
+#endif
+
+namespace Profiling {
+
+// The stages of a tick, in the order they run
+enum class Phase : std::uint8_t {
+  // Reading the system's boids from the runtime
+  kGather,
+  // Querying every boid for the neighbour snapshot and indexing it
+  kNeighbours,
+  // The flocking compute, over every sub-step
+  kSteering,
+  kHash,
+  // Sending the results to the runtime
+  kStore,
+  // Sending the tick's log messages to the runtime
+  kLogFlush,
+};
+
+constexpr std::size_t kPhaseCount = 6;
+
+inline const char *ToString(Phase phase) {
+  switch (phase) {
+  case Phase::kGather:
+    return "gather";
+  case Phase::kNeighbours:
+    return "neighbours";
+  case Phase::kSteering:
+    return "steering";
+  case Phase::kHash:
+    return "hash";
+  case Phase::kStore:
+    return "store";
+  case Phase::kLogFlush:
+    return "log flush";
+  }
+  return "unknown";
+}
+
+// Counts recorded alongside a tick's timings
+struct TickCounters {
+  std::uint64_t boids = 0;
+  std::uint64_t neighbours = 0;
+  std::uint32_t substeps = 0;
+  bool neighbour_lists_rebuilt = false;
+};
+
+// One tick's timings, in nanoseconds since the profiler was created. A phase
+// that did not run has a start of -1; one that ran more than once keeps its
+// first start and its total duration.
+struct TickRecord {
+  std::uint64_t tick = 0;
+  std::int64_t start_ns = 0;
+  std::int64_t duration_ns = 0;
+  std::int64_t phase_start_ns[kPhaseCount];
+  std::int64_t phase_ns[kPhaseCount];
+  TickCounters counters;
+};
+
+// Mean and worst timings over a run of ticks, in milliseconds
+struct Summary {
+  std::size_t ticks = 0;
+  double mean_tick_ms = 0;
+  double max_tick_ms = 0;
+  double mean_phase_ms[kPhaseCount] = {};
+};
+
+// Records the timings of the last `capacity` ticks into a ring allocated up
+// front, so recording never allocates. Only the tick thread records: phases
+// time the tick thread's view of a stage, including any time it spends
+// waiting for the worker pool.
+class TickProfiler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // A capacity of 0 disables the profiler
+  explicit TickProfiler(std::size_t capacity)
+      : capacity_(MOVEMENT_PROFILING ? capacity : 0),
+        records_(capacity_ > 0 ? std::make_unique<TickRecord[]>(capacity_)
+                               : nullptr),
+        epoch_(Clock::now()) {}
+
+  bool enabled() const { return MOVEMENT_PROFILING && capacity_ > 0; }
+  std::size_t capacity() const { return capacity_; }
+
+  std::int64_t Now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                epoch_)
+        .count();
+  }
+
+  // Starts recording tick number `tick`. A tick that is begun but never
+  // ended, because it failed, is not kept.
+  void BeginTick(std::uint64_t tick) {
+    if (!enabled()) {
+      return;
+    }
+    current_.tick = tick;
+    current_.start_ns = Now();
+    std::fill(current_.phase_start_ns, current_.phase_start_ns + kPhaseCount,
+              -1);
+    std::fill(current_.phase_ns, current_.phase_ns + kPhaseCount, 0);
+  }
+
+  void Record(Phase phase, std::int64_t start_ns, std::int64_t end_ns) {
+    const auto index = static_cast<std::size_t>(phase);
+    if (current_.phase_start_ns[index] < 0) {
+      current_.phase_start_ns[index] = start_ns;
+    }
+    current_.phase_ns[index] += end_ns - start_ns;
+  }
+
+  // Keeps the current tick, overwriting the oldest kept once the ring is full
+  void EndTick(const TickCounters &counters) {
+    if (!enabled()) {
+      return;
+    }
+    current_.duration_ns = Now() - current_.start_ns;
+    current_.counters = counters;
+    records_[recorded_ % capacity_] = current_;
+    ++recorded_;
+  }
+
+  // Ticks ended so far, and how many of the latest of them are kept
+  std::uint64_t recorded() const { return recorded_; }
+  std::size_t kept() const {
+    return static_cast<std::size_t>(
+        std::min<std::uint64_t>(recorded_, capacity_));
+  }
+
+  // The i-th oldest kept tick
+  const TickRecord &record(std::size_t i) const {
+    return records_[(recorded_ - kept() + i) % capacity_];
+  }
+
+  // Timings over the last `ticks` kept ticks, or all of them if fewer are kept
+  Summary Summarise(std::size_t ticks) const {
+    Summary summary;
+    summary.ticks = std::min(ticks, kept());
+    for (std::size_t i = kept() - summary.ticks; i < kept(); ++i) {
+      const auto &tick = record(i);
+      const double tick_ms = tick.duration_ns / 1e6;
+      summary.mean_tick_ms += tick_ms;
+      summary.max_tick_ms = std::max(summary.max_tick_ms, tick_ms);
+      for (std::size_t phase = 0; phase < kPhaseCount; ++phase) {
+        summary.mean_phase_ms[phase] += tick.phase_ns[phase] / 1e6;
+      }
+    }
+    if (summary.ticks > 0) {
+      const double ticks_kept = static_cast<double>(summary.ticks);
+      summary.mean_tick_ms /= ticks_kept;
+      for (auto &phase_ms : summary.mean_phase_ms) {
+        phase_ms /= ticks_kept;
+      }
+    }
+    return summary;
+  }
+
+  // Writes the kept ticks in the Chrome trace event format, for
+  // chrome://tracing or Perfetto: a slice per tick holding a slice per phase,
+  // and counter tracks for the boids and neighbours of each tick
+  void WriteChromeTrace(std::FILE *file) const {
+    std::fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    const char *separator = "";
+    for (std::size_t i = 0; i < kept(); ++i) {
+      const auto &tick = record(i);
+      const auto &counters = tick.counters;
+      std::fprintf(file,
+                   "%s{\"name\": \"tick\", \"cat\": \"movement\", \"ph\": "
+                   "\"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f, \"dur\": "
+                   "%.3f, \"args\": {\"tick\": %llu, \"substeps\": %u, "
+                   "\"neighbour_lists_rebuilt\": %s}}",
+                   separator, tick.start_ns / 1e3, tick.duration_ns / 1e3,
+                   static_cast<unsigned long long>(tick.tick),
+                   counters.substeps,
+                   counters.neighbour_lists_rebuilt ? "true" : "false");
+      separator = ",\n";
+      for (std::size_t phase = 0; phase < kPhaseCount; ++phase) {
+        if (tick.phase_start_ns[phase] < 0) {
+          continue;
+        }
+        std::fprintf(file,
+                     "%s{\"name\": \"%s\", \"cat\": \"movement\", \"ph\": "
+                     "\"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f, \"dur\": "
+                     "%.3f}",
+                     separator, ToString(static_cast<Phase>(phase)),
+                     tick.phase_start_ns[phase] / 1e3,
+                     tick.phase_ns[phase] / 1e3);
+      }
+      std::fprintf(file,
+                   "%s{\"name\": \"boids\", \"ph\": \"C\", \"pid\": 1, "
+                   "\"ts\": %.3f, \"args\": {\"boids\": %llu, "
+                   "\"neighbours\": %llu}}",
+                   separator, tick.start_ns / 1e3,
+                   static_cast<unsigned long long>(counters.boids),
+                   static_cast<unsigned long long>(counters.neighbours));
+    }
+    std::fprintf(file, "\n]}\n");
+  }
+
+private:
+  std::size_t capacity_;
+  std::unique_ptr<TickRecord[]> records_;
+  std::uint64_t recorded_ = 0;
+  TickRecord current_;
+  Clock::time_point epoch_;
+};
+
+// Records the time from its construction to its destruction as `phase` of
+// the profiler's current tick
+class PhaseScope {
+public:
+  PhaseScope(TickProfiler &profiler, Phase phase)
+      : profiler_(profiler.enabled() ? &profiler : nullptr), phase_(phase),
+        start_ns_(profiler_ ? profiler_->Now() : 0) {}
+  ~PhaseScope() {
+    if (profiler_) {
+      profiler_->Record(phase_, start_ns_, profiler_->Now());
+    }
+  }
+
+  PhaseScope(const PhaseScope &) = delete;
+  PhaseScope &operator=(const PhaseScope &) = delete;
+
+private:
+  TickProfiler *profiler_;
+  Phase phase_;
+  std::int64_t start_ns_;
+};
+
+} // namespace Profiling
+
+#define MOVEMENT_PROFILE_CONCAT_(a, b) a##b
+#define MOVEMENT_PROFILE_CONCAT(a, b) MOVEMENT_PROFILE_CONCAT_(a, b)
+
+// Times the rest of the enclosing scope as `phase` (a Profiling::Phase) of
+// the current tick
+#if MOVEMENT_PROFILING
+#define MOVEMENT_PROFILE_PHASE(profiler, phase)                                \
+  ::Profiling::PhaseScope MOVEMENT_PROFILE_CONCAT(movement_profile_phase_,     \
+                                                  __LINE__) {                  \
+    profiler, phase                                                            \
+  }
+#else
+#define MOVEMENT_PROFILE_PHASE(profiler, phase)                                \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#endif // TICK_PROFILER_H
@@ -98,6 +98,118 @@ DLL_PUBLIC System_Query_Handle System_Query_Create(System_Query_Constraint* cons
  */
 DLL_PUBLIC System_StatusCode System_Query_Destroy(System_Query_Handle query_handle);
 
+/* ---------------------------------------------------------------------------------------------- *
+ * COMPOUND CONSTRAINTS                                                                           *
+ *                                                                                                *
+ * Extension. Box, cylinder, and and or constraints, mirroring the standard library's             *
+ * ComponentInterest.QueryConstraint, so that a query such as "boids within a radius" is          *
+ * evaluated by the Runtime instead of being filtered by the System. They have their own          *
+ * constraint type and entry point, so System_Query_Constraint and System_Query_Create are        *
+ * unchanged. Runtimes that do not support them do not export System_Query_CreateCompound, so a   *
+ * System that must also run in such a Runtime should resolve it when it is loaded, for example   *
+ * as a weak symbol, and fall back to System_Query_Create when it is missing.                     *
+ * ---------------------------------------------------------------------------------------------- */
+
+#define SYSTEM_QUERY_COMPOUND_CONSTRAINTS 1
+
+typedef enum System_Query_CompoundConstraintType {
+  // A simple constraint will match the entities its System_Query_Constraint matches.
+  SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_SIMPLE,
+  // An absolute box constraint will match any entities whose `Position` component is within the
+  // axis-aligned box with the given center and edge lengths.
+  SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_ABSOLUTE_BOX,
+  // An absolute cylinder constraint will match any entities whose `Position` component is within
+  // the given radius of the center in the x-z plane, at any y. As in the standard library's
+  // CylinderConstraint, the cylinder is vertical and unbounded.
+  SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_ABSOLUTE_CYLINDER,
+  // An and constraint will match entities that match every one of its operands. With no operands
+  // it matches every entity.
+  SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_AND,
+  // An or constraint will match entities that match any of its operands. With no operands it
+  // matches nothing.
+  SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_OR,
+} System_Query_CompoundConstraintType;
+
+typedef struct System_Query_Constraint_AbsoluteBox {
+  System_Double3 center;
+  System_Double3 edge_length;
+} System_Query_Constraint_AbsoluteBox;
+
+typedef struct System_Query_Constraint_AbsoluteCylinder {
+  System_Double3 center;
+  double radius;
+} System_Query_Constraint_AbsoluteCylinder;
+
+typedef struct System_Query_CompoundConstraint {
+  uint8_t constraint_type;
+  System_Query_Constraint simple_constraint;
+  System_Query_Constraint_AbsoluteBox absolute_box_constraint;
+  System_Query_Constraint_AbsoluteCylinder absolute_cylinder_constraint;
+  // The operands of an and or or constraint. They are not copied, and must outlive any call that
+  // is passed the compound constraint. Compound constraints may nest.
+  const struct System_Query_CompoundConstraint* operands;
+  uint32_t operand_count;
+} System_Query_CompoundConstraint;
+
+/*
+ * Helper functions to create compound constraints. They are defined here rather than by the
+ * Runtime, so using them does not depend on the extension being present.
+ */
+static inline System_Query_CompoundConstraint
+System_Query_CompoundConstraint_CreateSimple(System_Query_Constraint constraint) {
+  System_Query_CompoundConstraint compound = {};
+  compound.constraint_type = SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_SIMPLE;
+  compound.simple_constraint = constraint;
+  return compound;
+}
+
+static inline System_Query_CompoundConstraint
+System_Query_CompoundConstraint_CreateAbsoluteBox(System_Double3 center,
+                                                  System_Double3 edge_length) {
+  System_Query_CompoundConstraint compound = {};
+  compound.constraint_type = SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_ABSOLUTE_BOX;
+  compound.absolute_box_constraint.center = center;
+  compound.absolute_box_constraint.edge_length = edge_length;
+  return compound;
+}
+
+static inline System_Query_CompoundConstraint
+System_Query_CompoundConstraint_CreateAbsoluteCylinder(System_Double3 center, double radius) {
+  System_Query_CompoundConstraint compound = {};
+  compound.constraint_type = SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_ABSOLUTE_CYLINDER;
+  compound.absolute_cylinder_constraint.center = center;
+  compound.absolute_cylinder_constraint.radius = radius;
+  return compound;
+}
+
+static inline System_Query_CompoundConstraint
+System_Query_CompoundConstraint_CreateAnd(const System_Query_CompoundConstraint* operands,
+                                          uint32_t operand_count) {
+  System_Query_CompoundConstraint compound = {};
+  compound.constraint_type = SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_AND;
+  compound.operands = operands;
+  compound.operand_count = operand_count;
+  return compound;
+}
+
+static inline System_Query_CompoundConstraint
+System_Query_CompoundConstraint_CreateOr(const System_Query_CompoundConstraint* operands,
+                                         uint32_t operand_count) {
+  System_Query_CompoundConstraint compound = {};
+  compound.constraint_type = SYSTEM_QUERY_COMPOUND_CONSTRAINT_TYPE_OR;
+  compound.operands = operands;
+  compound.operand_count = operand_count;
+  return compound;
+}
+
+/*
+ * Creates a query for a compound constraint, as System_Query_Create does for a simple one. If
+ * creation fails, including for a constraint of an unknown type, a nullptr is returned. The handle
+ * is used and destroyed like any other query's.
+ */
+DLL_PUBLIC System_Query_Handle
+System_Query_CreateCompound(const System_Query_CompoundConstraint* constraint);
+
 /* ---------------------------------------------------------------------------------------------- *
  * QUERY RESULT ITERATION                                                                         *
  * ---------------------------------------------------------------------------------------------- */
@@ -127,6 +239,68 @@ DLL_PUBLIC System_StatusCode System_Query_GetComponent(System_Query_Handle query
                                                        uint8_t* component_data_out,
                                                        uint32_t component_data_size);
 
+/*
+ * Extension, see BULK COMPONENT ACCESS in c_system.h. Starting at the current match, copies the
+ * columns for up to `max_entity_count` matches into their buffers, sets `entity_count_out` to the
+ * number copied and advances the query past them. Fails, without advancing, as
+ * System_GetComponentsBulk does.
+ */
+DLL_PUBLIC System_StatusCode System_Query_GetComponentsBulk(System_Query_Handle query_handle,
+                                                            const System_ComponentColumnType* columns,
+                                                            uint32_t column_count,
+                                                            uint32_t max_entity_count,
+                                                            uint32_t* entity_count_out);
+
+/*
+ * Extension, see ENTITY INDICES in c_system.h. Starting at the current match, writes the indices of
+ * up to `max_entity_count` matches to `entity_indices_out`, sets `entity_count_out` to the number
+ * written and advances the query past them.
+ */
+DLL_PUBLIC System_StatusCode System_Query_GetEntityIndices(System_Query_Handle query_handle,
+                                                           System_EntityIndex* entity_indices_out,
+                                                           uint32_t max_entity_count,
+                                                           uint32_t* entity_count_out);
+
+/* ---------------------------------------------------------------------------------------------- *
+ * BATCHED SPHERE QUERIES                                                                         *
+ *                                                                                                *
+ * Extension, see BULK COMPONENT ACCESS in c_system.h. Evaluates many absolute sphere constraints *
+ * in one call, such as one per boid for its neighbours, instead of creating and iterating a      *
+ * query per sphere. Runtimes that do not support it do not export System_Query_SphereBatch.      *
+ * ---------------------------------------------------------------------------------------------- */
+
+/*
+ * Where System_Query_SphereBatch writes its results, in compressed sparse row form. The caller owns
+ * every buffer.
+ */
+typedef struct System_Query_SphereBatchResult {
+  // sphere_count + 1 entries. The matches of sphere i are entries [offsets[i], offsets[i + 1]) of
+  // entity_indices and of every column, so offsets[sphere_count] is the total number of matches.
+  uint32_t* offsets;
+  // match_capacity entries, or null if the caller only wants the columns
+  System_EntityIndex* entity_indices;
+  // Components to copy for each match; each column's buffer holds match_capacity entries
+  const System_ComponentColumnType* columns;
+  uint32_t column_count;
+  uint32_t match_capacity;
+  // Set to the total number of matches across all spheres
+  uint32_t match_count;
+} System_Query_SphereBatchResult;
+
+/*
+ * Finds, for each of the `sphere_count` spheres, the entities an absolute sphere constraint with the
+ * same center and radius would match, in ascending entity index order, and copies the requested
+ * columns for each match. An entity within several spheres is reported once for each.
+ *
+ * If the matches do not fit in match_capacity, only `offsets` and `match_count` are written and
+ * SYSTEM_STATUS_CODE_OUT_OF_RANGE is returned, so the caller can grow its buffers and retry; a call
+ * with a match_capacity of 0 sizes the result without copying anything. Every match must have the
+ * components named by the columns.
+ */
+DLL_PUBLIC System_StatusCode
+System_Query_SphereBatch(const System_Query_Constraint_AbsoluteSphere* spheres,
+                         uint32_t sphere_count, System_Query_SphereBatchResult* result);
+
 #ifdef __cplusplus
 }
 #endif  //__cplusplus
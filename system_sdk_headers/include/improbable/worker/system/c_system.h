@@ -128,6 +128,97 @@ DLL_PUBLIC System_StatusCode System_UpdateComponent(System_EntityIterator entity
                                                     uint8_t* component_data_in,
                                                     uint32_t component_data_size);
 
+/*
+ * BULK COMPONENT ACCESS
+ * -----------------------------------------------------------------------------
+ *
+ * Extension. Moves components for many entities in one call, between the
+ * Runtime and columnar buffers owned by the System, instead of one call per
+ * entity and component. Runtimes that do not support it do not export these
+ * functions, so a System that must also run in such a Runtime should resolve
+ * them when it is loaded, for example as weak symbols, and fall back to the
+ * per-entity calls above when they are missing.
+ */
+#define SYSTEM_BULK_COMPONENT_ACCESS 1
+
+/*
+ * One column of a bulk transfer: the bytes [field_offset, field_offset +
+ * field_size) of the given component, for consecutive entities. The k-th
+ * entity of the transfer is at data + k * stride; a stride of 0 means
+ * field_size, i.e. densely packed. A column may hold a whole component
+ * (field_offset 0 and field_size component_data_size) or one field of it,
+ * so that, for example, the x, y and z of a position can go to three
+ * separate arrays. component_data_size must be the size of the whole
+ * component, as for System_GetComponent.
+ */
+typedef struct System_ComponentColumn {
+  System_ComponentId component_id;
+  uint32_t component_data_size;
+  uint32_t field_offset;
+  uint32_t field_size;
+  uint8_t* data;
+  uint32_t stride;
+} System_ComponentColumnType;
+
+/*
+ * Starting at the EntityIterator's current entity, copies the columns for up
+ * to max_entity_count entities into their buffers, sets entity_count_out to
+ * the number copied and advances the EntityIterator past them. An iterator
+ * that has already finished copies no entities and succeeds.
+ *
+ * Every entity copied must have every component named by the columns. If
+ * any call fails, the EntityIterator is not advanced and the contents of the
+ * buffers are unspecified.
+ */
+DLL_PUBLIC System_StatusCode System_GetComponentsBulk(System_EntityIterator entity_iterator,
+                                                      const System_ComponentColumnType* columns,
+                                                      uint32_t column_count,
+                                                      uint32_t max_entity_count,
+                                                      uint32_t* entity_count_out);
+
+/*
+ * Starting at the EntityIterator's current entity, updates the components
+ * named by the columns for the next entity_count entities from their buffers,
+ * and advances the EntityIterator past them. Parts of a component that no
+ * column covers keep their current value, and with no columns at all the
+ * call only advances the EntityIterator. As with System_UpdateComponent,
+ * the updates are visible to Systems from their next tick.
+ *
+ * The whole update is checked before any of it is applied: if the call
+ * fails, nothing is updated and the EntityIterator is not advanced.
+ * entity_count must not exceed the number of entities left to iterate.
+ */
+DLL_PUBLIC System_StatusCode System_UpdateComponentsBulk(System_EntityIterator entity_iterator,
+                                                         const System_ComponentColumnType* columns,
+                                                         uint32_t column_count,
+                                                         uint32_t entity_count);
+
+/*
+ * ENTITY INDICES
+ * -----------------------------------------------------------------------------
+ *
+ * Extension. Reports which entities an EntityIterator or query visits, so a
+ * System can recognise them from one tick to the next and keep state for
+ * them instead of fetching it again. An entity's index does not change while
+ * it exists and is never given to another entity. Runtimes that do not
+ * support it do not export these functions, so a System that must also run
+ * in such a Runtime should resolve them when it is loaded and fetch its
+ * entities' components every tick when they are missing.
+ */
+#define SYSTEM_ENTITY_INDICES 1
+
+/*
+ * Starting at the EntityIterator's current entity, writes the indices of up
+ * to max_entity_count entities to entity_indices_out, sets entity_count_out
+ * to the number written and advances the EntityIterator past them, as
+ * System_GetComponentsBulk does. Copy the EntityIterator first to visit the
+ * same entities again.
+ */
+DLL_PUBLIC System_StatusCode System_GetEntityIndices(System_EntityIterator entity_iterator,
+                                                     System_EntityIndex* entity_indices_out,
+                                                     uint32_t max_entity_count,
+                                                     uint32_t* entity_count_out);
+
 /*
  * Add and Remove Components, Create and Delete Entities
  * -----------------------------------------------------------------------------